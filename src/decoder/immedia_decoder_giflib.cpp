@@ -1,11 +1,13 @@
 #include "immedia_decoder_giflib.h"
 
-#include <limits>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "gif_lib.h"
 
 #include "immedia_image.h"
+#include "immedia_pixel_convert.h"
 
 static void* CreateContextFromFile(void* f, size_t file_size);
 static void* CreateContextFromData(const uint8_t* data, size_t data_size);
@@ -15,6 +17,9 @@ static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
 static bool ReadNextFrame(void* context);
+static void* CreateContextFromSource(const ImMedia::ImageSource& source);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format);
 
 void ImMedia_DecoderGiflib_Install()
 {
@@ -24,26 +29,47 @@ void ImMedia_DecoderGiflib_Install()
         DeleteContext,
         GetInfo,
         ReadFrame,
-        ReadNextFrame
+        ReadNextFrame,
+        nullptr,
+        CreateContextFromSource,
+        Probe,
+        SetOutputFormat,
+        nullptr,
+        nullptr,
+        nullptr
     });
 }
 
+#ifdef IMMEDIA_DECODER_PLUGIN
+IMMEDIA_DECODER_PLUGIN_ENTRY
+{
+    ImMedia_DecoderGiflib_Install();
+}
+#endif
+
 
 
 struct Context
 {
     GifFileType* Gif;
     bool         HasAlpha;
+    ImMedia::PixelFormat Format;
 
     uint8_t*     FramePixels;
     int          FrameDelay;
     int          FrameIndex;
+
+    int          Background;  // Palette entry of pixels no frame has drawn, -1 if frames can't share an index canvas.
+    uint8_t*     Indices;     // Index canvas expanded into FramePixels, unless Format is Indexed8.
+    uint8_t      Palette[256 * 4];
 };
 
 
 static Context* GifRead(GifFileType* gif);
+static int GifSelectBackground(const Context* ctx);
 static int GifFileReadFunc(GifFileType* gif, GifByteType* buf, int len);
 static int GifDataReadFunc(GifFileType* gif, GifByteType* buf, int len);
+static int GifSourceReadFunc(GifFileType* gif, GifByteType* buf, int len);
 
 
 static void* CreateContextFromFile(void* f, size_t file_size)
@@ -62,12 +88,24 @@ static void* CreateContextFromData(const uint8_t* data, size_t data_size)
     return GifRead(DGifOpen(d, GifDataReadFunc, nullptr));
 }
 
+static void* CreateContextFromSource(const ImMedia::ImageSource& source)
+{
+    // Blocks are decoded as they are read from source.
+    Context* ctx = GifRead(DGifOpen(const_cast<ImMedia::ImageSource*>(&source), GifSourceReadFunc, nullptr));
+    if (ctx)
+        ctx->Gif->UserData = nullptr;
+    ImMedia::CloseImageSource(source);
+    return ctx;
+}
+
 static void DeleteContext(void* context)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
     DGifCloseFile(ctx->Gif, nullptr);
     if (ctx->FramePixels)
         delete[] ctx->FramePixels;
+    if (ctx->Indices)
+        delete[] ctx->Indices;
     delete ctx;
 }
 
@@ -79,11 +117,85 @@ static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat
     if (height)
         *height = ctx->Gif->SHeight;
     if (format)
-        *format = ctx->HasAlpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+        *format = ctx->Format;
     if (frame_count)
         *frame_count = ctx->Gif->ImageCount == 1 ? 0 : ctx->Gif->ImageCount;
 }
 
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (ctx->FramePixels || format != ImMedia::PixelFormat::Indexed8 || ctx->Background < 0)
+        return false;
+    ctx->Format = format;
+    return true;
+}
+
+// Returns offset after the block terminator, or data_size if data ends before.
+static size_t SkipGifSubBlocks(const uint8_t* data, size_t data_size, size_t p)
+{
+    while (p < data_size)
+    {
+        const uint8_t size = data[p];
+        p += (size_t)size + 1;
+        if (size == 0)
+            return p;
+    }
+    return data_size;
+}
+
+// Walks blocks in data without decompressing, frames are only counted if data reaches the trailer.
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    if (data_size < 13 || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0))
+        return false;
+
+    bool   has_alpha = false;
+    bool   complete  = false;
+    int    frames    = 0;
+    size_t p         = 13;
+    if (data[10] & 0x80)
+        p += (size_t)3 << ((data[10] & 0x07) + 1);
+    while (p < data_size)
+    {
+        const uint8_t block = data[p];
+        if (block == 0x3B)
+        {
+            complete = true;
+            break;
+        }
+        if (block == 0x21)
+        {
+            // Graphics control extension with transparent color flag.
+            if (p + 4 <= data_size && data[p + 1] == GRAPHICS_EXT_FUNC_CODE && (data[p + 3] & 0x01))
+                has_alpha = true;
+            p = SkipGifSubBlocks(data, data_size, p + 2);
+        }
+        else if (block == 0x2C)
+        {
+            if (data_size - p < 10)
+                break;
+            ++frames;
+            size_t next = p + 10;
+            if (data[p + 9] & 0x80)
+                next += (size_t)3 << ((data[p + 9] & 0x07) + 1);
+            p = SkipGifSubBlocks(data, data_size, next + 1);  // After LZW minimum code size.
+        }
+        else
+            break;
+    }
+
+    if (width)
+        *width = data[6] | (data[7] << 8);
+    if (height)
+        *height = data[8] | (data[9] << 8);
+    if (format)
+        *format = has_alpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+    if (frame_count)
+        *frame_count = !complete ? -1 : (frames > 1 ? frames : 0);
+    return true;
+}
+
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
@@ -97,11 +209,64 @@ static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
     return true;
 }
 
+// Frames are drawn on the index canvas, then only their rectangle is expanded if the output is not Indexed8.
+static void DrawIndexedFrame(Context* ctx, const SavedImage& frame, const GraphicsControlBlock& graphic_block)
+{
+    const int canvas_width  = ctx->Gif->SWidth;
+    const int canvas_height = ctx->Gif->SHeight;
+    const bool indexed      = ctx->Format == ImMedia::PixelFormat::Indexed8;
+    uint8_t* canvas = indexed ? ctx->FramePixels : ctx->Indices;
+
+    // Frames are clipped to the canvas.
+    const int left   = frame.ImageDesc.Left;
+    const int top    = frame.ImageDesc.Top;
+    const int width  = left + frame.ImageDesc.Width  > canvas_width  ? canvas_width  - left : frame.ImageDesc.Width;
+    const int height = top  + frame.ImageDesc.Height > canvas_height ? canvas_height - top  : frame.ImageDesc.Height;
+    if (left < 0 || top < 0 || width <= 0 || height <= 0)
+        return;
+
+    for (int y = 0; y < height; ++y)
+    {
+        const uint8_t* src = frame.RasterBits + (size_t)y * frame.ImageDesc.Width;
+        uint8_t*       dst = canvas + (size_t)(y + top) * canvas_width + left;
+        if (!ctx->HasAlpha || graphic_block.TransparentColor == NO_TRANSPARENT_COLOR)
+            memcpy(dst, src, (size_t)width);
+        else
+            for (int x = 0; x < width; ++x)
+                if (src[x] != graphic_block.TransparentColor)
+                    dst[x] = src[x];
+    }
+
+    if (indexed)
+        return;
+    const int pixel_size = PIXEL_FORMAT_SIZE(ctx->Format);
+    for (int y = top; y < top + height; ++y)
+        ImMedia::ExpandPalette(canvas + (size_t)y * canvas_width + left, ctx->Palette,
+                               ctx->FramePixels + ((size_t)y * canvas_width + left) * pixel_size, ctx->Format, (size_t)width);
+}
+
 static bool ReadNextFrame(void* context)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
 
-    if (!ctx->FramePixels)
+    if (!ctx->FramePixels && ctx->Background >= 0)
+    {
+        const size_t canvas_size = (size_t)ctx->Gif->SWidth * ctx->Gif->SHeight;
+        const size_t frame_size  = ImMedia::GetFrameSize(ctx->Gif->SWidth, ctx->Gif->SHeight, ctx->Format);
+        ctx->FramePixels = new uint8_t[frame_size];
+        memset(ctx->FramePixels, 0, frame_size);
+        if (ctx->Format == ImMedia::PixelFormat::Indexed8)
+        {
+            memset(ctx->FramePixels, ctx->Background, canvas_size);
+            memcpy(ctx->FramePixels + canvas_size, ctx->Palette, sizeof(ctx->Palette));
+        }
+        else
+        {
+            ctx->Indices = new uint8_t[canvas_size];
+            memset(ctx->Indices, ctx->Background, canvas_size);
+        }
+    }
+    else if (!ctx->FramePixels)
     {
         size_t frame_size = (size_t)ctx->Gif->SWidth * ctx->Gif->SHeight * (ctx->HasAlpha ? 4 : 3);
         ctx->FramePixels = new uint8_t[frame_size];
@@ -117,6 +282,14 @@ static bool ReadNextFrame(void* context)
 
     DGifSavedExtensionToGCB(ctx->Gif, ctx->FrameIndex, &graphic_block);
 
+    if (ctx->Background >= 0)
+    {
+        DrawIndexedFrame(ctx, frame, graphic_block);
+        ctx->FrameDelay = graphic_block.DelayTime * 10;
+        ctx->FrameIndex = (ctx->FrameIndex + 1) % ctx->Gif->ImageCount;
+        return true;
+    }
+
     for (size_t y = 0; y < frame.ImageDesc.Height; ++y)
     {
         for (size_t x = 0; x < frame.ImageDesc.Width; ++x)
@@ -161,23 +334,78 @@ static Context* GifRead(GifFileType* gif)
     Context* ctx = new Context();
     ctx->Gif = gif;
 
-    for (size_t i = 0; i < gif->ImageCount && ctx->HasAlpha == false; i++)
+    // Any frame with a transparent color makes the whole animation RGBA.
+    for (int i = 0; i < gif->ImageCount && ctx->HasAlpha == false; i++)
+    {
+        GraphicsControlBlock graphic_block;
+        if (DGifSavedExtensionToGCB(gif, i, &graphic_block) == GIF_OK)
+            ctx->HasAlpha = graphic_block.TransparentColor != NO_TRANSPARENT_COLOR;
+    }
+    ctx->Format = ctx->HasAlpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+    ctx->FramePixels = nullptr;
+    ctx->FrameIndex = 0;
+    ctx->FrameDelay = 0;
+    ctx->Indices = nullptr;
+    ctx->Background = GifSelectBackground(ctx);
+    if (ctx->Background >= 0)
+    {
+        const ColorMapObject* color_map = gif->SColorMap;
+        for (int i = 0; i < color_map->ColorCount; ++i)
+        {
+            uint8_t* color = ctx->Palette + i * 4;
+            color[0] = color_map->Colors[i].Red;
+            color[1] = color_map->Colors[i].Green;
+            color[2] = color_map->Colors[i].Blue;
+            color[3] = 0xFF;
+        }
+        // Undrawn pixels are transparent, or black for images without alpha.
+        if (ctx->HasAlpha || ctx->Background >= color_map->ColorCount)
+        {
+            uint8_t* color = ctx->Palette + ctx->Background * 4;
+            color[0] = color[1] = color[2] = 0;
+            color[3] = ctx->HasAlpha ? 0x00 : 0xFF;
+        }
+    }
+    return ctx;
+}
+
+// Frames share an index canvas if they all use the global color map and a palette entry is left for undrawn pixels:
+// the transparent color shared by every frame, an entry beyond the color map, or any if the first frame covers the canvas.
+static int GifSelectBackground(const Context* ctx)
+{
+    const GifFileType* gif = ctx->Gif;
+    if (!gif->SColorMap || gif->SColorMap->ColorCount <= 0 || gif->SColorMap->ColorCount > 256)
+        return -1;
+    for (int i = 0; i < gif->ImageCount; ++i)
+        if (gif->SavedImages[i].ImageDesc.ColorMap)
+            return -1;
+
+    if (ctx->HasAlpha)
     {
-        const SavedImage& image = gif->SavedImages[i];
-        for (size_t j = 0; j < image.ExtensionBlockCount; j++)
+        int shared_transparent = NO_TRANSPARENT_COLOR;
+        for (int i = 0; i < gif->ImageCount; ++i)
         {
-            const ExtensionBlock& block = image.ExtensionBlocks[j];
-            if (block.Function == GRAPHICS_EXT_FUNC_CODE)
+            GraphicsControlBlock graphic_block;
+            if (DGifSavedExtensionToGCB(const_cast<GifFileType*>(gif), i, &graphic_block) != GIF_OK
+                || graphic_block.TransparentColor == NO_TRANSPARENT_COLOR
+                || (i > 0 && graphic_block.TransparentColor != shared_transparent))
             {
-                ctx->HasAlpha = block.Bytes[4] != 0;
+                shared_transparent = NO_TRANSPARENT_COLOR;
                 break;
             }
+            shared_transparent = graphic_block.TransparentColor;
         }
+        if (shared_transparent != NO_TRANSPARENT_COLOR)
+            return shared_transparent;
     }
-    ctx->FramePixels = nullptr;
-    ctx->FrameIndex = 0;
-    ctx->FrameDelay = 0;
-    return ctx;
+
+    if (gif->SColorMap->ColorCount < 256)
+        return gif->SColorMap->ColorCount;
+
+    const GifImageDesc& first = gif->SavedImages[0].ImageDesc;
+    if (!ctx->HasAlpha && first.Left == 0 && first.Top == 0 && first.Width >= gif->SWidth && first.Height >= gif->SHeight)
+        return 0;
+    return -1;
 }
 
 static int GifFileReadFunc(GifFileType* gif, GifByteType* buf, int len)
@@ -202,3 +430,9 @@ static int GifDataReadFunc(GifFileType* gif, GifByteType* buf, int len)
     d[0] += l;
     return l;
 }
+
+static int GifSourceReadFunc(GifFileType* gif, GifByteType* buf, int len)
+{
+    const ImMedia::ImageSource* source = reinterpret_cast<const ImMedia::ImageSource*>(gif->UserData);
+    return (int)ImMedia::ReadImageSource(*source, buf, (size_t)len);
+}
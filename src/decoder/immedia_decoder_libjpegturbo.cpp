@@ -1,8 +1,10 @@
 #include "immedia_decoder_libjpegturbo.h"
 
+#include <setjmp.h>
 #include <stdio.h>
 
 #include "turbojpeg.h"
+#include "jpeglib.h"
 
 #include "immedia_image.h"
 
@@ -13,8 +15,13 @@ static void DeleteContext(void* context);
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static void* CreateContextFromSource(const ImMedia::ImageSource& source);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format);
+static ImMedia::ImageOrientation GetOrientation(void* context);
+static bool SetTargetSize(void* context, int width, int height);
 
-void ImMedia_DecoderLibjpegTurbo_Install()
+void ImMedia_DecoderLibjpegTurbo_Install(bool yuv_planes)
 {
     ImMedia::InstallImageDecoder("jpg", {
         CreateContextFromFile,
@@ -23,6 +30,13 @@ void ImMedia_DecoderLibjpegTurbo_Install()
         GetInfo,
         ReadFrame,
         nullptr,
+        nullptr,
+        CreateContextFromSource,
+        Probe,
+        yuv_planes ? SetOutputFormat : nullptr,
+        GetOrientation,
+        SetTargetSize,
+        nullptr
     });
     ImMedia::InstallImageDecoder("jpeg", {
         CreateContextFromFile,
@@ -31,23 +45,68 @@ void ImMedia_DecoderLibjpegTurbo_Install()
         GetInfo,
         ReadFrame,
         nullptr,
+        nullptr,
+        CreateContextFromSource,
+        Probe,
+        yuv_planes ? SetOutputFormat : nullptr,
+        GetOrientation,
+        SetTargetSize,
+        nullptr
     });
 }
 
+#ifdef IMMEDIA_DECODER_PLUGIN
+IMMEDIA_DECODER_PLUGIN_ENTRY
+{
+    ImMedia_DecoderLibjpegTurbo_Install(false);
+}
+#endif
+
 
 
+struct JPEGStream;
+
 struct Context
 {
     int      Width;
     int      Height;
+    ImMedia::PixelFormat Format;
+    ImMedia::ImageOrientation Orientation;
 
     tjhandle Handle;
     uint8_t* Buffer;
     size_t   BufferSize;
 
     uint8_t* Pixels;
+
+    JPEGStream* Stream;  // libjpeg decompressor reading from ImageSource, instead of Handle and Buffer.
 };
 
+static void JPEGStreamDelete(JPEGStream* stream);
+static bool JPEGStreamDecode(Context* ctx);
+static bool JPEGStreamSetTargetSize(Context* ctx, int width, int height);
+
+// Segments before the first scan are walked for an Exif APP1, pixels are oriented when shown, not here.
+static ImMedia::ImageOrientation FindOrientation(const uint8_t* data, size_t data_size)
+{
+    size_t offset = 2;
+    while (offset + 4 <= data_size && data[offset] == 0xFF)
+    {
+        const uint8_t marker = data[offset + 1];
+        const size_t  size   = (size_t)(data[offset + 2] << 8 | data[offset + 3]);
+        if (marker == 0xDA || size < 2 || offset + 2 + size > data_size)
+            break;
+        if (marker == 0xE1)
+        {
+            ImMedia::ImageOrientation orientation = ImMedia::ReadExifOrientation(data + offset + 4, size - 2);
+            if (orientation != ImMedia::ImageOrientation::Normal)
+                return orientation;
+        }
+        offset += 2 + size;
+    }
+    return ImMedia::ImageOrientation::Normal;
+}
+
 static Context* CreateContext(uint8_t* jpeg_buffer, size_t buffer_size)
 {
     tjhandle handle = tj3Init(TJINIT_DECOMPRESS);
@@ -62,9 +121,12 @@ static Context* CreateContext(uint8_t* jpeg_buffer, size_t buffer_size)
     return new Context {
         tj3Get(handle, TJPARAM_JPEGWIDTH),
         tj3Get(handle, TJPARAM_JPEGHEIGHT),
+        ImMedia::PixelFormat::RGB888,
+        FindOrientation(jpeg_buffer, buffer_size),
         handle,
         jpeg_buffer,
         buffer_size,
+        nullptr,
         nullptr
     };
 }
@@ -93,6 +155,8 @@ static void DeleteContext(void* context)
     if (ctx->Handle) tj3Destroy(ctx->Handle);
     if (ctx->Buffer) tj3Free(ctx->Buffer);
     if (ctx->Pixels) delete[] ctx->Pixels;
+    if (ctx->Stream) JPEGStreamDelete(ctx->Stream);
+    delete ctx;
 }
 
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
@@ -100,39 +164,133 @@ static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat
     Context* ctx = reinterpret_cast<Context*>(context);
     if (width) *width = ctx->Width;
     if (height) *height = ctx->Height;
-    if (format) *format = ImMedia::PixelFormat::RGB888;
+    if (format) *format = ctx->Format;
     if (frame_count) *frame_count = 0;
 }
 
+static ImMedia::ImageOrientation GetOrientation(void* context)
+{
+    return reinterpret_cast<Context*>(context)->Orientation;
+}
+
+// Planes are only emitted for 4:2:0 YCbCr images decoded by TurboJPEG, chroma is copied without upsampling.
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (ctx->Pixels)
+        return false;
+    if (format == ImMedia::PixelFormat::YUV420P
+        && (!ctx->Handle
+            || tj3Get(ctx->Handle, TJPARAM_SUBSAMP) != TJSAMP_420
+            || tj3Get(ctx->Handle, TJPARAM_COLORSPACE) != TJCS_YCbCr))
+        return false;
+    if (format != ImMedia::PixelFormat::YUV420P && format != ImMedia::PixelFormat::RGB888)
+        return false;
+    ctx->Format = format;
+    return true;
+}
+
+// Scaled in the IDCT, which is cheaper than decoding at full size and resizing.
+// The smallest factor is picked whose output still covers the image fitted in width x height.
+static tjscalingfactor FindScalingFactor(int image_width, int image_height, int width, int height)
+{
+    int count = 0;
+    const tjscalingfactor* factors = tj3GetScalingFactors(&count);
+
+    tjscalingfactor best = TJUNSCALED;
+    for (int i = 0; factors && i < count; ++i)
+    {
+        const tjscalingfactor factor = factors[i];
+        if (factor.num >= factor.denom)
+            continue;
+        const int scaled_width  = TJSCALED(image_width, factor);
+        const int scaled_height = TJSCALED(image_height, factor);
+        if ((scaled_width >= width || scaled_height >= height) && scaled_width < TJSCALED(image_width, best))
+            best = factor;
+    }
+    return best;
+}
+
+static bool SetTargetSize(void* context, int width, int height)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (ctx->Pixels || width <= 0 || height <= 0)
+        return false;
+
+    if (ctx->Handle)
+    {
+        const int image_width  = tj3Get(ctx->Handle, TJPARAM_JPEGWIDTH);
+        const int image_height = tj3Get(ctx->Handle, TJPARAM_JPEGHEIGHT);
+        const tjscalingfactor factor = FindScalingFactor(image_width, image_height, width, height);
+        if (tj3SetScalingFactor(ctx->Handle, factor) != 0)
+            return false;
+        ctx->Width  = TJSCALED(image_width, factor);
+        ctx->Height = TJSCALED(image_height, factor);
+        return factor.num != factor.denom;
+    }
+
+    return ctx->Stream && JPEGStreamSetTargetSize(ctx, width, height);
+}
+
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    tjhandle handle = tj3Init(TJINIT_DECOMPRESS);
+    if (!handle)
+        return false;
+
+    const bool valid = tj3DecompressHeader(handle, data, data_size) == 0;
+    if (valid)
+    {
+        if (width) *width = tj3Get(handle, TJPARAM_JPEGWIDTH);
+        if (height) *height = tj3Get(handle, TJPARAM_JPEGHEIGHT);
+        if (format) *format = ImMedia::PixelFormat::RGB888;
+        if (frame_count) *frame_count = 0;
+    }
+    tj3Destroy(handle);
+    return valid;
+}
+
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
 {
 #define DECODE_PIXEL_FORMAT TJPF_RGB
 
     Context* ctx = reinterpret_cast<Context*>(context);
 
+    if (ctx->Stream && !JPEGStreamDecode(ctx))
+        return false;
+
     if (!ctx->Handle && !ctx->Pixels)
         return false;
 
     if (!ctx->Pixels)
     {
-        ctx->Pixels = new uint8_t[ctx->Width * ctx->Height * tjPixelSize[DECODE_PIXEL_FORMAT]];
-        if (tj3Decompress8(ctx->Handle,
-                           ctx->Buffer, ctx->BufferSize,
-                           ctx->Pixels, ctx->Width * tjPixelSize[DECODE_PIXEL_FORMAT],
-                           DECODE_PIXEL_FORMAT) == 0)
+        int result;
+        if (ctx->Format == ImMedia::PixelFormat::YUV420P)
         {
-            tj3Destroy(ctx->Handle);
-            tj3Free(ctx->Buffer);
-            ctx->Handle = nullptr;
-            ctx->Buffer = nullptr;
+            const int    chroma_width = (ctx->Width + 1) / 2;
+            const size_t luma_size    = (size_t)ctx->Width * ctx->Height;
+            const size_t chroma_size  = (size_t)chroma_width * ((ctx->Height + 1) / 2);
+            ctx->Pixels = new uint8_t[luma_size + chroma_size * 2];
+            unsigned char* planes[3]  = { ctx->Pixels, ctx->Pixels + luma_size, ctx->Pixels + luma_size + chroma_size };
+            int            strides[3] = { ctx->Width, chroma_width, chroma_width };
+            result = tj3DecompressToYUVPlanes8(ctx->Handle, ctx->Buffer, ctx->BufferSize, planes, strides);
         }
         else
         {
-            tj3Destroy(ctx->Handle);
-            tj3Free(ctx->Buffer);
+            ctx->Pixels = new uint8_t[ctx->Width * ctx->Height * tjPixelSize[DECODE_PIXEL_FORMAT]];
+            result = tj3Decompress8(ctx->Handle,
+                                    ctx->Buffer, ctx->BufferSize,
+                                    ctx->Pixels, ctx->Width * tjPixelSize[DECODE_PIXEL_FORMAT],
+                                    DECODE_PIXEL_FORMAT);
+        }
+
+        tj3Destroy(ctx->Handle);
+        tj3Free(ctx->Buffer);
+        ctx->Handle = nullptr;
+        ctx->Buffer = nullptr;
+        if (result != 0)
+        {
             delete[] ctx->Pixels;
-            ctx->Handle = nullptr;
-            ctx->Buffer = nullptr;
             ctx->Pixels = nullptr;
             return false;
         }
@@ -142,3 +300,180 @@ static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
     *delay_in_ms = 0;
     return true;
 }
+
+
+
+#define JPEG_STREAM_BUFFER_SIZE 65536
+
+struct JPEGErrorManager
+{
+    jpeg_error_mgr Base;
+    jmp_buf        JumpBuffer;
+};
+
+struct JPEGStream
+{
+    jpeg_decompress_struct Decompress;
+    jpeg_source_mgr        SourceManager;
+    JPEGErrorManager       Error;
+    ImMedia::ImageSource   Source;
+    JOCTET                 Buffer[JPEG_STREAM_BUFFER_SIZE];
+};
+
+static void JPEGErrorExit(j_common_ptr cinfo)
+{
+    longjmp(reinterpret_cast<JPEGErrorManager*>(cinfo->err)->JumpBuffer, 1);
+}
+
+static void JPEGOutputMessage(j_common_ptr)
+{
+}
+
+static void JPEGInitSource(j_decompress_ptr)
+{
+}
+
+static void JPEGTermSource(j_decompress_ptr)
+{
+}
+
+static boolean JPEGFillInputBuffer(j_decompress_ptr cinfo)
+{
+    JPEGStream* stream = reinterpret_cast<JPEGStream*>(cinfo->client_data);
+    size_t size = stream->Source.Read(stream->Source.UserData, stream->Buffer, JPEG_STREAM_BUFFER_SIZE);
+    if (size == 0)
+    {
+        // Truncated stream, end it with EOI so the rows read so far are kept.
+        stream->Buffer[0] = 0xFF;
+        stream->Buffer[1] = JPEG_EOI;
+        size = 2;
+    }
+    stream->SourceManager.next_input_byte = stream->Buffer;
+    stream->SourceManager.bytes_in_buffer = size;
+    return TRUE;
+}
+
+static void JPEGSkipInputData(j_decompress_ptr cinfo, long num_bytes)
+{
+    JPEGStream* stream = reinterpret_cast<JPEGStream*>(cinfo->client_data);
+    jpeg_source_mgr& src = stream->SourceManager;
+    if (num_bytes <= 0)
+        return;
+    if ((size_t)num_bytes <= src.bytes_in_buffer)
+    {
+        src.next_input_byte += num_bytes;
+        src.bytes_in_buffer -= num_bytes;
+        return;
+    }
+    const size_t remain = (size_t)num_bytes - src.bytes_in_buffer;
+    src.bytes_in_buffer = 0;
+    ImMedia::SkipImageSource(stream->Source, remain);
+}
+
+// Mapped sources are read in place, others through a fixed buffer, the header is parsered here and rows in ReadFrame.
+static void* CreateContextFromSource(const ImMedia::ImageSource& source)
+{
+    JPEGStream* stream = new JPEGStream();
+    stream->Source = source;
+    stream->Decompress.err = jpeg_std_error(&stream->Error.Base);
+    stream->Error.Base.error_exit     = JPEGErrorExit;
+    stream->Error.Base.output_message = JPEGOutputMessage;
+
+    if (setjmp(stream->Error.JumpBuffer))
+    {
+        JPEGStreamDelete(stream);
+        return nullptr;
+    }
+
+    jpeg_create_decompress(&stream->Decompress);
+    stream->Decompress.client_data = stream;
+
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (mapped)
+        jpeg_mem_src(&stream->Decompress, mapped, (unsigned long)mapped_size);
+    else
+    {
+        jpeg_source_mgr& src = stream->SourceManager;
+        src.init_source       = JPEGInitSource;
+        src.fill_input_buffer = JPEGFillInputBuffer;
+        src.skip_input_data   = JPEGSkipInputData;
+        src.resync_to_restart = jpeg_resync_to_restart;
+        src.term_source       = JPEGTermSource;
+        src.next_input_byte   = nullptr;
+        src.bytes_in_buffer   = 0;
+        stream->Decompress.src = &src;
+    }
+
+    jpeg_save_markers(&stream->Decompress, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_read_header(&stream->Decompress, TRUE);
+
+    ImMedia::ImageOrientation orientation = ImMedia::ImageOrientation::Normal;
+    for (jpeg_saved_marker_ptr marker = stream->Decompress.marker_list;
+         marker && orientation == ImMedia::ImageOrientation::Normal; marker = marker->next)
+        orientation = ImMedia::ReadExifOrientation(marker->data, marker->data_length);
+
+    return new Context {
+        (int)stream->Decompress.image_width,
+        (int)stream->Decompress.image_height,
+        ImMedia::PixelFormat::RGB888,
+        orientation,
+        nullptr,
+        nullptr,
+        0,
+        nullptr,
+        stream
+    };
+}
+
+static void JPEGStreamDelete(JPEGStream* stream)
+{
+    jpeg_destroy_decompress(&stream->Decompress);
+    ImMedia::CloseImageSource(stream->Source);
+    delete stream;
+}
+
+static bool JPEGStreamSetTargetSize(Context* ctx, int width, int height)
+{
+    jpeg_decompress_struct& decompress = ctx->Stream->Decompress;
+    if (setjmp(ctx->Stream->Error.JumpBuffer))
+        return false;
+
+    const tjscalingfactor factor = FindScalingFactor((int)decompress.image_width, (int)decompress.image_height, width, height);
+    decompress.scale_num   = (unsigned int)factor.num;
+    decompress.scale_denom = (unsigned int)factor.denom;
+    jpeg_calc_output_dimensions(&decompress);
+    ctx->Width  = (int)decompress.output_width;
+    ctx->Height = (int)decompress.output_height;
+    return factor.num != factor.denom;
+}
+
+static bool JPEGStreamDecode(Context* ctx)
+{
+    JPEGStream* stream = ctx->Stream;
+    ctx->Stream = nullptr;
+
+    const size_t row_size = (size_t)ctx->Width * 3;
+    uint8_t*     pixels   = new uint8_t[row_size * ctx->Height];
+
+    if (setjmp(stream->Error.JumpBuffer))
+    {
+        delete[] pixels;
+        JPEGStreamDelete(stream);
+        return false;
+    }
+
+    jpeg_decompress_struct& decompress = stream->Decompress;
+    decompress.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&decompress);
+    while (decompress.output_scanline < decompress.output_height)
+    {
+        JSAMPROW row = pixels + row_size * decompress.output_scanline;
+        jpeg_read_scanlines(&decompress, &row, 1);
+    }
+    jpeg_finish_decompress(&decompress);
+    JPEGStreamDelete(stream);
+
+    ctx->Pixels = pixels;
+    return true;
+}
@@ -4,6 +4,8 @@
 #ifndef IMMEDIA_DECODER_LIBJPEGTURBO_H
 #define IMMEDIA_DECODER_LIBJPEGTURBO_H
 
-void ImMedia_DecoderLibjpegTurbo_Install();
+// yuv_planes: Emit 4:2:0 images as YUV420P planes when the renderer supports it, it converts them to RGB
+//             on the GPU, uploading half the bytes of RGB888. Other images are still decoded to RGB888.
+void ImMedia_DecoderLibjpegTurbo_Install(bool yuv_planes = false);
 
 #endif // !IMMEDIA_DECODER_LIBJPEGTURBO_H
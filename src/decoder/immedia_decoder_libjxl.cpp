@@ -0,0 +1,415 @@
+#include "immedia_decoder_libjxl.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "jxl/decode.h"
+#include "jxl/thread_parallel_runner.h"
+
+#include "immedia_image.h"
+
+static void* CreateContextFromFile(void* f, size_t file_size);
+static void* CreateContextFromData(const uint8_t* data, size_t data_size);
+static void DeleteContext(void* context);
+
+static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
+
+static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static bool ReadNextFrame(void* context);
+static void* CreateContextFromSource(const ImMedia::ImageSource& source);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format);
+static ImMedia::ImageOrientation GetOrientation(void* context);
+static int GetLoopCount(void* context);
+
+static bool g_progressive_passes = false;
+static int  g_thread_count       = 0;
+
+void ImMedia_DecoderLibjxl_Install(bool progressive_passes, int thread_count)
+{
+    g_progressive_passes = progressive_passes;
+    g_thread_count       = thread_count;
+
+    ImMedia::InstallImageDecoder("jxl", {
+        CreateContextFromFile,
+        CreateContextFromData,
+        DeleteContext,
+        GetInfo,
+        ReadFrame,
+        ReadNextFrame,
+        nullptr,
+        CreateContextFromSource,
+        Probe,
+        SetOutputFormat,
+        GetOrientation,
+        nullptr,
+        GetLoopCount
+    });
+}
+
+#ifdef IMMEDIA_DECODER_PLUGIN
+IMMEDIA_DECODER_PLUGIN_ENTRY
+{
+    ImMedia_DecoderLibjxl_Install();
+}
+#endif
+
+
+
+struct Context
+{
+    // Whole file, owned in Storage, or mapped from Source.
+    const uint8_t*       Data;
+    size_t               DataSize;
+    ImVector<uint8_t>    Storage;
+    ImMedia::ImageSource Source;
+    bool                 SourceOpen;
+
+    JxlBasicInfo         Info;
+    ImMedia::PixelFormat Format;
+    int                  FrameCount;  // 0 for still images.
+
+    // Created on the first frame, so contexts which are only probed don't start threads.
+    JxlDecoder* Decoder;
+    void*       Runner;
+
+    ImVector<uint8_t> Pixels;
+    int               FrameDelay;
+    int               FrameIndex;
+    int               PlayedCount;
+    bool              FrameReady;     // Pixels hold the current frame, or the latest pass of it.
+    bool              HasMorePasses;
+};
+
+enum DecodeResult
+{
+    DecodeResult_Frame,
+    DecodeResult_Pass,
+    DecodeResult_End,
+    DecodeResult_Error,
+};
+
+static bool ReadBasicInfo(const uint8_t* data, size_t data_size, JxlBasicInfo* info)
+{
+    const JxlSignature signature = JxlSignatureCheck(data, data_size);
+    if (signature != JXL_SIG_CODESTREAM && signature != JXL_SIG_CONTAINER)
+        return false;
+
+    JxlDecoder* decoder = JxlDecoderCreate(nullptr);
+    if (!decoder)
+        return false;
+    bool valid = JxlDecoderSubscribeEvents(decoder, JXL_DEC_BASIC_INFO) == JXL_DEC_SUCCESS
+              && JxlDecoderSetInput(decoder, data, data_size) == JXL_DEC_SUCCESS;
+    if (valid)
+    {
+        JxlDecoderCloseInput(decoder);
+        valid = JxlDecoderProcessInput(decoder) == JXL_DEC_BASIC_INFO
+             && JxlDecoderGetBasicInfo(decoder, info) == JXL_DEC_SUCCESS;
+    }
+    JxlDecoderDestroy(decoder);
+    return valid;
+}
+
+// Frame headers are parsed without decoding pixels, since no image event is subscribed.
+static int CountFrames(const uint8_t* data, size_t data_size)
+{
+    JxlDecoder* decoder = JxlDecoderCreate(nullptr);
+    if (!decoder)
+        return 0;
+    int count = 0;
+    if (JxlDecoderSubscribeEvents(decoder, JXL_DEC_FRAME) == JXL_DEC_SUCCESS
+        && JxlDecoderSetInput(decoder, data, data_size) == JXL_DEC_SUCCESS)
+    {
+        JxlDecoderCloseInput(decoder);
+        while (JxlDecoderProcessInput(decoder) == JXL_DEC_FRAME)
+            ++count;
+    }
+    JxlDecoderDestroy(decoder);
+    return count;
+}
+
+static ImMedia::PixelFormat GetDefaultFormat(const JxlBasicInfo& info)
+{
+    return info.alpha_bits > 0 ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+}
+
+static Context* CreateContext(const uint8_t* data, size_t data_size)
+{
+    JxlBasicInfo info;
+    if (!ReadBasicInfo(data, data_size, &info))
+        return nullptr;
+
+    const int frame_count = info.have_animation ? CountFrames(data, data_size) : 0;
+    if (info.have_animation && frame_count == 0)
+        return nullptr;
+
+    Context* ctx = new Context();
+    ctx->Data          = data;
+    ctx->DataSize      = data_size;
+    ctx->SourceOpen    = false;
+    ctx->Info          = info;
+    ctx->Format        = GetDefaultFormat(info);
+    ctx->FrameCount    = frame_count;
+    ctx->Decoder       = nullptr;
+    ctx->Runner        = nullptr;
+    ctx->FrameDelay    = 0;
+    ctx->FrameIndex    = 0;
+    ctx->PlayedCount   = 0;
+    ctx->FrameReady    = false;
+    ctx->HasMorePasses = false;
+    return ctx;
+}
+
+static void* CreateContextFromFile(void* f, size_t file_size)
+{
+    FILE* fp = reinterpret_cast<FILE*>(f);
+    ImVector<uint8_t> data;
+    data.resize((int)file_size);
+    const bool read = fread(data.Data, 1, file_size, fp) == file_size;
+    fclose(fp);
+    if (!read)
+        return nullptr;
+
+    Context* ctx = CreateContext(data.Data, (size_t)data.Size);
+    if (ctx)
+        ctx->Storage.swap(data);
+    return ctx;
+}
+
+static void* CreateContextFromData(const uint8_t* data, size_t data_size)
+{
+    ImVector<uint8_t> storage;
+    storage.resize((int)data_size);
+    memcpy(storage.Data, data, data_size);
+    Context* ctx = CreateContext(storage.Data, data_size);
+    if (ctx)
+        ctx->Storage.swap(storage);
+    return ctx;
+}
+
+static void* CreateContextFromSource(const ImMedia::ImageSource& source)
+{
+    // Frames are decoded from the whole file, a mapped source is read in place.
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (mapped)
+    {
+        Context* ctx = CreateContext(mapped, mapped_size);
+        if (!ctx)
+        {
+            ImMedia::CloseImageSource(source);
+            return nullptr;
+        }
+        ctx->Source     = source;
+        ctx->SourceOpen = true;
+        return ctx;
+    }
+
+    ImVector<uint8_t> data;
+    ImMedia::ReadImageSourceToEnd(source, data);
+    ImMedia::CloseImageSource(source);
+    Context* ctx = CreateContext(data.Data, (size_t)data.Size);
+    if (ctx)
+        ctx->Storage.swap(data);
+    return ctx;
+}
+
+static void DeleteContext(void* context)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (ctx->Decoder)
+        JxlDecoderDestroy(ctx->Decoder);
+    if (ctx->Runner)
+        JxlThreadParallelRunnerDestroy(ctx->Runner);
+    if (ctx->SourceOpen)
+        ImMedia::CloseImageSource(ctx->Source);
+    delete ctx;
+}
+
+static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (width)
+        *width = (int)ctx->Info.xsize;
+    if (height)
+        *height = (int)ctx->Info.ysize;
+    if (format)
+        *format = ctx->Format;
+    if (frame_count)
+        *frame_count = ctx->FrameCount;
+}
+
+static ImMedia::ImageOrientation GetOrientation(void* context)
+{
+    // JxlOrientation has the values of EXIF orientation.
+    return (ImMedia::ImageOrientation)reinterpret_cast<Context*>(context)->Info.orientation;
+}
+
+// Gray images may be emitted as L8 or LA88, which the renderer expands on the GPU.
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (ctx->Decoder)
+        return false;
+
+    const bool has_alpha = ctx->Info.alpha_bits > 0;
+    const bool gray      = ctx->Info.num_color_channels == 1;
+    if (format == GetDefaultFormat(ctx->Info)
+        || (gray && format == (has_alpha ? ImMedia::PixelFormat::LA88 : ImMedia::PixelFormat::L8)))
+    {
+        ctx->Format = format;
+        return true;
+    }
+    return false;
+}
+
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    JxlBasicInfo info;
+    if (!ReadBasicInfo(data, data_size, &info))
+        return false;
+
+    if (width)
+        *width = (int)info.xsize;
+    if (height)
+        *height = (int)info.ysize;
+    if (format)
+        *format = GetDefaultFormat(info);
+    if (frame_count)
+        *frame_count = info.have_animation ? -1 : 0;  // Frames are only counted when the whole file is read.
+    return true;
+}
+
+static bool StartDecoder(Context* ctx)
+{
+    const size_t thread_count = g_thread_count > 0 ? (size_t)g_thread_count : JxlThreadParallelRunnerDefaultNumWorkerThreads();
+    ctx->Decoder = JxlDecoderCreate(nullptr);
+    if (!ctx->Decoder)
+        return false;
+    if (thread_count > 1)
+    {
+        ctx->Runner = JxlThreadParallelRunnerCreate(nullptr, thread_count);
+        if (!ctx->Runner || JxlDecoderSetParallelRunner(ctx->Decoder, JxlThreadParallelRunner, ctx->Runner) != JXL_DEC_SUCCESS)
+            return false;
+    }
+
+    int events = JXL_DEC_COLOR_ENCODING | JXL_DEC_FRAME | JXL_DEC_FULL_IMAGE;
+    if (g_progressive_passes && ctx->FrameCount == 0)
+        events |= JXL_DEC_FRAME_PROGRESSION;
+
+    // Pixels are kept as stored, orientation is applied when shown.
+    if (JxlDecoderSubscribeEvents(ctx->Decoder, events) != JXL_DEC_SUCCESS
+        || JxlDecoderSetKeepOrientation(ctx->Decoder, JXL_TRUE) != JXL_DEC_SUCCESS
+        || (g_progressive_passes && JxlDecoderSetProgressiveDetail(ctx->Decoder, kPasses) != JXL_DEC_SUCCESS)
+        || JxlDecoderSetInput(ctx->Decoder, ctx->Data, ctx->DataSize) != JXL_DEC_SUCCESS)
+        return false;
+    JxlDecoderCloseInput(ctx->Decoder);
+    return true;
+}
+
+// Run the decoder to the end of the next frame, or of the next pass of a progressive still image.
+static DecodeResult DecodeNext(Context* ctx)
+{
+    JxlDecoder* decoder = ctx->Decoder;
+    while (true)
+    {
+        switch (JxlDecoderProcessInput(decoder))
+        {
+        case JXL_DEC_COLOR_ENCODING:
+        {
+            // Only applies to XYB encoded images, others are emitted in their own color space.
+            JxlColorEncoding color_encoding;
+            JxlColorEncodingSetToSRGB(&color_encoding, ctx->Info.num_color_channels == 1);
+            JxlDecoderSetPreferredColorProfile(decoder, &color_encoding);
+            break;
+        }
+        case JXL_DEC_FRAME:
+        {
+            JxlFrameHeader header;
+            ctx->FrameDelay = 0;
+            if (ctx->FrameCount > 0 && JxlDecoderGetFrameHeader(decoder, &header) == JXL_DEC_SUCCESS
+                && ctx->Info.animation.tps_numerator > 0)
+                ctx->FrameDelay = (int)((uint64_t)header.duration * 1000 * ctx->Info.animation.tps_denominator
+                                        / ctx->Info.animation.tps_numerator);
+            break;
+        }
+        case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+        {
+            const JxlPixelFormat format = { (uint32_t)PIXEL_FORMAT_SIZE(ctx->Format), JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0 };
+            size_t size = 0;
+            if (JxlDecoderImageOutBufferSize(decoder, &format, &size) != JXL_DEC_SUCCESS)
+                return DecodeResult_Error;
+            ctx->Pixels.resize((int)size);
+            if (JxlDecoderSetImageOutBuffer(decoder, &format, ctx->Pixels.Data, size) != JXL_DEC_SUCCESS)
+                return DecodeResult_Error;
+            break;
+        }
+        case JXL_DEC_FRAME_PROGRESSION:
+            // Passes before the output buffer is set have nothing to show.
+            if (!ctx->Pixels.empty() && JxlDecoderFlushImage(decoder) == JXL_DEC_SUCCESS)
+                return DecodeResult_Pass;
+            break;
+        case JXL_DEC_FULL_IMAGE:
+            return DecodeResult_Frame;
+        case JXL_DEC_SUCCESS:
+            return DecodeResult_End;
+        default:
+            // Input is closed, so JXL_DEC_NEED_MORE_INPUT means a truncated file.
+            return DecodeResult_Error;
+        }
+    }
+}
+
+static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+
+    if (!ctx->FrameReady)
+    {
+        if (!ctx->Decoder && !StartDecoder(ctx))
+            return false;
+        const DecodeResult result = DecodeNext(ctx);
+        if (result != DecodeResult_Frame && result != DecodeResult_Pass)
+            return false;
+        ctx->HasMorePasses = result == DecodeResult_Pass;
+        ctx->FrameReady    = true;
+    }
+
+    *pixels      = ctx->Pixels.Data;
+    *delay_in_ms = ctx->FrameDelay;
+    return true;
+}
+
+static bool ReadNextFrame(void* context)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+
+    // A still image has a next frame while passes refine it.
+    if (ctx->FrameCount == 0)
+    {
+        if (!ctx->HasMorePasses)
+            return false;
+        ctx->FrameReady = false;
+        return true;
+    }
+
+    ctx->FrameReady = false;
+    if (++ctx->FrameIndex < ctx->FrameCount)
+        return true;
+
+    // End of loop, decode again from the first frame.
+    ++ctx->PlayedCount;
+    if (ctx->Info.animation.num_loops > 0 && ctx->PlayedCount >= (int)ctx->Info.animation.num_loops)
+        return false;
+    ctx->FrameIndex = 0;
+    JxlDecoderRewind(ctx->Decoder);
+    if (JxlDecoderSetInput(ctx->Decoder, ctx->Data, ctx->DataSize) != JXL_DEC_SUCCESS)
+        return false;
+    JxlDecoderCloseInput(ctx->Decoder);
+    return true;
+}
+
+static int GetLoopCount(void* context)
+{
+    return (int)reinterpret_cast<Context*>(context)->Info.animation.num_loops;
+}
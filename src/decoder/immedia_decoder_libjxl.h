@@ -0,0 +1,13 @@
+// Image decoder of jpeg xl using libjxl.
+// libjxl homepage: https://github.com/libjxl/libjxl
+
+#ifndef IMMEDIA_DECODER_LIBJXL_H
+#define IMMEDIA_DECODER_LIBJXL_H
+
+// progressive_passes: Show still images pass by pass, starting from the 1:8 preview. ReadFrame returns the latest pass
+//                     and ReadNextFrame returns true until the last one, so images refine over the next frames.
+// thread_count:       Threads of the parallel runner each decoding context starts on its first frame,
+//                     0 to use the number of hardware threads, 1 to decode on the calling thread.
+void ImMedia_DecoderLibjxl_Install(bool progressive_passes = false, int thread_count = 0);
+
+#endif // !IMMEDIA_DECODER_LIBJXL_H
@@ -4,9 +4,12 @@
 #pragma warning (disable: 4611) // Interaction between '_setjmp' and C++ object destruction is non-portable.
 #endif
 
+#include <stdio.h>
+
 #include "png.h"
 
 #include "immedia_image.h"
+#include "immedia_pixel_convert.h"
 
 #define PNG_HEADER_SIZE 8
 
@@ -17,6 +20,12 @@ static void DeleteContext(void* context);
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static bool ReadNextFrame(void* context);
+static bool GetDirtyRect(void* context, int* x, int* y, int* width, int* height);
+static void* CreateContextFromSource(const ImMedia::ImageSource& source);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format);
+static int GetLoopCount(void* context);
 
 void ImMedia_DecoderLibpng_Install()
 {
@@ -26,21 +35,98 @@ void ImMedia_DecoderLibpng_Install()
         DeleteContext,
         GetInfo,
         ReadFrame,
-        nullptr
+        ReadNextFrame,
+        GetDirtyRect,
+        CreateContextFromSource,
+        Probe,
+        SetOutputFormat,
+        nullptr,
+        nullptr,
+        GetLoopCount
+    });
+    ImMedia::InstallImageDecoder("apng", {
+        CreateContextFromFile,
+        CreateContextFromData,
+        DeleteContext,
+        GetInfo,
+        ReadFrame,
+        ReadNextFrame,
+        GetDirtyRect,
+        CreateContextFromSource,
+        Probe,
+        SetOutputFormat,
+        nullptr,
+        nullptr,
+        GetLoopCount
     });
 }
 
+#ifdef IMMEDIA_DECODER_PLUGIN
+IMMEDIA_DECODER_PLUGIN_ENTRY
+{
+    ImMedia_DecoderLibpng_Install();
+}
+#endif
+
+
+
+// APNG frame control, see https://wiki.mozilla.org/APNG_Specification
+enum APNGDispose { APNGDispose_None = 0, APNGDispose_Background = 1, APNGDispose_Previous = 2 };
+enum APNGBlend   { APNGBlend_Source = 0, APNGBlend_Over = 1 };
+
+struct APNGChunk
+{
+    size_t Offset;  // Offset of chunk data, sequence number of fdAT excluded.
+    size_t Size;
+};
+
+struct APNGFrame
+{
+    int X;
+    int Y;
+    int Width;
+    int Height;
+    int Delay;
+    int Dispose;
+    int Blend;
+    int ChunkBegin;
+    int ChunkEnd;
+};
 
+struct APNG
+{
+    ImVector<uint8_t>   Storage;
+    uint8_t*            Data;
+    size_t              DataSize;
+    size_t              IHDROffset;
+    ImVector<APNGChunk> HeaderChunks;  // Whole chunks between IHDR and image data, e.g. PLTE, tRNS.
+    ImVector<APNGChunk> DataChunks;
+    ImVector<APNGFrame> Frames;
+    int                 PlayCount;
+
+    int                 FrameIndex;
+    int                 PlayedCount;
+    uint8_t*            FrameBuffer;
+    uint8_t*            PreviousPixels;
+    int                 DirtyRect[4];
+    bool                Dirty;
+};
 
 struct Context
 {
-    png_struct* PNG;
-    png_info*   Info;
-    uint8_t*    FramePixels;
+    png_struct*          PNG;
+    png_info*            Info;
+    uint8_t*             FramePixels;
+    int                  Width;
+    int                  Height;
+    ImMedia::PixelFormat Format;
+    APNG*                Anim;
+    uint8_t*             IndexedPixels;  // Indexed8 frame of palette images, until it is expanded in ReadFrame.
 };
 
-static void PNGRead(png_struct* png, png_info* info, uint8_t*& pixels, uint8_t**& rows);
+static void PNGRead(png_struct* png, png_info* info, uint8_t*& pixels, uint8_t**& rows, ImMedia::PixelFormat& format);
 static void PNGClean(png_struct* png, png_info* info, uint8_t* pixels, uint8_t** rows);
+static void PNGReadPalette(png_struct* png, png_info* info, uint8_t* palette);
 
 struct PNGDataReadIO
 {
@@ -51,21 +137,79 @@ struct PNGDataReadIO
 
 static void PNGDataReadFunc(png_structp png, png_bytep png_data, png_size_t length);
 
+struct PNGSourceReadIO
+{
+    const ImMedia::ImageSource* Source;
+    const uint8_t*              Prefix;      // Chunks read while looking for acTL, replayed first.
+    size_t                      PrefixSize;
+    size_t                      PrefixPos;
+};
 
-static void* CreateContextFromFile(void* fp, size_t data_size)
+static void PNGSourceReadFunc(png_structp png, png_bytep png_data, png_size_t length);
+
+static bool   IsAPNG(const uint8_t* data, size_t data_size);
+static bool   IsAPNG(FILE* f);
+static bool   IsChunk(const uint8_t* type, const char* name);
+static uint32_t ReadBE32(const uint8_t* p);
+static APNG*  APNGParse(uint8_t* data, size_t data_size, int* width, int* height);
+static void   APNGDelete(APNG* anim);
+static bool   APNGRenderFrame(Context* ctx, int index);
+
+
+static Context* CreateStaticContext(png_struct* png, png_info* info, uint8_t* pixels, ImMedia::PixelFormat format)
 {
-    IM_UNUSED(data_size);
+    const bool indexed = format == ImMedia::PixelFormat::Indexed8;
+    if (indexed)
+        format = png_get_valid(png, info, PNG_INFO_tRNS) ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+    return new Context{
+        png,
+        info,
+        indexed ? nullptr : pixels,
+        (int)png_get_image_width(png, info),
+        (int)png_get_image_height(png, info),
+        format,
+        nullptr,
+        indexed ? pixels : nullptr
+    };
+}
 
+// Frames are decoded lazily, the animation takes the whole file from data.
+static Context* CreateAnimContext(ImVector<uint8_t>& data)
+{
+    int width, height;
+    APNG* anim = APNGParse(data.Data, data.Size, &width, &height);
+    if (!anim)
+        return nullptr;
+    anim->Storage.swap(data);
+    return new Context{ nullptr, nullptr, nullptr, width, height, ImMedia::PixelFormat::RGBA8888, anim, nullptr };
+}
+
+static void* CreateContextFromFile(void* fp, size_t data_size)
+{
     uint8_t header[8];
     FILE* f = reinterpret_cast<FILE*>(fp);
-    fread(header, 1, PNG_HEADER_SIZE, f);
-    if (png_sig_cmp(header, 0, PNG_HEADER_SIZE) != 0)
+    if (fread(header, 1, PNG_HEADER_SIZE, f) != PNG_HEADER_SIZE || png_sig_cmp(header, 0, PNG_HEADER_SIZE) != 0)
+    {
+        fclose(f);
         return nullptr;
+    }
 
-    png_struct* png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    png_info*   info   = png_create_info_struct(png);
-    png_byte*   pixels = nullptr;
-    png_byte**  rows   = nullptr;
+    if (IsAPNG(f))
+    {
+        ImVector<uint8_t> data;
+        data.resize((int)data_size);
+        fseek(f, 0, SEEK_SET);
+        data.resize((int)fread(data.Data, 1, data_size, f));
+        fclose(f);
+        return CreateAnimContext(data);
+    }
+    fseek(f, PNG_HEADER_SIZE, SEEK_SET);
+
+    png_struct*          png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_info*            info   = png_create_info_struct(png);
+    png_byte*            pixels = nullptr;
+    png_byte**           rows   = nullptr;
+    ImMedia::PixelFormat format;
 
     if (setjmp(png_jmpbuf(png)))
     {
@@ -76,9 +220,9 @@ static void* CreateContextFromFile(void* fp, size_t data_size)
 
     png_init_io(png, f);
     png_set_sig_bytes(png, PNG_HEADER_SIZE);
-    PNGRead(png, info, pixels, rows);
+    PNGRead(png, info, pixels, rows, format);
     fclose(f);
-    return new Context{ png, info, pixels };
+    return CreateStaticContext(png, info, pixels, format);
 }
 
 static void* CreateContextFromData(const uint8_t* data, size_t data_size)
@@ -89,10 +233,19 @@ static void* CreateContextFromData(const uint8_t* data, size_t data_size)
     if (png_sig_cmp(data, 0, PNG_HEADER_SIZE) != 0)
         return nullptr;
 
-    png_struct* png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    png_info*   info   = png_create_info_struct(png);
-    png_byte*   pixels = nullptr;
-    png_byte**  rows   = nullptr;
+    if (IsAPNG(data, data_size))
+    {
+        ImVector<uint8_t> copy;
+        copy.resize((int)data_size);
+        memcpy(copy.Data, data, data_size);
+        return CreateAnimContext(copy);
+    }
+
+    png_struct*          png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_info*            info   = png_create_info_struct(png);
+    png_byte*            pixels = nullptr;
+    png_byte**           rows   = nullptr;
+    ImMedia::PixelFormat format;
 
     if (setjmp(png_jmpbuf(png)))
     {
@@ -103,43 +256,236 @@ static void* CreateContextFromData(const uint8_t* data, size_t data_size)
     PNGDataReadIO png_io = { data + PNG_HEADER_SIZE, data_size - PNG_HEADER_SIZE, 0 };
     png_set_sig_bytes(png, PNG_HEADER_SIZE);
     png_set_read_fn(png, &png_io, PNGDataReadFunc);
-    PNGRead(png, info, pixels, rows);
-    return new Context{ png, info, pixels };
+    PNGRead(png, info, pixels, rows, format);
+    return CreateStaticContext(png, info, pixels, format);
+}
+
+static void* CreateContextFromSource(const ImMedia::ImageSource& source)
+{
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (mapped)
+    {
+        void* context = CreateContextFromData(mapped, mapped_size);
+        ImMedia::CloseImageSource(source);
+        return context;
+    }
+
+    ImVector<uint8_t> prefix;
+    prefix.resize(PNG_HEADER_SIZE);
+    bool valid  = ImMedia::ReadImageSource(source, prefix.Data, PNG_HEADER_SIZE) == PNG_HEADER_SIZE
+               && png_sig_cmp(prefix.Data, 0, PNG_HEADER_SIZE) == 0;
+    bool is_apng = false;
+    while (valid)
+    {
+        const int offset = prefix.Size;
+        prefix.resize(offset + 8);
+        if (ImMedia::ReadImageSource(source, prefix.Data + offset, 8) != 8)
+        {
+            valid = false;
+            break;
+        }
+        const uint8_t* type = prefix.Data + offset + 4;
+        if (IsChunk(type, "acTL"))
+        {
+            is_apng = true;
+            break;
+        }
+        if (IsChunk(type, "IDAT") || IsChunk(type, "IEND"))
+            break;
+        const uint32_t length = ReadBE32(prefix.Data + offset) + 4;
+        if (length > 0x7FFFFFFF - (uint32_t)prefix.Size)
+        {
+            valid = false;
+            break;
+        }
+        prefix.resize(prefix.Size + (int)length);
+        valid = ImMedia::ReadImageSource(source, prefix.Data + offset + 8, length) == length;
+    }
+
+    if (!valid)
+    {
+        ImMedia::CloseImageSource(source);
+        return nullptr;
+    }
+    if (is_apng)
+    {
+        ImMedia::ReadImageSourceToEnd(source, prefix);
+        ImMedia::CloseImageSource(source);
+        return CreateAnimContext(prefix);
+    }
+
+    png_struct*          png    = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_info*            info   = png_create_info_struct(png);
+    png_byte*            pixels = nullptr;
+    png_byte**           rows   = nullptr;
+    ImMedia::PixelFormat format;
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        PNGClean(png, info, pixels, rows);
+        ImMedia::CloseImageSource(source);
+        return nullptr;
+    }
+
+    // Rows are decoded while they are read from source.
+    PNGSourceReadIO png_io = { &source, prefix.Data + PNG_HEADER_SIZE, (size_t)prefix.Size - PNG_HEADER_SIZE, 0 };
+    png_set_sig_bytes(png, PNG_HEADER_SIZE);
+    png_set_read_fn(png, &png_io, PNGSourceReadFunc);
+    PNGRead(png, info, pixels, rows, format);
+    ImMedia::CloseImageSource(source);
+    return CreateStaticContext(png, info, pixels, format);
 }
 
 static void DeleteContext(void* context)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
-    png_destroy_read_struct(&ctx->PNG, &ctx->Info, nullptr);
+    if (ctx->PNG)
+        png_destroy_read_struct(&ctx->PNG, &ctx->Info, nullptr);
+    if (ctx->Anim)
+        APNGDelete(ctx->Anim);
     delete[] ctx->FramePixels;
+    delete[] ctx->IndexedPixels;
     delete ctx;
 }
 
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
-    *width = png_get_image_width(ctx->PNG, ctx->Info);
-    *height = png_get_image_height(ctx->PNG, ctx->Info);
-    png_byte color_type = png_get_color_type(ctx->PNG, ctx->Info);
-    if (color_type == PNG_COLOR_TYPE_RGB)
-        *format = ImMedia::PixelFormat::RGB888;
-    else if (color_type == PNG_COLOR_TYPE_RGBA)
-        *format = ImMedia::PixelFormat::RGBA8888;
-    else
-    { assert(false); }
-    *frame_count = 0;
+    if (width)
+        *width = ctx->Width;
+    if (height)
+        *height = ctx->Height;
+    if (format)
+        *format = ctx->Format;
+    if (frame_count)
+        *frame_count = ctx->Anim && ctx->Anim->Frames.Size > 1 ? ctx->Anim->Frames.Size : 0;
+}
+
+// Format follows PNGRead and CreateAnimContext, which only needs chunks before the first IDAT.
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    // Signature, then IHDR length, type, width, height, bit depth and color type.
+    if (data_size < PNG_HEADER_SIZE + 18 || png_sig_cmp(data, 0, PNG_HEADER_SIZE) != 0 || !IsChunk(data + 12, "IHDR"))
+        return false;
+
+    bool     has_alpha   = (data[25] & PNG_COLOR_MASK_ALPHA) != 0;
+    bool     is_apng     = false;
+    uint32_t anim_frames = 0;
+    size_t   p           = PNG_HEADER_SIZE;
+    while (true)
+    {
+        if (data_size - p < 8)
+            return false;
+        const uint32_t length = ReadBE32(data + p);
+        const uint8_t* type   = data + p + 4;
+        if (IsChunk(type, "IDAT") || IsChunk(type, "IEND"))
+            break;
+        if (IsChunk(type, "tRNS"))
+            has_alpha = true;
+        else if (IsChunk(type, "acTL"))
+        {
+            if (data_size - p < 12)
+                return false;
+            is_apng     = true;
+            anim_frames = ReadBE32(data + p + 8);
+        }
+        if (data_size - p < 12 || length > data_size - p - 12)
+            return false;
+        p += (size_t)length + 12;
+    }
+
+    if (width)
+        *width = (int)ReadBE32(data + 16);
+    if (height)
+        *height = (int)ReadBE32(data + 20);
+    if (format)
+        *format = has_alpha || is_apng ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+    if (frame_count)
+        *frame_count = anim_frames > 1 ? (int)anim_frames : 0;
+    return true;
+}
+
+// Palette images are decoded to Indexed8, they are expanded on CPU only if the renderer doesn't take them.
+static bool SetOutputFormat(void* context, ImMedia::PixelFormat format)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (format != ImMedia::PixelFormat::Indexed8 || !ctx->IndexedPixels)
+        return false;
+    ctx->Format = format;
+    return true;
 }
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
-    *pixels = ctx->FramePixels;
-    *delay_in_ms = 0;
+    if (!ctx->Anim)
+    {
+        if (ctx->IndexedPixels && ctx->Format != ImMedia::PixelFormat::Indexed8)
+        {
+            const size_t pixel_count = (size_t)ctx->Width * ctx->Height;
+            ctx->FramePixels = new uint8_t[pixel_count * PIXEL_FORMAT_SIZE(ctx->Format)];
+            ImMedia::ExpandPalette(ctx->IndexedPixels, ctx->IndexedPixels + pixel_count, ctx->FramePixels, ctx->Format, pixel_count);
+            delete[] ctx->IndexedPixels;
+            ctx->IndexedPixels = nullptr;
+        }
+        *pixels = ctx->IndexedPixels ? ctx->IndexedPixels : ctx->FramePixels;
+        *delay_in_ms = 0;
+        return true;
+    }
+
+    if (!ctx->FramePixels && !APNGRenderFrame(ctx, 0))
+    {
+        delete[] ctx->FramePixels;
+        ctx->FramePixels = nullptr;
+        return false;
+    }
+
+    *pixels      = ctx->FramePixels;
+    *delay_in_ms = ctx->Anim->Frames[ctx->Anim->FrameIndex].Delay;
     return true;
 }
 
+static bool ReadNextFrame(void* context)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    APNG* anim = ctx->Anim;
+    if (!anim || anim->Frames.Size == 1)
+        return false;
 
-static void PNGRead(png_struct* png, png_info* info, uint8_t*& pixels, uint8_t**& rows)
+    int next = anim->FrameIndex + 1;
+    if (next == anim->Frames.Size)
+    {
+        ++anim->PlayedCount;
+        if (anim->PlayCount > 0 && anim->PlayedCount >= anim->PlayCount)
+            return false;
+        next = 0;
+    }
+    // A broken frame leaves the canvas unchanged, the animation goes on.
+    APNGRenderFrame(ctx, next);
+    return true;
+}
+
+static int GetLoopCount(void* context)
+{
+    const APNG* anim = reinterpret_cast<Context*>(context)->Anim;
+    return anim ? anim->PlayCount : 0;
+}
+
+static bool GetDirtyRect(void* context, int* x, int* y, int* width, int* height)
+{
+    Context* ctx = reinterpret_cast<Context*>(context);
+    if (!ctx->Anim || !ctx->Anim->Dirty)
+        return false;
+    *x      = ctx->Anim->DirtyRect[0];
+    *y      = ctx->Anim->DirtyRect[1];
+    *width  = ctx->Anim->DirtyRect[2];
+    *height = ctx->Anim->DirtyRect[3];
+    return true;
+}
+
+
+static void PNGRead(png_struct* png, png_info* info, uint8_t*& pixels, uint8_t**& rows, ImMedia::PixelFormat& format)
 {
     png_read_info(png, info);
 
@@ -147,27 +493,61 @@ static void PNGRead(png_struct* png, png_info* info, uint8_t*& pixels, uint8_t**
     png_uint_32 height     = png_get_image_height(png, info);
     png_byte    color_type = png_get_color_type(png, info);
 
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_palette_to_rgb(png);
-    else if (color_type == PNG_COLOR_TYPE_GRAY)
+    // Palette images keep one byte per index, the palette is stored after them as in Indexed8.
+    const bool indexed = color_type == PNG_COLOR_TYPE_PALETTE;
+    if (indexed)
+        png_set_packing(png);
+    else if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
     {
-        png_set_gray_to_rgb(png);
         png_set_expand_gray_1_2_4_to_8(png);
+        png_set_gray_to_rgb(png);
     }
 
-    if (png_get_valid(png, info, PNG_INFO_tRNS))
+    const bool has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+    if (!indexed && png_get_valid(png, info, PNG_INFO_tRNS))
         png_set_tRNS_to_alpha(png);
+    png_set_strip_16(png);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
 
-    const bool has_alpha = color_type & PNG_COLOR_MASK_ALPHA;
+    if (indexed)
+        format = ImMedia::PixelFormat::Indexed8;
+    else
+        format = has_alpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
 
-    size_t row_size = (size_t)width * (has_alpha ? 4 : 3);
+    size_t row_size = (size_t)width * PIXEL_FORMAT_SIZE(format);
     size_t image_size = row_size * height;
-    pixels = new uint8_t[image_size];
+    pixels = new uint8_t[ImMedia::GetFrameSize((int)width, (int)height, format)];
+    if (indexed)
+        PNGReadPalette(png, info, pixels + image_size);
     rows = new uint8_t* [height];
     for (size_t i = 0; i < height; ++i)
         rows[i] = pixels + i * row_size;
     png_read_image(png, rows);
     delete[] rows;
+    rows = nullptr;
+}
+
+static void PNGReadPalette(png_struct* png, png_info* info, uint8_t* palette)
+{
+    memset(palette, 0, 256 * 4);
+
+    png_color* colors      = nullptr;
+    int        color_count = 0;
+    png_get_PLTE(png, info, &colors, &color_count);
+
+    png_byte* alphas      = nullptr;
+    int       alpha_count = 0;
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+        png_get_tRNS(png, info, &alphas, &alpha_count, nullptr);
+
+    for (int i = 0; i < color_count && i < 256; ++i)
+    {
+        palette[i * 4 + 0] = colors[i].red;
+        palette[i * 4 + 1] = colors[i].green;
+        palette[i * 4 + 2] = colors[i].blue;
+        palette[i * 4 + 3] = i < alpha_count ? alphas[i] : 0xFF;
+    }
 }
 
 static void PNGClean(png_struct* png, png_info* info, uint8_t* pixels, uint8_t** rows)
@@ -182,7 +562,458 @@ static void PNGClean(png_struct* png, png_info* info, uint8_t* pixels, uint8_t**
 static void PNGDataReadFunc(png_structp png, png_bytep png_data, png_size_t length)
 {
     PNGDataReadIO* png_io = reinterpret_cast<PNGDataReadIO*>(png_get_io_ptr(png));
+    if (length > png_io->DataSize - png_io->CurrentPos)
+        png_error(png, "read beyond end of data");
     const uint8_t* data = png_io->Data;
     memcpy(png_data, data + png_io->CurrentPos, length);
     png_io->CurrentPos += length;
 }
+
+static void PNGSourceReadFunc(png_structp png, png_bytep png_data, png_size_t length)
+{
+    PNGSourceReadIO* png_io = reinterpret_cast<PNGSourceReadIO*>(png_get_io_ptr(png));
+    if (png_io->PrefixPos < png_io->PrefixSize)
+    {
+        size_t n = png_io->PrefixSize - png_io->PrefixPos;
+        if (n > length)
+            n = length;
+        memcpy(png_data, png_io->Prefix + png_io->PrefixPos, n);
+        png_io->PrefixPos += n;
+        png_data          += n;
+        length            -= n;
+    }
+    if (length > 0 && ImMedia::ReadImageSource(*png_io->Source, png_data, length) != length)
+        png_error(png, "read beyond end of source");
+}
+
+
+
+static uint32_t ReadBE32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint16_t ReadBE16(const uint8_t* p)
+{
+    return (uint16_t)(((uint16_t)p[0] << 8) | p[1]);
+}
+
+static void WriteBE32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)(v);
+}
+
+static bool IsChunk(const uint8_t* type, const char* name)
+{
+    return memcmp(type, name, 4) == 0;
+}
+
+// An animation control chunk before the first IDAT makes it an APNG.
+static bool IsAPNG(const uint8_t* data, size_t data_size)
+{
+    size_t p = PNG_HEADER_SIZE;
+    while (p + 8 <= data_size)
+    {
+        const uint8_t* type = data + p + 4;
+        if (IsChunk(type, "acTL"))
+            return true;
+        if (IsChunk(type, "IDAT") || IsChunk(type, "IEND"))
+            return false;
+        p += 12 + (size_t)ReadBE32(data + p);
+    }
+    return false;
+}
+
+static bool IsAPNG(FILE* f)
+{
+    uint8_t chunk[8];
+    bool    result = false;
+    while (fread(chunk, 1, 8, f) == 8)
+    {
+        if (IsChunk(chunk + 4, "acTL"))
+        {
+            result = true;
+            break;
+        }
+        if (IsChunk(chunk + 4, "IDAT") || IsChunk(chunk + 4, "IEND"))
+            break;
+        if (fseek(f, (long)ReadBE32(chunk) + 4, SEEK_CUR) != 0)
+            break;
+    }
+    return result;
+}
+
+static APNG* APNGParse(uint8_t* data, size_t data_size, int* width, int* height)
+{
+    APNG* anim = new APNG();
+    anim->Data        = data;  // Owned by Storage once parsed.
+    anim->DataSize    = data_size;
+    anim->IHDROffset  = 0;
+    anim->PlayCount   = 0;
+    anim->FrameIndex  = 0;
+    anim->PlayedCount = 0;
+    anim->FrameBuffer    = nullptr;
+    anim->PreviousPixels = nullptr;
+    anim->Dirty          = false;
+
+    int  frame_total = 0;
+    bool seen_data   = false;
+    size_t p = PNG_HEADER_SIZE;
+    while (p + 12 <= data_size)
+    {
+        const size_t   length = ReadBE32(data + p);
+        const uint8_t* type   = data + p + 4;
+        const size_t   body   = p + 8;
+        if (length > data_size - body - 4)
+            break;
+
+        if (IsChunk(type, "IHDR") && length >= 13)
+        {
+            anim->IHDROffset = body;
+            *width  = (int)ReadBE32(data + body);
+            *height = (int)ReadBE32(data + body + 4);
+        }
+        else if (IsChunk(type, "acTL") && length >= 8)
+        {
+            frame_total     = (int)ReadBE32(data + body);
+            anim->PlayCount = (int)ReadBE32(data + body + 4);
+        }
+        else if (IsChunk(type, "fcTL") && length >= 26)
+        {
+            if (!anim->Frames.empty())
+                anim->Frames.back().ChunkEnd = anim->DataChunks.Size;
+
+            const uint8_t* c = data + body;
+            int delay_num = ReadBE16(c + 20);
+            int delay_den = ReadBE16(c + 22);
+            APNGFrame frame;
+            frame.Width      = (int)ReadBE32(c + 4);
+            frame.Height     = (int)ReadBE32(c + 8);
+            frame.X          = (int)ReadBE32(c + 12);
+            frame.Y          = (int)ReadBE32(c + 16);
+            frame.Delay      = delay_num * 1000 / (delay_den == 0 ? 100 : delay_den);
+            frame.Dispose    = c[24];
+            frame.Blend      = c[25];
+            frame.ChunkBegin = anim->DataChunks.Size;
+            frame.ChunkEnd   = anim->DataChunks.Size;
+            anim->Frames.push_back(frame);
+        }
+        else if (IsChunk(type, "IDAT"))
+        {
+            // IDAT is the first frame only if a fcTL comes before it, otherwise it's the hidden default image.
+            seen_data = true;
+            if (!anim->Frames.empty())
+                anim->DataChunks.push_back({ body, length });
+        }
+        else if (IsChunk(type, "fdAT") && length > 4)
+        {
+            seen_data = true;
+            anim->DataChunks.push_back({ body + 4, length - 4 });
+        }
+        else if (IsChunk(type, "IEND"))
+            break;
+        else if (!seen_data && !IsChunk(type, "acTL") && !IsChunk(type, "fcTL"))
+            anim->HeaderChunks.push_back({ p, length + 12 });
+
+        p = body + length + 4;
+    }
+    if (!anim->Frames.empty())
+        anim->Frames.back().ChunkEnd = anim->DataChunks.Size;
+
+    bool valid = anim->IHDROffset != 0 && *width > 0 && *height > 0 && !anim->Frames.empty();
+    for (int i = 0; valid && i < anim->Frames.Size; ++i)
+    {
+        const APNGFrame& frame = anim->Frames[i];
+        valid = frame.Width > 0 && frame.Height > 0 && frame.ChunkBegin < frame.ChunkEnd
+             && frame.X >= 0 && frame.Y >= 0 && frame.X + frame.Width <= *width && frame.Y + frame.Height <= *height;
+    }
+    if (!valid)
+    {
+        APNGDelete(anim);
+        return nullptr;
+    }
+    if (frame_total > 0 && frame_total < anim->Frames.Size)
+        anim->Frames.resize(frame_total);
+
+    // Previous frame of first one is the cleared canvas.
+    if (anim->Frames[0].Dispose == APNGDispose_Previous)
+        anim->Frames[0].Dispose = APNGDispose_Background;
+
+    anim->FrameBuffer = new uint8_t[(size_t)(*width) * (*height) * 4];
+    return anim;
+}
+
+static void APNGDelete(APNG* anim)
+{
+    delete[] anim->FrameBuffer;
+    delete[] anim->PreviousPixels;
+    delete anim;
+}
+
+// Frame data is served to libpng as a standalone PNG made of the original header chunks,
+// an IHDR with frame size and fdAT payloads renamed to IDAT, without copying the payloads.
+struct APNGFrameReader
+{
+    const APNG*      Anim;
+    const APNGFrame* Frame;
+    uint8_t          Prefix[PNG_HEADER_SIZE + 25];
+    uint8_t          ChunkHeader[8];
+    uint8_t          Footer[4 + 12];
+    int              Segment;
+    size_t           SegmentPos;
+};
+
+static bool APNGNextSegment(APNGFrameReader* reader, const uint8_t** data, size_t* size)
+{
+    const APNG*      anim  = reader->Anim;
+    const APNGFrame* frame = reader->Frame;
+    const int header_count = anim->HeaderChunks.Size;
+    const int chunk_count  = frame->ChunkEnd - frame->ChunkBegin;
+
+    // Segment 0: signature and IHDR, then header chunks, then 3 segments for each data chunk, then IEND.
+    int s = reader->Segment;
+    if (s == 0)
+    {
+        *data = reader->Prefix;
+        *size = sizeof(reader->Prefix);
+        return true;
+    }
+    s -= 1;
+    if (s < header_count)
+    {
+        *data = anim->Data + anim->HeaderChunks[s].Offset;
+        *size = anim->HeaderChunks[s].Size;
+        return true;
+    }
+    s -= header_count;
+    if (s < chunk_count * 3)
+    {
+        const APNGChunk& chunk = anim->DataChunks[frame->ChunkBegin + s / 3];
+        switch (s % 3)
+        {
+        case 0:
+            WriteBE32(reader->ChunkHeader, (uint32_t)chunk.Size);
+            memcpy(reader->ChunkHeader + 4, "IDAT", 4);
+            *data = reader->ChunkHeader;
+            *size = 8;
+            break;
+        case 1:
+            *data = anim->Data + chunk.Offset;
+            *size = chunk.Size;
+            break;
+        default:
+            // CRC is not checked for the synthesized stream.
+            *data = reader->Footer;
+            *size = 4;
+            break;
+        }
+        return true;
+    }
+    s -= chunk_count * 3;
+    if (s == 0)
+    {
+        *data = reader->Footer + 4;
+        *size = 12;
+        return true;
+    }
+    return false;
+}
+
+static void APNGFrameReadFunc(png_structp png, png_bytep png_data, png_size_t length)
+{
+    APNGFrameReader* reader = reinterpret_cast<APNGFrameReader*>(png_get_io_ptr(png));
+    while (length > 0)
+    {
+        const uint8_t* data;
+        size_t         size;
+        if (!APNGNextSegment(reader, &data, &size))
+            png_error(png, "read beyond end of frame");
+        size_t n = size - reader->SegmentPos;
+        if (n > length)
+            n = length;
+        memcpy(png_data, data + reader->SegmentPos, n);
+        png_data           += n;
+        length             -= n;
+        reader->SegmentPos += n;
+        if (reader->SegmentPos == size)
+        {
+            ++reader->Segment;
+            reader->SegmentPos = 0;
+        }
+    }
+}
+
+// Decode frame to RGBA8888 into anim->FrameBuffer, with frame size as stride.
+static bool APNGDecodeFrame(const APNG* anim, const APNGFrame& frame)
+{
+    static const uint8_t signature[PNG_HEADER_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const uint8_t iend[12] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+
+    APNGFrameReader reader;
+    reader.Anim       = anim;
+    reader.Frame      = &frame;
+    reader.Segment    = 0;
+    reader.SegmentPos = 0;
+    memcpy(reader.Prefix, signature, PNG_HEADER_SIZE);
+    WriteBE32(reader.Prefix + PNG_HEADER_SIZE, 13);
+    memcpy(reader.Prefix + PNG_HEADER_SIZE + 4, "IHDR", 4);
+    memcpy(reader.Prefix + PNG_HEADER_SIZE + 8, anim->Data + anim->IHDROffset, 13);
+    WriteBE32(reader.Prefix + PNG_HEADER_SIZE + 8, (uint32_t)frame.Width);
+    WriteBE32(reader.Prefix + PNG_HEADER_SIZE + 12, (uint32_t)frame.Height);
+    memset(reader.Prefix + PNG_HEADER_SIZE + 21, 0, 4);
+    memset(reader.Footer, 0, 4);
+    memcpy(reader.Footer + 4, iend, sizeof(iend));
+
+    png_byte** rows = new png_byte*[frame.Height];
+    for (int i = 0; i < frame.Height; ++i)
+        rows[i] = anim->FrameBuffer + (size_t)i * frame.Width * 4;
+
+    png_struct* png  = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_info*   info = png_create_info_struct(png);
+
+    if (setjmp(png_jmpbuf(png)))
+    {
+        PNGClean(png, info, nullptr, rows);
+        return false;
+    }
+
+    png_set_crc_action(png, PNG_CRC_QUIET_USE, PNG_CRC_QUIET_USE);
+    png_set_read_fn(png, &reader, APNGFrameReadFunc);
+    png_read_info(png, info);
+
+    png_byte color_type = png_get_color_type(png, info);
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+    if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+    {
+        png_set_expand_gray_1_2_4_to_8(png);
+        png_set_gray_to_rgb(png);
+    }
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+    png_set_strip_16(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    png_read_image(png, rows);
+
+    PNGClean(png, info, nullptr, rows);
+    return true;
+}
+
+static void APNGClearRect(uint8_t* canvas, int canvas_width, int x, int y, int width, int height)
+{
+    for (int i = 0; i < height; ++i)
+        memset(canvas + ((size_t)(y + i) * canvas_width + x) * 4, 0, (size_t)width * 4);
+}
+
+static void APNGCopyRect(uint8_t* dst, const uint8_t* src, int canvas_width, int x, int y, int width, int height)
+{
+    for (int i = 0; i < height; ++i)
+    {
+        size_t offset = ((size_t)(y + i) * canvas_width + x) * 4;
+        memcpy(dst + offset, src + offset, (size_t)width * 4);
+    }
+}
+
+static void APNGBlendFrame(uint8_t* canvas, int canvas_width, const uint8_t* frame_pixels, const APNGFrame& frame)
+{
+    for (int i = 0; i < frame.Height; ++i)
+    {
+        uint8_t*       dst = canvas + ((size_t)(frame.Y + i) * canvas_width + frame.X) * 4;
+        const uint8_t* src = frame_pixels + (size_t)i * frame.Width * 4;
+        if (frame.Blend == APNGBlend_Source)
+        {
+            memcpy(dst, src, (size_t)frame.Width * 4);
+            continue;
+        }
+        for (int j = 0; j < frame.Width; ++j, dst += 4, src += 4)
+        {
+            const int sa = src[3];
+            if (sa == 0xFF)
+                memcpy(dst, src, 4);
+            else if (sa != 0)
+            {
+                const int da = dst[3] * (0xFF - sa) / 0xFF;
+                const int a  = sa + da;
+                for (int c = 0; c < 3; ++c)
+                    dst[c] = (uint8_t)((src[c] * sa + dst[c] * da) / a);
+                dst[3] = (uint8_t)a;
+            }
+        }
+    }
+}
+
+static void APNGUnionRect(int* rect, int x, int y, int width, int height)
+{
+    int x1 = rect[0] + rect[2] > x + width  ? rect[0] + rect[2] : x + width;
+    int y1 = rect[1] + rect[3] > y + height ? rect[1] + rect[3] : y + height;
+    rect[0] = rect[0] < x ? rect[0] : x;
+    rect[1] = rect[1] < y ? rect[1] : y;
+    rect[2] = x1 - rect[0];
+    rect[3] = y1 - rect[1];
+}
+
+// Dispose current frame and render frame of index onto canvas, returns false if the frame can't be decoded.
+static bool APNGRenderFrame(Context* ctx, int index)
+{
+    APNG* anim = ctx->Anim;
+    const size_t canvas_size = (size_t)ctx->Width * ctx->Height * 4;
+
+    if (!ctx->FramePixels || index == 0)
+    {
+        if (!ctx->FramePixels)
+            ctx->FramePixels = new uint8_t[canvas_size];
+        memset(ctx->FramePixels, 0, canvas_size);
+        anim->Dirty = false;
+    }
+    else
+    {
+        const APNGFrame& prev = anim->Frames[anim->FrameIndex];
+        anim->Dirty = true;
+        anim->DirtyRect[0] = prev.X;
+        anim->DirtyRect[1] = prev.Y;
+        anim->DirtyRect[2] = 0;
+        anim->DirtyRect[3] = 0;
+        if (prev.Dispose == APNGDispose_Background)
+        {
+            APNGClearRect(ctx->FramePixels, ctx->Width, prev.X, prev.Y, prev.Width, prev.Height);
+            APNGUnionRect(anim->DirtyRect, prev.X, prev.Y, prev.Width, prev.Height);
+        }
+        else if (prev.Dispose == APNGDispose_Previous && anim->PreviousPixels)
+        {
+            APNGCopyRect(ctx->FramePixels, anim->PreviousPixels, ctx->Width, prev.X, prev.Y, prev.Width, prev.Height);
+            APNGUnionRect(anim->DirtyRect, prev.X, prev.Y, prev.Width, prev.Height);
+        }
+    }
+
+    const APNGFrame& frame = anim->Frames[index];
+    if (frame.Dispose == APNGDispose_Previous)
+    {
+        if (!anim->PreviousPixels)
+            anim->PreviousPixels = new uint8_t[canvas_size];
+        APNGCopyRect(anim->PreviousPixels, ctx->FramePixels, ctx->Width, frame.X, frame.Y, frame.Width, frame.Height);
+    }
+
+    anim->FrameIndex = index;
+    if (anim->Dirty)
+    {
+        if (anim->DirtyRect[2] == 0)
+        {
+            anim->DirtyRect[0] = frame.X;
+            anim->DirtyRect[1] = frame.Y;
+            anim->DirtyRect[2] = frame.Width;
+            anim->DirtyRect[3] = frame.Height;
+        }
+        else
+            APNGUnionRect(anim->DirtyRect, frame.X, frame.Y, frame.Width, frame.Height);
+    }
+
+    if (!APNGDecodeFrame(anim, frame))
+        return false;
+    APNGBlendFrame(ctx->FramePixels, ctx->Width, anim->FrameBuffer, frame);
+    return true;
+}
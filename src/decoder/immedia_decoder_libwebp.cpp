@@ -5,6 +5,7 @@
 #include "webp/demux.h"
 
 #include "immedia_image.h"
+#include "immedia_pixel_convert.h"
 
 static void* CreateContextFromFile(void* f, size_t file_size);
 static void* CreateContextFromData(const uint8_t* data, size_t data_size);
@@ -14,6 +15,8 @@ static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
 static bool ReadNextFrame(void* context);
+static void* CreateContextFromSource(const ImMedia::ImageSource& source);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 void ImMedia_DecoderLibwebp_Install()
 {
@@ -23,10 +26,24 @@ void ImMedia_DecoderLibwebp_Install()
         DeleteContext,
         GetInfo,
         ReadFrame,
-        ReadNextFrame
+        ReadNextFrame,
+        nullptr,
+        CreateContextFromSource,
+        Probe,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr
     });
 }
 
+#ifdef IMMEDIA_DECODER_PLUGIN
+IMMEDIA_DECODER_PLUGIN_ENTRY
+{
+    ImMedia_DecoderLibwebp_Install();
+}
+#endif
+
 
 
 struct Context
@@ -40,8 +57,20 @@ struct Context
     uint8_t* FramePixels;
     int      FrameDelay;
     int      PreviousTimeStamp;
+
+    // Animation decoder always outputs RGBA, frames of opaque animations are converted to RGB here.
+    ImVector<uint8_t> OpaquePixels;
+
+    // Contexts from ImageSource don't own WebpData, it points to mapped source or SourceData.
+    bool                 OwnsWebpData;
+    ImMedia::ImageSource Source;
+    bool                 SourceOpen;
+    bool                 Streaming;   // Still image decoded incrementally while reading source in ReadFrame.
+    ImVector<uint8_t>    SourceData;
 };
 
+static bool DecodeFromSource(Context* ctx);
+
 static Context* CreateContext(const WebPData& webp_data)
 {
     if (WebPGetInfo(webp_data.bytes, webp_data.size, nullptr, nullptr) == false)
@@ -71,6 +100,10 @@ static Context* CreateContext(const WebPData& webp_data)
     ctx->FrameDelay = 0;
     ctx->PreviousTimeStamp = 0;
 
+    ctx->OwnsWebpData = true;
+    ctx->SourceOpen   = false;
+    ctx->Streaming    = false;
+
     return ctx;
 }
 
@@ -99,11 +132,77 @@ static void* CreateContextFromData(const uint8_t* data, size_t data_size)
     return CreateContext(webp_data);
 }
 
+static void* CreateContextFromSource(const ImMedia::ImageSource& source)
+{
+    Context* ctx = nullptr;
+
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (mapped)
+    {
+        ctx = CreateContext({ mapped, mapped_size });
+        if (!ctx)
+        {
+            ImMedia::CloseImageSource(source);
+            return nullptr;
+        }
+        ctx->OwnsWebpData = false;
+        ctx->Source       = source;
+        ctx->SourceOpen   = true;
+        return ctx;
+    }
+
+    // Read until the features are known.
+    ImVector<uint8_t> data;
+    WebPBitstreamFeatures features;
+    VP8StatusCode status = VP8_STATUS_NOT_ENOUGH_DATA;
+    while (status == VP8_STATUS_NOT_ENOUGH_DATA)
+    {
+        const int offset = data.Size;
+        data.resize(offset + 256);
+        data.resize(offset + (int)source.Read(source.UserData, data.Data + offset, 256));
+        if (data.Size == offset)
+            break;
+        status = WebPGetFeatures(data.Data, data.Size, &features);
+    }
+    if (status != VP8_STATUS_OK)
+    {
+        ImMedia::CloseImageSource(source);
+        return nullptr;
+    }
+
+    // Animation decoder needs the whole file, a still image is decoded as it arrives.
+    if (features.has_animation)
+    {
+        ImMedia::ReadImageSourceToEnd(source, data);
+        ImMedia::CloseImageSource(source);
+    }
+    ctx = CreateContext({ data.Data, (size_t)data.Size });
+    if (!ctx)
+    {
+        if (!features.has_animation)
+            ImMedia::CloseImageSource(source);
+        return nullptr;
+    }
+    ctx->OwnsWebpData = false;
+    ctx->SourceData.swap(data);
+    if (!features.has_animation)
+    {
+        ctx->Source     = source;
+        ctx->SourceOpen = true;
+        ctx->Streaming  = true;
+    }
+    return ctx;
+}
+
 static void DeleteContext(void* context)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
     WebPFreeDecBuffer(&ctx->DecoderConfig.output);
-    WebPDataClear(&ctx->WebpData);
+    if (ctx->OwnsWebpData)
+        WebPDataClear(&ctx->WebpData);
+    if (ctx->SourceOpen)
+        ImMedia::CloseImageSource(ctx->Source);
     if (ctx->AnimDecoderOptions)
     {
         delete ctx->AnimDecoderOptions;
@@ -135,6 +234,35 @@ static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat
     }
 }
 
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    WebPBitstreamFeatures feature;
+    if (WebPGetFeatures(data, data_size, &feature) != VP8_STATUS_OK)
+        return false;
+
+    if (width)
+        *width = feature.width;
+    if (height)
+        *height = feature.height;
+    if (format)
+        *format = feature.has_alpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+    if (frame_count)
+    {
+        if (!feature.has_animation)
+            *frame_count = 0;
+        else
+        {
+            // Frames are only counted if data contains the whole file.
+            WebPData       webp_data = { data, data_size };
+            WebPDemuxState state;
+            WebPDemuxer*   demux = WebPDemuxPartial(&webp_data, &state);
+            *frame_count = demux && state == WEBP_DEMUX_DONE ? (int)WebPDemuxGetI(demux, WEBP_FF_FRAME_COUNT) : -1;
+            WebPDemuxDelete(demux);
+        }
+    }
+    return true;
+}
+
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
 {
     Context* ctx = reinterpret_cast<Context*>(context);
@@ -143,7 +271,12 @@ static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
     {
         if (!ctx->DecoderConfig.output.u.RGBA.rgba)
         {
-            if (WebPDecode(ctx->WebpData.bytes, ctx->WebpData.size, &ctx->DecoderConfig) != VP8_STATUS_OK)
+            if (ctx->Streaming)
+            {
+                if (!DecodeFromSource(ctx))
+                    return false;
+            }
+            else if (WebPDecode(ctx->WebpData.bytes, ctx->WebpData.size, &ctx->DecoderConfig) != VP8_STATUS_OK)
                 return false;
         }
         *pixels = ctx->DecoderConfig.output.u.RGBA.rgba;
@@ -174,10 +307,50 @@ static bool ReadNextFrame(void* context)
         ctx->PreviousTimeStamp = 0;
     }
 
-    int timestamp;
-    WebPAnimDecoderGetNext(ctx->AnimDecoder, &ctx->FramePixels, &timestamp);
+    int      timestamp;
+    uint8_t* frame;
+    if (!WebPAnimDecoderGetNext(ctx->AnimDecoder, &frame, &timestamp))
+        return false;
     ctx->FrameDelay = timestamp - ctx->PreviousTimeStamp;
     ctx->PreviousTimeStamp = timestamp;
 
+    const WebPBitstreamFeatures& feature = ctx->DecoderConfig.input;
+    if (feature.has_alpha)
+        ctx->FramePixels = frame;
+    else
+    {
+        ctx->OpaquePixels.resize(feature.width * feature.height * 3);
+        ImMedia::ConvertPixels(frame, ImMedia::PixelFormat::RGBA8888, 0,
+                               ctx->OpaquePixels.Data, ImMedia::PixelFormat::RGB888, 0, feature.width, feature.height);
+        ctx->FramePixels = ctx->OpaquePixels.Data;
+    }
+
     return true;
 }
+
+static bool DecodeFromSource(Context* ctx)
+{
+    WebPIDecoder* decoder = WebPIDecode(nullptr, 0, &ctx->DecoderConfig);
+    VP8StatusCode status  = decoder
+        ? WebPIAppend(decoder, ctx->SourceData.Data, ctx->SourceData.Size)
+        : VP8_STATUS_OUT_OF_MEMORY;
+
+    // WebPIAppend keeps its own copy, the buffer is reused for each read.
+    ctx->SourceData.resize(65536);
+    while (status == VP8_STATUS_SUSPENDED)
+    {
+        size_t size = ctx->Source.Read(ctx->Source.UserData, ctx->SourceData.Data, ctx->SourceData.Size);
+        if (size == 0)
+            break;
+        status = WebPIAppend(decoder, ctx->SourceData.Data, size);
+    }
+    if (decoder)
+        WebPIDelete(decoder);
+
+    ImMedia::CloseImageSource(ctx->Source);
+    ctx->SourceOpen = false;
+    ctx->Streaming  = false;
+    ctx->SourceData.clear();
+    ctx->WebpData   = { nullptr, 0 };
+    return status == VP8_STATUS_OK;
+}
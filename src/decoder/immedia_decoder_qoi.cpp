@@ -13,6 +13,7 @@ static void DeleteContext(void* context);
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 void ImMedia_DecoderQOI_Install()
 {
@@ -22,6 +23,13 @@ void ImMedia_DecoderQOI_Install()
         DeleteContext,
         GetInfo,
         ReadFrame,
+        nullptr,
+        nullptr,
+        nullptr,
+        Probe,
+        nullptr,
+        nullptr,
+        nullptr,
         nullptr
     });
 }
@@ -70,3 +78,19 @@ static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
     *delay_in_ms = 0;
     return true;
 }
+
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    // Magic, big-endian width and height, channels, colorspace.
+    if (data_size < QOI_HEADER_SIZE || memcmp(data, "qoif", 4) != 0 || (data[12] != 3 && data[12] != 4))
+        return false;
+    if (width)
+        *width = (int)(((uint32_t)data[4] << 24) | ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7]);
+    if (height)
+        *height = (int)(((uint32_t)data[8] << 24) | ((uint32_t)data[9] << 16) | ((uint32_t)data[10] << 8) | data[11]);
+    if (format)
+        *format = data[12] == 3 ? ImMedia::PixelFormat::RGB888 : ImMedia::PixelFormat::RGBA8888;
+    if (frame_count)
+        *frame_count = 0;
+    return true;
+}
@@ -20,6 +20,7 @@ static void DeleteContext(void* context);
 static void GetInfo(void* context, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count);
 
 void ImMedia_DecoderSTB_Install(DecoderSTBFormat format)
 {
@@ -29,6 +30,13 @@ void ImMedia_DecoderSTB_Install(DecoderSTBFormat format)
         DeleteContext,
         GetInfo,
         ReadFrame,
+        nullptr,
+        nullptr,
+        nullptr,
+        Probe,
+        nullptr,
+        nullptr,
+        nullptr,
         nullptr
     };
 
@@ -64,22 +72,25 @@ struct Context
     uint8_t* Pixels;
 };
 
+static ImMedia::PixelFormat GetFormat(int channels)
+{
+    return channels == STBI_grey_alpha || channels == STBI_rgb_alpha ? ImMedia::PixelFormat::RGBA8888 : ImMedia::PixelFormat::RGB888;
+}
+
 static void* CreateContextFromData(const uint8_t* data, size_t data_size)
 {
     if (data_size > INT_MAX)
         return nullptr;
 
     int width, height, channels;
-    uint8_t* pixels = stbi_load_from_memory(data, static_cast<int>(data_size), &width, &height, &channels, STBI_default);
-    if (!pixels)
+    if (!stbi_info_from_memory(data, static_cast<int>(data_size), &width, &height, &channels))
         return nullptr;
 
-    ImMedia::PixelFormat format;
-    if (channels == STBI_rgb)
-        format = ImMedia::PixelFormat::RGB888;
-    else if (channels != STBI_rgb_alpha)
-        format = ImMedia::PixelFormat::RGBA8888;
-    else
+    // Gray is expanded to RGB, so the format is the same as Probe.
+    const ImMedia::PixelFormat format = GetFormat(channels);
+    uint8_t* pixels = stbi_load_from_memory(data, static_cast<int>(data_size), &width, &height, &channels,
+                                            PIXEL_FORMAT_SIZE(format));
+    if (!pixels)
         return nullptr;
 
     Context* ctx = new Context();
@@ -113,3 +124,15 @@ static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
     *delay_in_ms = 0;
     return true;
 }
+
+static bool Probe(const uint8_t* data, size_t data_size, int* width, int* height, ImMedia::PixelFormat* format, int* frame_count)
+{
+    int w, h, channels;
+    if (data_size > INT_MAX || !stbi_info_from_memory(data, static_cast<int>(data_size), &w, &h, &channels))
+        return false;
+    if (width)  *width  = w;
+    if (height) *height = h;
+    if (format) *format = GetFormat(channels);
+    if (frame_count) *frame_count = 0;
+    return true;
+}
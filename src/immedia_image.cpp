@@ -5,9 +5,34 @@
 
 #define IMGUI_DEFINE_MATH_OPERATORS
 #include "immedia_image.h"
+#include "immedia_pack.h"
+#include "immedia_pixel_convert.h"
+#include "immedia_resize.h"
+#include "immedia_trace.h"
 
 #include <ctype.h>
+#include <float.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+#endif
 
 #include "imgui_internal.h"
 
@@ -15,58 +40,274 @@ namespace ImMedia {
 
 static bool CompareFormat(const char* format_in_lowercase, const char* s);
 static const char* GetFileExtension(const char* filename);
+static void* CreateRendererContext(int width, int height, PixelFormat format, bool has_anim);
+static void DeleteRendererContext(void* context, int width, int height, PixelFormat format, bool has_anim);
+static void TrimTexturePool(size_t max_bytes, int min_frame);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+static ImGuiID HashFormat(const char* format);
+static void InstallDefaultImageSignatures();
+#endif
 
 
 
 #ifndef IMMEDIA_NO_IMAGE_DECODER
 
+enum class ImageDecoderPluginState : int
+{
+    Unloaded,
+    Loaded,
+    Failed,
+};
+
+// Shared library installing decoders, loaded on the first lookup of one of its formats.
+struct ImageDecoderPlugin
+{
+    const char*                          Library;
+    void*                                Handle;  // Guarded by DecoderPluginMutex.
+    std::atomic<ImageDecoderPluginState> State;
+};
+
 struct ImageDecoderInfo
 {
     const char*         Format;
-    const ImageDecoder* Decoder;
+    const ImageDecoder* Decoder;  // Null until the plug-in is loaded.
+    ImageDecoderPlugin* Plugin;   // [nullable] Set while the format is installed from a library.
+};
+
+struct ImageSignature
+{
+    const char*    Format;
+    const uint8_t* Bytes;
+    int            Size;
+    int            Offset;
+};
+
+// Immutable once published. Installing copies the current registry and publishes the copy,
+// so lookups from any thread read a consistent snapshot without locking.
+struct ImageDecoderRegistry
+{
+    ImVector<ImageDecoderInfo> Decoders;
+    ImGuiStorage               DecoderIndex;  // Hash of format to index of Decoders + 1.
+    ImVector<ImageSignature>   Signatures;
+};
+
+// Bytes read by ProbeImage, the larger size is only read if the header doesn't fit in the first.
+#define IMAGE_PROBE_SIZE     4096
+#define IMAGE_PROBE_MAX_SIZE 65536
+
+// Textures of an animation, filled while decoding the first loop.
+struct ImageFrameCache
+{
+    ImVector<void*> Contexts;
+    ImVector<int>   Delays;      // One per filled context.
+    int             FrameCount;
+    int             FrameIndex;
+    int             LoopCount;   // Of the decoder, 0 to loop forever.
+    int             PlayedLoops;
+    size_t          Bytes;
+    bool            Complete;
 };
 
 #endif // !IMMEDIA_NO_IMAGE_DECODER
 
+struct PooledTexture
+{
+    void*       Context;
+    ImGuiID     Key;      // Hash of size, format and animation flag.
+    size_t      Bytes;
+    int         Frame;    // ImGui frame it was released in.
+};
+
+enum class ImageHandleState : uint8_t
+{
+    Free,
+    Loaded,
+    Evicted,  // Image is deleted, loaded again from Filenames when used.
+};
+
+// Structure of arrays indexed by ImageHandle::Index. The arrays scanned every frame are kept apart from images.
+struct ImageHandleStorage
+{
+    ImVector<uint32_t>         Generations;
+    ImVector<ImageHandleState> States;
+    ImVector<int>              LastUsedFrames;
+    ImVector<size_t>           NextFrameTimes;  // SIZE_MAX if there is no frame to play, or it is being uploaded.
+    ImVector<ImTextureID>      Textures;
+    ImVector<ImVec2>           Sizes;           // For display, kept while evicted.
+
+    ImVector<Image*>           Images;          // Null if free or evicted.
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    ImVector<char*>            Filenames;       // Null if not loaded from file.
+    ImVector<const ImageDecoder*> Decoders;
+#endif
+
+    ImVector<uint32_t>         FreeIndices;
+    ImVector<uint32_t>         PendingIndices;  // Textures to refresh once frames are uploaded.
+    int                        EvictAfterFrames = 0;
+
+    ImageHandle Add(Image* image);
+    void        Remove(uint32_t index);
+    void        Refresh(uint32_t index);
+    Image*      Use(uint32_t index);
+    void        Show(uint32_t index, const ImVec2& size, ImageFillMode fill_mode,
+                     const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col);
+    void        Tick();
+    void        RefreshPending();
+    void        Clear();
+};
+
 
 struct ImMediaContext
 {
 #ifndef IMMEDIA_NO_IMAGE_DECODER
-    ImVector<ImageDecoderInfo> ImageDecoders;
+    std::atomic<ImageDecoderRegistry*> DecoderRegistry{ nullptr };
+    std::mutex                         DecoderRegistryMutex;      // Serializes installs, lookups don't take it.
+    ImVector<ImageDecoderRegistry*>    RetiredDecoderRegistries;  // Replaced snapshots, lookups may still read them.
+    ImVector<ImageDecoder*>            InstalledDecoders;         // Every installed decoder, replaced ones included.
+    ImVector<ImageDecoderPlugin*>      DecoderPlugins;            // Guarded by DecoderRegistryMutex.
+    std::mutex                         DecoderPluginMutex;        // Serializes loading libraries.
 #endif
 
-    ImageRenderer* PImageRenderer = nullptr;
-    ImageRenderer  ImageRenderer  = {};
+    std::atomic<ImageRenderer*> PImageRenderer{ nullptr };
+    ImageRenderer               ImageRenderer = {};
 
     Image* EmptyImage = nullptr;
+
+    ImageHandleStorage Handles;
+
+    size_t            FrameDeadline     = SIZE_MAX;  // Milliseconds of ImGui time, of animations played since EndFrame started.
+    size_t            AnimationDeadline = SIZE_MAX;  // Of animations played in the previous frame.
+    std::atomic<bool> WakeUpRequested{ false };
+    void            (*WakeUpCallback)(void* user_data) = nullptr;
+    void*             WakeUpUserData = nullptr;
+
+    ImVector<uint8_t> ScratchPixels;
+    ThreadPool*       WorkerPool = nullptr;  // CPU work of the render thread, created on first use.
+
+    bool                    TexturePoolEnabled  = false;
+    size_t                  TexturePoolMaxBytes = 0;
+    int                     TexturePoolMaxAge   = 0;
+    size_t                  TexturePoolBytes    = 0;
+    ImVector<PooledTexture> TexturePool;  // In release order, the oldest first.
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    bool            UploadQueueEnabled = false;
+    size_t          UploadBudgetBytes  = 0;
+    float           UploadBudgetMs     = 0.0f;
+    ImVector<Image*> UploadQueue;
+
+    bool            FrameCacheEnabled       = false;
+    size_t          FrameCacheMaxImageBytes = 0;
+    size_t          FrameCacheMaxTotalBytes = 0;
+    size_t          FrameCacheBytes         = 0;
+
+    bool            FormatCompactionEnabled = false;
+    ImGuiStorage    FormatCache;  // Hash of filename, size and decoded format to compacted format.
+#endif
 };
 
 static ImMediaContext* g_context = nullptr;
 
+static ThreadPool* GetWorkerPool()
+{
+    if (!g_context->WorkerPool)
+        g_context->WorkerPool = new ThreadPool();
+    return g_context->WorkerPool;
+}
+
+static void RecordAnimationDeadline(size_t time)
+{
+    if (time < g_context->FrameDeadline)
+        g_context->FrameDeadline = time;
+}
+
 void CreateContext()
 {
     if (g_context != nullptr)
         return;
     g_context = new ImMediaContext();
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->DecoderRegistry.store(new ImageDecoderRegistry());
+    InstallDefaultImageSignatures();
+#endif
 }
 
 void DestoryContext()
 {
     assert(g_context);
 
+    g_context->Handles.Clear();
+
 #ifndef IMMEDIA_NO_IMAGE_DECODER
-    for (int i = 0; i < g_context->ImageDecoders.size(); ++i)
-        delete g_context->ImageDecoders[i].Decoder;
+    for (int i = 0; i < g_context->InstalledDecoders.Size; ++i)
+        delete g_context->InstalledDecoders[i];
+    for (int i = 0; i < g_context->RetiredDecoderRegistries.Size; ++i)
+        delete g_context->RetiredDecoderRegistries[i];
+    delete g_context->DecoderRegistry.load();
+    UnmountAllPacks();
+
+    // Last, decoders of replaced registries may still point into libraries.
+    for (int i = 0; i < g_context->DecoderPlugins.Size; ++i)
+    {
+        ImageDecoderPlugin* plugin = g_context->DecoderPlugins[i];
+        if (plugin->Handle)
+        {
+#ifdef _WIN32
+            FreeLibrary((HMODULE)plugin->Handle);
+#else
+            dlclose(plugin->Handle);
+#endif
+        }
+        delete plugin;
+    }
 #endif
 
+    DisableTexturePool();
     if (g_context->EmptyImage)
         delete g_context->EmptyImage;
 
+    if (g_context->WorkerPool)
+        delete g_context->WorkerPool;
+
     delete g_context;
+    g_context = nullptr;
 }
 
 #ifndef IMMEDIA_NO_IMAGE_DECODER
 
+// Must be called with DecoderRegistryMutex locked. The replaced snapshot is freed in DestoryContext,
+// installs are rare so it is cheaper than tracking readers.
+static void PublishDecoderRegistry(ImageDecoderRegistry* registry)
+{
+    g_context->RetiredDecoderRegistries.push_back(g_context->DecoderRegistry.load());
+    g_context->DecoderRegistry.store(registry, std::memory_order_release);
+}
+
+// Must be called with DecoderRegistryMutex locked.
+static void PublishImageDecoder(const char* format, const ImageDecoder* decoder, ImageDecoderPlugin* plugin)
+{
+    ImageDecoderRegistry* registry = new ImageDecoderRegistry(*g_context->DecoderRegistry.load());
+
+    // A replaced decoder is kept alive, other threads may still hold it.
+    bool replaced = false;
+    for (int i = 0; i < registry->Decoders.Size && !replaced; ++i)
+    {
+        ImageDecoderInfo& info = registry->Decoders[i];
+        if (CompareFormat(info.Format, format))
+        {
+            info.Decoder = decoder;
+            info.Plugin  = plugin;
+            replaced     = true;
+        }
+    }
+    if (!replaced)
+    {
+        registry->Decoders.push_back({ format, decoder, plugin });
+        registry->DecoderIndex.SetInt(HashFormat(format), registry->Decoders.Size);
+    }
+    PublishDecoderRegistry(registry);
+}
+
 void InstallImageDecoder(const char* format, const ImageDecoder& decoder)
 {
     assert(g_context);
@@ -78,17 +319,82 @@ void InstallImageDecoder(const char* format, const ImageDecoder& decoder)
     if (format == nullptr || format[0] == '\0')
         return;
 
-    for (int i = 0; i < g_context->ImageDecoders.size(); ++i)
+    std::lock_guard<std::mutex> lock(g_context->DecoderRegistryMutex);
+    ImageDecoder* installed = new ImageDecoder(decoder);
+    g_context->InstalledDecoders.push_back(installed);
+    PublishImageDecoder(format, installed, nullptr);
+}
+
+void InstallImageDecoder(const char* format, const char* library)
+{
+    assert(g_context);
+    assert(library);
+
+    if (format == nullptr || format[0] == '\0')
+        return;
+
+    std::lock_guard<std::mutex> lock(g_context->DecoderRegistryMutex);
+    ImageDecoderPlugin* plugin = nullptr;
+    for (int i = 0; i < g_context->DecoderPlugins.Size && !plugin; ++i)
+        if (strcmp(g_context->DecoderPlugins[i]->Library, library) == 0)
+            plugin = g_context->DecoderPlugins[i];
+    if (!plugin)
+    {
+        plugin = new ImageDecoderPlugin{ library, nullptr, { ImageDecoderPluginState::Unloaded } };
+        g_context->DecoderPlugins.push_back(plugin);
+    }
+    PublishImageDecoder(format, nullptr, plugin);
+}
+
+static const ImageDecoderInfo* FindImageDecoderInfo(const ImageDecoderRegistry* registry, const char* format)
+{
+    const int index = registry->DecoderIndex.GetInt(HashFormat(format), 0);
+    if (index > 0 && CompareFormat(registry->Decoders[index - 1].Format, format))
+        return &registry->Decoders[index - 1];
+
+    // Only reached for unknown formats and hash collisions.
+    for (int i = 0; i < registry->Decoders.Size; ++i)
     {
-        ImageDecoderInfo& info = g_context->ImageDecoders[i];
+        const ImageDecoderInfo& info = registry->Decoders[i];
         if (CompareFormat(info.Format, format))
+            return &info;
+    }
+
+    return nullptr;
+}
+
+// False for formats of plug-ins which failed to load, or which loaded without installing the format.
+static bool IsImageDecoderAvailable(const ImageDecoderInfo* info)
+{
+    return info && (info->Decoder || info->Plugin->State.load(std::memory_order_acquire) == ImageDecoderPluginState::Unloaded);
+}
+
+// The library installs its decoders through InstallImageDecoder, which replaces the plug-in entries.
+static const ImageDecoder* LoadImageDecoderPlugin(ImageDecoderPlugin* plugin, const char* format)
+{
+    if (plugin->State.load(std::memory_order_acquire) == ImageDecoderPluginState::Unloaded)
+    {
+        std::lock_guard<std::mutex> lock(g_context->DecoderPluginMutex);
+        if (plugin->State.load(std::memory_order_relaxed) == ImageDecoderPluginState::Unloaded)
         {
-            delete info.Decoder;
-            info.Decoder = new ImageDecoder(decoder);
-            return;
+            void (*install)() = nullptr;
+#ifdef _WIN32
+            plugin->Handle = (void*)LoadLibraryA(plugin->Library);
+            if (plugin->Handle)
+                install = (void (*)())GetProcAddress((HMODULE)plugin->Handle, "ImMedia_InstallDecoderPlugin");
+#else
+            plugin->Handle = dlopen(plugin->Library, RTLD_NOW | RTLD_LOCAL);
+            if (plugin->Handle)
+                install = (void (*)())dlsym(plugin->Handle, "ImMedia_InstallDecoderPlugin");
+#endif
+            if (install)
+                install();
+            plugin->State.store(install ? ImageDecoderPluginState::Loaded : ImageDecoderPluginState::Failed, std::memory_order_release);
         }
     }
-    g_context->ImageDecoders.push_back({ format, new ImageDecoder(decoder) });
+
+    const ImageDecoderInfo* info = FindImageDecoderInfo(g_context->DecoderRegistry.load(std::memory_order_acquire), format);
+    return info ? info->Decoder : nullptr;
 }
 
 const ImageDecoder* GetImageDecoder(const char* format)
@@ -97,294 +403,1993 @@ const ImageDecoder* GetImageDecoder(const char* format)
 
     if (format == nullptr || format[0] == '\0')
         return nullptr;
+    const ImageDecoderInfo* info = FindImageDecoderInfo(g_context->DecoderRegistry.load(std::memory_order_acquire), format);
+    if (!info)
+        return nullptr;
+    if (info->Decoder || !info->Plugin)
+        return info->Decoder;
+    return LoadImageDecoderPlugin(info->Plugin, format);
+}
+
+void InstallImageSignature(const char* format, const uint8_t* signature, int signature_size, int offset)
+{
+    assert(g_context);
+    assert(signature_size > 0 && offset >= 0);
+
+    std::lock_guard<std::mutex> lock(g_context->DecoderRegistryMutex);
+    ImageDecoderRegistry* registry = new ImageDecoderRegistry(*g_context->DecoderRegistry.load());
+    registry->Signatures.push_back({ format, signature, signature_size, offset });
+    PublishDecoderRegistry(registry);
+}
+
+const char* DetectImageFormat(const uint8_t* data, size_t data_size)
+{
+    assert(g_context);
 
-    for (int i = 0; i < g_context->ImageDecoders.size(); ++i)
+    const ImageDecoderRegistry*     registry   = g_context->DecoderRegistry.load(std::memory_order_acquire);
+    const ImVector<ImageSignature>& signatures = registry->Signatures;
+    for (int i = signatures.Size - 1; i >= 0; --i)
     {
-        ImageDecoderInfo& info = g_context->ImageDecoders[i];
-        if (CompareFormat(info.Format, format))
-            return info.Decoder;
+        const ImageSignature& signature = signatures[i];
+        if ((size_t)signature.Offset + signature.Size > data_size
+            || memcmp(data + signature.Offset, signature.Bytes, signature.Size) != 0)
+            continue;
+        if (IsImageDecoderAvailable(FindImageDecoderInfo(registry, signature.Format)))
+            return signature.Format;
     }
-
     return nullptr;
 }
 
-#endif // !IMMEDIA_NO_IMAGE_DECODER
+static bool ProbeImageContext(void* context, const ImageDecoder* decoder, ImageInfo* info)
+{
+    if (!context)
+        return false;
+    decoder->GetInfo(context, &info->Width, &info->Height, &info->Format, &info->FrameCount);
+    decoder->DeleteContext(context);
+    return true;
+}
 
-void InstallImageRenderer(const ImageRenderer& renderer)
+bool ProbeImage(const uint8_t* data, size_t data_size, ImageInfo* info, const char* format)
 {
-    assert(g_context);
-    assert(!g_context->PImageRenderer);
-    assert(renderer.CreateContext);
-    assert(renderer.DeleteContext);
-    assert(renderer.GetTexture);
-    assert(renderer.WriteFrame);
+    const ImageDecoder* decoder = GetImageDecoder(format ? format : DetectImageFormat(data, data_size));
+    if (!decoder)
+        return false;
 
-    g_context->ImageRenderer = renderer;
-    g_context->PImageRenderer = &g_context->ImageRenderer;
-    uint8_t pixels[] = { 0x00, 0x00, 0x00, 0x00 };
-    g_context->EmptyImage = new Image(1, 1, PixelFormat::RGBA8888, pixels);
+    info->Decoder = decoder;
+    if (decoder->Probe)
+        return decoder->Probe(data, data_size, &info->Width, &info->Height, &info->Format, &info->FrameCount);
+    return ProbeImageContext(IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData", decoder->CreateContextFromData(data, data_size)), decoder, info);
 }
 
-const ImageRenderer* GetImageRenderer()
-{ 
-    assert(g_context);
-    return g_context->PImageRenderer;
+bool ProbeImage(const char* filename, ImageInfo* info, const char* format)
+{
+    if (IsPackPath(filename))
+    {
+        PackEntryInfo entry;
+        if (!GetPackEntryInfo(filename, &entry))
+            return false;
+        info->Decoder    = format ? GetImageDecoder(format) : GetPackEntryDecoder(filename);
+        info->Width      = entry.Width;
+        info->Height     = entry.Height;
+        info->Format     = entry.Format;
+        info->FrameCount = entry.FrameCount;
+        return info->Decoder != nullptr;
+    }
+
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    uint8_t head[IMAGE_PROBE_SIZE];
+    const size_t head_size = fread(head, 1, sizeof(head), f);
+
+    const ImageDecoder* decoder = nullptr;
+    if (format)
+        decoder = GetImageDecoder(format);
+    else
+    {
+        decoder = GetImageDecoder(DetectImageFormat(head, head_size));
+        if (!decoder)
+            decoder = GetImageDecoder(GetFileExtension(filename));
+    }
+    if (!decoder)
+    {
+        fclose(f);
+        return false;
+    }
+    info->Decoder = decoder;
+
+    if (decoder->Probe)
+    {
+        bool probed = decoder->Probe(head, head_size, &info->Width, &info->Height, &info->Format, &info->FrameCount);
+        if (!probed && head_size == sizeof(head))
+        {
+            // Metadata before the header, e.g. EXIF of jpeg or ICC profile of png.
+            ImVector<uint8_t> data;
+            data.resize(IMAGE_PROBE_MAX_SIZE);
+            memcpy(data.Data, head, head_size);
+            const size_t data_size = head_size + fread(data.Data + head_size, 1, data.Size - head_size, f);
+            probed = decoder->Probe(data.Data, data_size, &info->Width, &info->Height, &info->Format, &info->FrameCount);
+        }
+        if (probed)
+        {
+            fclose(f);
+            return true;
+        }
+    }
+    fclose(f);
+
+    return ProbeImageContext(CreateDecoderContext(filename, decoder), decoder, info);
 }
 
-#ifndef IMMEDIA_NO_IMAGE_DECODER
+void* CreateDecoderContext(const char* filename, const ImageDecoder* decoder)
+{
+    if (!filename || !decoder)
+        return nullptr;
 
+    if (IsPackPath(filename))
+    {
+        ImageSource source;
+        return OpenPackEntry(filename, &source) ? CreateDecoderContext(source, decoder) : nullptr;
+    }
 
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return nullptr;
 
-Image::Image(const char* filename, const char* format) noexcept
+    fseek(f, 0, SEEK_END);
+    size_t file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (decoder->CreateContextFromFile)
+        return IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromFile", decoder->CreateContextFromFile(f, file_size));
+
+    uint8_t* data = new uint8_t[file_size];
+    fread(data, 1, file_size, f);
+    fclose(f);
+    void* context = IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData", decoder->CreateContextFromData(data, file_size));
+    delete[] data;
+    return context;
+}
+
+void* CreateDecoderContext(const ImageSource& source, const ImageDecoder* decoder)
 {
-    Load(filename, GetImageDecoder(format == nullptr ? GetFileExtension(filename) : format));
+    if (!decoder)
+    {
+        CloseImageSource(source);
+        return nullptr;
+    }
+
+    if (decoder->CreateContextFromSource)
+        return IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromSource", decoder->CreateContextFromSource(source));
+
+    void* context = nullptr;
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (mapped)
+        context = IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData", decoder->CreateContextFromData(mapped, mapped_size));
+    else
+    {
+        ImVector<uint8_t> data;
+        ReadImageSourceToEnd(source, data);
+        if (!data.empty())
+            context = IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData", decoder->CreateContextFromData(data.Data, data.Size));
+    }
+    CloseImageSource(source);
+    return context;
 }
 
-Image::Image(const char* filename, const ImageDecoder* decoder) noexcept
+bool ReadFinalFrame(void* context, const ImageDecoder* decoder, uint8_t** pixels, int* delay_in_ms)
 {
-    Load(filename, decoder);
+    int         width, height, frame_count;
+    PixelFormat format;
+    decoder->GetInfo(context, &width, &height, &format, &frame_count);
+
+    bool read = IMMEDIA_TRACE_CALL("ImageDecoder::ReadFrame", decoder->ReadFrame(context, pixels, delay_in_ms)) && *pixels;
+    while (read && frame_count == 0 && decoder->ReadNextFrame
+           && IMMEDIA_TRACE_CALL("ImageDecoder::ReadNextFrame", decoder->ReadNextFrame(context)))
+        read = IMMEDIA_TRACE_CALL("ImageDecoder::ReadFrame", decoder->ReadFrame(context, pixels, delay_in_ms)) && *pixels;
+    return read;
 }
 
-Image::Image(const uint8_t* data, size_t data_size, const char* format) noexcept
+size_t ReadImageSource(const ImageSource& source, void* buffer, size_t size)
 {
-    Load(data, data_size, GetImageDecoder(format));
+    size_t total = 0;
+    while (total < size)
+    {
+        size_t n = source.Read(source.UserData, (uint8_t*)buffer + total, size - total);
+        if (n == 0)
+            break;
+        total += n;
+    }
+    return total;
 }
 
-Image::Image(const uint8_t* data, size_t data_size, const ImageDecoder* decoder) noexcept
+bool SkipImageSource(const ImageSource& source, size_t size)
 {
-    Load(data, data_size, decoder);
+    if (source.Skip)
+        return source.Skip(source.UserData, size);
+
+    uint8_t buffer[4096];
+    while (size > 0)
+    {
+        size_t n = ReadImageSource(source, buffer, size < sizeof(buffer) ? size : sizeof(buffer));
+        if (n == 0)
+            return false;
+        size -= n;
+    }
+    return true;
 }
 
-Image::Image(void* decoder_context, const ImageDecoder* decoder) noexcept
+void ReadImageSourceToEnd(const ImageSource& source, ImVector<uint8_t>& buffer)
 {
-    Load(decoder_context, decoder);
+    const size_t size_hint = source.GetSize ? source.GetSize(source.UserData) : 0;
+    if (size_hint > (size_t)buffer.Size)
+        buffer.reserve((int)size_hint);
+
+    uint8_t probe[4096];
+    while (true)
+    {
+        if (buffer.Size == buffer.Capacity)
+        {
+            // Probe before growing, the size hint is usually exact.
+            size_t n = source.Read(source.UserData, probe, sizeof(probe));
+            if (n == 0)
+                break;
+            const int offset = buffer.Size;
+            buffer.reserve(ImMax(buffer.Capacity * 2, 65536));
+            buffer.resize(offset + (int)n);
+            memcpy(buffer.Data + offset, probe, n);
+            continue;
+        }
+        const int offset = buffer.Size;
+        buffer.resize(buffer.Capacity);
+        size_t n = source.Read(source.UserData, buffer.Data + offset, (size_t)(buffer.Size - offset));
+        buffer.resize(offset + (int)n);
+        if (n == 0)
+            break;
+    }
+}
+
+void CloseImageSource(const ImageSource& source)
+{
+    if (source.Close)
+        source.Close(source.UserData);
 }
 
 #endif // !IMMEDIA_NO_IMAGE_DECODER
 
-Image::Image(int width, int height, PixelFormat format, const uint8_t* pixels) noexcept
+void InstallImageRenderer(const ImageRenderer& renderer)
 {
-    Width = width;
-    Height = height;
-    const ImageRenderer* renderer = GetImageRenderer();
-    RendererContext = renderer->CreateContext(width, height, format, false);
-    renderer->WriteFrame(RendererContext, pixels);
+    assert(g_context);
+    assert(!g_context->PImageRenderer.load());
+    assert(renderer.CreateContext);
+    assert(renderer.DeleteContext);
+    assert(renderer.GetTexture);
+    assert(renderer.WriteFrame);
+
+    // Published after the table is filled, so threads which see the pointer see the whole table.
+    g_context->ImageRenderer = renderer;
+    g_context->PImageRenderer.store(&g_context->ImageRenderer, std::memory_order_release);
+    uint8_t pixels[] = { 0x00, 0x00, 0x00, 0x00 };
+    g_context->EmptyImage = new Image(1, 1, PixelFormat::RGBA8888, pixels);
 }
 
-Image::~Image()
-{
-#ifndef IMMEDIA_NO_IMAGE_DECODER
-    if (DecoderContext)
-        Decoder->DeleteContext(DecoderContext);
-#endif
-    if (RendererContext)
-        GetImageRenderer()->DeleteContext(RendererContext);
+const ImageRenderer* GetImageRenderer()
+{ 
+    assert(g_context);
+    return g_context->PImageRenderer.load(std::memory_order_acquire);
 }
 
-int Image::GetWidth() const
+bool IsPixelFormatSupported(PixelFormat format)
 {
-    return Width;
+    if (format == PixelFormat::RGB888 || format == PixelFormat::RGBA8888)
+        return true;
+    const ImageRenderer* renderer = GetImageRenderer();
+    return renderer && renderer->SupportsFormat && renderer->SupportsFormat(format);
 }
 
-int Image::GetHeight() const
+size_t GetFrameSize(int width, int height, PixelFormat format)
 {
-    return Height;
+    const size_t size = (size_t)width * height * PIXEL_FORMAT_SIZE(format);
+    if (format == PixelFormat::YUV420P)
+        return size + (size_t)((width + 1) / 2) * ((height + 1) / 2) * 2;
+    if (format == PixelFormat::Indexed8)
+        return size + 256 * 4;
+    return size;
 }
 
-ImVec2 Image::GetSize() const
+// Only IFD0 is read, orientation is one of its tags.
+ImageOrientation ReadExifOrientation(const uint8_t* data, size_t data_size)
 {
-    return ImVec2((float)Width, (float)Height);
+    if (data_size >= 6 && memcmp(data, "Exif\0\0", 6) == 0)
+    {
+        data      += 6;
+        data_size -= 6;
+    }
+    if (data_size < 8)
+        return ImageOrientation::Normal;
+
+    const bool little_endian = data[0] == 'I' && data[1] == 'I';
+    if (!little_endian && !(data[0] == 'M' && data[1] == 'M'))
+        return ImageOrientation::Normal;
+    auto read16 = [&](size_t offset) -> uint32_t {
+        return little_endian ? data[offset] | (data[offset + 1] << 8) : (data[offset] << 8) | data[offset + 1];
+    };
+    auto read32 = [&](size_t offset) -> uint32_t {
+        return little_endian ? read16(offset) | (read16(offset + 2) << 16) : (read16(offset) << 16) | read16(offset + 2);
+    };
+    if (read16(2) != 42)
+        return ImageOrientation::Normal;
+
+    const size_t ifd = read32(4);
+    if (ifd > data_size - 2)
+        return ImageOrientation::Normal;
+    const uint32_t entry_count = read16(ifd);
+    for (uint32_t i = 0; i < entry_count; ++i)
+    {
+        const size_t entry = ifd + 2 + (size_t)i * 12;
+        if (entry + 12 > data_size)
+            break;
+        // SHORT of count 1, the value is stored in place.
+        if (read16(entry) == 0x0112 && read16(entry + 2) == 3 && read32(entry + 4) == 1)
+        {
+            const uint32_t value = read16(entry + 8);
+            return value >= 1 && value <= 8 ? (ImageOrientation)value : ImageOrientation::Normal;
+        }
+    }
+    return ImageOrientation::Normal;
 }
 
-bool Image::HasAnimation() const
+void EnableUploadQueue(size_t max_bytes_per_frame, float max_ms_per_frame)
 {
-#ifdef IMMEDIA_NO_IMAGE_DECODER
-    return false;
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->UploadQueueEnabled = true;
+    g_context->UploadBudgetBytes  = max_bytes_per_frame;
+    g_context->UploadBudgetMs     = max_ms_per_frame;
 #else
-    return HasAnim;
+    IM_UNUSED(max_bytes_per_frame);
+    IM_UNUSED(max_ms_per_frame);
 #endif
 }
 
-ImTextureID Image::GetTexture() const
+void DisableUploadQueue()
 {
-    if (!RendererContext)
-        return g_context->EmptyImage->GetTexture();
-    Play();
-    return GetImageRenderer()->GetTexture(RendererContext);
-}
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->UploadQueueEnabled = false;
 
-void Image::Play() const
+    ImVector<Image*>& queue = g_context->UploadQueue;
+    if (queue.empty())
+        return;
+
+    const ImageRenderer* renderer = GetImageRenderer();
+    const size_t curremt_time = static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000);
+    if (renderer->BeginUpload)
+        renderer->BeginUpload();
+    while (!queue.empty())
+    {
+        Image* image = queue.back();
+        queue.pop_back();
+        image->UploadQueued = false;
+        image->UploadFrame(curremt_time);
+    }
+    if (renderer->EndUpload)
+        renderer->EndUpload();
+#endif
+}
+
+void EnableFrameCache(size_t max_bytes_per_image, size_t max_total_bytes)
+{
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->FrameCacheEnabled       = true;
+    g_context->FrameCacheMaxImageBytes = max_bytes_per_image;
+    g_context->FrameCacheMaxTotalBytes = max_total_bytes;
+#else
+    IM_UNUSED(max_bytes_per_image);
+    IM_UNUSED(max_total_bytes);
+#endif
+}
+
+void DisableFrameCache()
+{
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->FrameCacheEnabled = false;
+#endif
+}
+
+void EnableFormatCompaction()
+{
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->FormatCompactionEnabled = true;
+#endif
+}
+
+void DisableFormatCompaction()
+{
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->FormatCompactionEnabled = false;
+#endif
+}
+
+void ClearFormatCache()
+{
+    assert(g_context);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    g_context->FormatCache.Clear();
+#endif
+}
+
+void EnableTexturePool(size_t max_bytes, int max_age_frames)
+{
+    assert(g_context);
+    g_context->TexturePoolEnabled  = true;
+    g_context->TexturePoolMaxBytes = max_bytes;
+    g_context->TexturePoolMaxAge   = max_age_frames;
+    TrimTexturePool(max_bytes, INT_MIN);
+}
+
+void DisableTexturePool()
+{
+    assert(g_context);
+    g_context->TexturePoolEnabled = false;
+    TrimTexturePool(0, INT_MIN);
+}
+
+static ImGuiID HashTextureKey(int width, int height, PixelFormat format, bool has_anim)
+{
+    const int key[4] = { width, height, (int)format, has_anim ? 1 : 0 };
+    return ImHashData(key, sizeof(key));
+}
+
+// Delete the oldest pooled textures until the pool fits in max_bytes, and the ones released before min_frame.
+void TrimTexturePool(size_t max_bytes, int min_frame)
+{
+    ImVector<PooledTexture>& pool = g_context->TexturePool;
+    int count = 0;
+    while (count < pool.Size && (g_context->TexturePoolBytes > max_bytes || pool[count].Frame < min_frame))
+    {
+        GetImageRenderer()->DeleteContext(pool[count].Context);
+        g_context->TexturePoolBytes -= pool[count].Bytes;
+        ++count;
+    }
+    if (count > 0)
+        pool.erase(pool.begin(), pool.begin() + count);
+}
+
+// The most recently released texture of the same key is reused, its content is overwritten by the first frame.
+void* CreateRendererContext(int width, int height, PixelFormat format, bool has_anim)
+{
+    ImVector<PooledTexture>& pool = g_context->TexturePool;
+    if (!pool.empty())
+    {
+        const ImGuiID key = HashTextureKey(width, height, format, has_anim);
+        for (int i = pool.Size - 1; i >= 0; --i)
+            if (pool[i].Key == key)
+            {
+                void* context = pool[i].Context;
+                g_context->TexturePoolBytes -= pool[i].Bytes;
+                pool.erase(pool.begin() + i);
+                return context;
+            }
+    }
+    return GetImageRenderer()->CreateContext(width, height, format, has_anim);
+}
+
+void DeleteRendererContext(void* context, int width, int height, PixelFormat format, bool has_anim)
+{
+    const size_t bytes = (size_t)width * height * 4;
+    if (!g_context->TexturePoolEnabled || bytes > g_context->TexturePoolMaxBytes)
+    {
+        GetImageRenderer()->DeleteContext(context);
+        return;
+    }
+    const int frame = ImGui::GetCurrentContext() ? ImGui::GetFrameCount() : 0;
+    g_context->TexturePool.push_back({ context, HashTextureKey(width, height, format, has_anim), bytes, frame });
+    g_context->TexturePoolBytes += bytes;
+    TrimTexturePool(g_context->TexturePoolMaxBytes, INT_MIN);
+}
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+struct PendingUpload
+{
+    Image*      Target;
+    bool        Visible;
+    size_t      Deadline;
+    PixelFormat Format;
+    size_t      Bytes;
+};
+
+static int ComparePendingUpload(const void* lhs, const void* rhs)
+{
+    const PendingUpload* a = reinterpret_cast<const PendingUpload*>(lhs);
+    const PendingUpload* b = reinterpret_cast<const PendingUpload*>(rhs);
+    if (a->Visible != b->Visible)
+        return a->Visible ? -1 : 1;
+    if (a->Deadline != b->Deadline)
+        return a->Deadline < b->Deadline ? -1 : 1;
+    return 0;
+}
+
+// Uploads of the same format are grouped so renderer can keep its unpack state.
+static int ComparePendingUploadFormat(const void* lhs, const void* rhs)
+{
+    const PendingUpload* a = reinterpret_cast<const PendingUpload*>(lhs);
+    const PendingUpload* b = reinterpret_cast<const PendingUpload*>(rhs);
+    if (a->Format != b->Format)
+        return (int)a->Format < (int)b->Format ? -1 : 1;
+    return ComparePendingUpload(lhs, rhs);
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+void EndFrame()
+{
+    assert(g_context);
+#ifdef IMMEDIA_ENABLE_TRACE
+    if (IsTracing())
+        FlushTrace();
+#endif
+    if (g_context->TexturePoolMaxAge > 0 && !g_context->TexturePool.empty())
+        TrimTexturePool(g_context->TexturePoolMaxBytes, ImGui::GetFrameCount() - g_context->TexturePoolMaxAge);
+
+    g_context->AnimationDeadline = g_context->FrameDeadline;
+    g_context->FrameDeadline     = SIZE_MAX;
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    ImageHandleStorage& handles = g_context->Handles;
+    handles.Tick();
+
+    ImVector<Image*>& queue = g_context->UploadQueue;
+    if (queue.empty())
+    {
+        handles.RefreshPending();
+        return;
+    }
+
+    const int frame = ImGui::GetFrameCount();
+    ImVector<PendingUpload> pending;
+    pending.resize(queue.Size);
+    for (int i = 0; i < queue.Size; ++i)
+    {
+        Image* image = queue[i];
+        pending[i] = {
+            image,
+            image->LastVisibleFrame == frame,
+            image->NextFrameTime,
+            image->Format,
+            GetFrameSize(image->Width, image->Height, image->Format)
+        };
+    }
+    qsort(pending.Data, (size_t)pending.Size, sizeof(PendingUpload), ComparePendingUpload);
+
+    // Select the highest priority uploads fitting in the byte budget, at least one.
+    int    batch_size  = 0;
+    size_t batch_bytes = 0;
+    while (batch_size < pending.Size)
+    {
+        size_t bytes = pending[batch_size].Bytes;
+        if (batch_size > 0 && g_context->UploadBudgetBytes > 0 && batch_bytes + bytes > g_context->UploadBudgetBytes)
+            break;
+        batch_bytes += bytes;
+        ++batch_size;
+    }
+    qsort(pending.Data, (size_t)batch_size, sizeof(PendingUpload), ComparePendingUploadFormat);
+
+    const ImageRenderer* renderer = GetImageRenderer();
+    const size_t curremt_time = static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000);
+    const auto   start_time   = std::chrono::steady_clock::now();
+
+    if (renderer->BeginUpload)
+        renderer->BeginUpload();
+
+    int uploaded = 0;
+    while (uploaded < batch_size)
+    {
+        if (uploaded > 0 && g_context->UploadBudgetMs > 0.0f)
+        {
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+            if (elapsed.count() >= g_context->UploadBudgetMs)
+                break;
+        }
+        Image* image = pending[uploaded++].Target;
+        image->UploadQueued = false;
+        image->UploadFrame(curremt_time);
+        if (image->HasAnim)
+            RecordAnimationDeadline(image->NextFrameTime);
+    }
+
+    if (renderer->EndUpload)
+        renderer->EndUpload();
+
+    queue.resize(0);
+    for (int i = uploaded; i < pending.Size; ++i)
+        queue.push_back(pending[i].Target);
+
+    handles.RefreshPending();
+#endif
+}
+
+double GetNextAnimationDeadline()
+{
+    assert(g_context);
+    if (g_context->WakeUpRequested.exchange(false, std::memory_order_acquire))
+        return ImGui::GetTime();
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    if (!g_context->UploadQueue.empty())
+        return ImGui::GetTime();
+#endif
+    const size_t deadline = ImMin(g_context->AnimationDeadline, g_context->FrameDeadline);
+    if (deadline == SIZE_MAX)
+        return -1.0;
+    return (double)deadline / 1000.0;
+}
+
+void SetWakeUpCallback(void (*callback)(void* user_data), void* user_data)
+{
+    assert(g_context);
+    g_context->WakeUpCallback = callback;
+    g_context->WakeUpUserData = user_data;
+}
+
+void RequestWakeUp()
+{
+    assert(g_context);
+    g_context->WakeUpRequested.store(true, std::memory_order_release);
+    if (g_context->WakeUpCallback)
+        g_context->WakeUpCallback(g_context->WakeUpUserData);
+}
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+
+
+Image::Image(const char* filename, const char* format) noexcept
+{
+    Load(filename, GetFileDecoder(filename, format));
+}
+
+Image::Image(const char* filename, const ImageDecoder* decoder) noexcept
+{
+    Load(filename, decoder);
+}
+
+Image::Image(const uint8_t* data, size_t data_size, const char* format) noexcept
+{
+    Load(data, data_size, GetImageDecoder(format ? format : DetectImageFormat(data, data_size)));
+}
+
+Image::Image(const uint8_t* data, size_t data_size, const ImageDecoder* decoder) noexcept
+{
+    Load(data, data_size, decoder);
+}
+
+Image::Image(void* decoder_context, const ImageDecoder* decoder) noexcept
+{
+    Load(decoder_context, decoder);
+}
+
+Image::Image(const ImageSource& source, const char* format) noexcept
+{
+    const ImageDecoder* decoder = GetImageDecoder(format);
+    Load(CreateDecoderContext(source, decoder), decoder);
+}
+
+Image::Image(const ImageSource& source, const ImageDecoder* decoder) noexcept
+{
+    Load(CreateDecoderContext(source, decoder), decoder);
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+Image::Image(int width, int height, PixelFormat format, const uint8_t* pixels) noexcept
+{
+    Width = width;
+    Height = height;
+    Format = format;
+    assert(IsPixelFormatSupported(format));
+    RendererContext = CreateRendererContext(width, height, format, false);
+    IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", GetImageRenderer()->WriteFrame(RendererContext, pixels));
+    FrameReady = true;
+}
+
+Image::~Image()
+{
+    Release();
+}
+
+Image::Image(Image&& other) noexcept
+{
+    operator=(static_cast<Image&&>(other));
+}
+
+Image& Image::operator=(Image&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    Release();
+
+    Width            = other.Width;
+    Height           = other.Height;
+    Format           = other.Format;
+    Orientation      = other.Orientation;
+    RendererContext  = other.RendererContext;
+    FrameReady       = other.FrameReady;
+    LastVisibleFrame = other.LastVisibleFrame;
+    other.RendererContext = nullptr;
+    other.FrameReady      = false;
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    DecoderContext = other.DecoderContext;
+    Decoder        = other.Decoder;
+    HasAnim        = other.HasAnim;
+    UploadQueued   = other.UploadQueued;
+    NextFrameTime  = other.NextFrameTime;
+    FrameCache     = other.FrameCache;
+    FormatKey      = other.FormatKey;
+    other.DecoderContext = nullptr;
+    other.Decoder        = nullptr;
+    other.UploadQueued   = false;
+    other.FrameCache     = nullptr;
+
+    if (UploadQueued)
+    {
+        ImVector<Image*>& queue = g_context->UploadQueue;
+        for (int i = 0; i < queue.Size; ++i)
+            if (queue[i] == &other)
+                queue[i] = this;
+    }
+#endif
+
+    return *this;
+}
+
+void Image::Release()
+{
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    if (UploadQueued)
+    {
+        ImVector<Image*>& queue = g_context->UploadQueue;
+        for (int i = 0; i < queue.Size; ++i)
+            if (queue[i] == this)
+            {
+                queue.erase(queue.begin() + i);
+                break;
+            }
+        UploadQueued = false;
+    }
+    if (DecoderContext)
+        Decoder->DeleteContext(DecoderContext);
+    DecoderContext = nullptr;
+    Decoder        = nullptr;
+    if (FrameCache)
+    {
+        for (int i = 0; i < FrameCache->Contexts.Size; ++i)
+            DeleteRendererContext(FrameCache->Contexts[i], Width, Height, Format, false);
+        g_context->FrameCacheBytes -= FrameCache->Bytes;
+        delete FrameCache;
+        FrameCache      = nullptr;
+        RendererContext = nullptr;
+    }
+#endif
+    if (RendererContext)
+        DeleteRendererContext(RendererContext, Width, Height, Format, HasAnimation());
+    RendererContext = nullptr;
+    FrameReady      = false;
+}
+
+int Image::GetWidth() const
+{
+    return IMAGE_ORIENTATION_IS_TRANSPOSED(Orientation) ? Height : Width;
+}
+
+int Image::GetHeight() const
+{
+    return IMAGE_ORIENTATION_IS_TRANSPOSED(Orientation) ? Width : Height;
+}
+
+ImVec2 Image::GetSize() const
+{
+    return ImVec2((float)GetWidth(), (float)GetHeight());
+}
+
+ImageOrientation Image::GetOrientation() const
+{
+    return Orientation;
+}
+
+PixelFormat Image::GetFormat() const
+{
+    return Format;
+}
+
+bool Image::HasAnimation() const
+{
+#ifdef IMMEDIA_NO_IMAGE_DECODER
+    return false;
+#else
+    return HasAnim;
+#endif
+}
+
+ImTextureID Image::GetTexture() const
+{
+    if (!RendererContext)
+        return g_context->EmptyImage->GetTexture();
+    Play();
+    if (!FrameReady)
+        return g_context->EmptyImage->GetTexture();
+    return GetImageRenderer()->GetTexture(RendererContext);
+}
+
+void Image::Play() const
+{
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+    if (FrameCache && FrameCache->Complete)
+    {
+        const_cast<Image*>(this)->PlayCachedFrame(static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000));
+        RecordAnimationDeadline(NextFrameTime);
+        return;
+    }
+
+    if (!Decoder || !DecoderContext)
+        return;
+
+    const size_t curremt_time = static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000);
+    if (curremt_time < NextFrameTime)
+    {
+        RecordAnimationDeadline(NextFrameTime);
+        return;
+    }
+
+    Image* p = const_cast<Image*>(this);
+    if (g_context->UploadQueueEnabled)
+    {
+        if (!UploadQueued)
+        {
+            p->UploadQueued = true;
+            g_context->UploadQueue.push_back(p);
+        }
+        return;
+    }
+
+    p->UploadFrame(curremt_time);
+    RecordAnimationDeadline(NextFrameTime);
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+}
+
+bool Image::UpdatePixels(const uint8_t* pixels, int stride, int x, int y, int width, int height)
+{
+    if (!RendererContext || HasAnimation())
+        return false;
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 || x + width > Width || y + height > Height)
+        return false;
+
+    const ImageRenderer* renderer = GetImageRenderer();
+    if (PIXEL_FORMAT_IS_PLANAR(Format) || PIXEL_FORMAT_HAS_PALETTE(Format))
+    {
+        if (x != 0 || y != 0 || width != Width || height != Height || stride != 0)
+            return false;
+        IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", renderer->WriteFrame(RendererContext, pixels));
+        FrameReady = true;
+        return true;
+    }
+
+    const int row_size = width * PIXEL_FORMAT_SIZE(Format);
+    if (stride == 0)
+        stride = row_size;
+
+    if (renderer->WriteRegion)
+        IMMEDIA_TRACE_CALL("ImageRenderer::WriteRegion", renderer->WriteRegion(RendererContext, pixels, stride, x, y, width, height));
+    else if (x == 0 && y == 0 && width == Width && height == Height)
+    {
+        if (stride != row_size)
+        {
+            ImVector<uint8_t>& scratch = g_context->ScratchPixels;
+            scratch.resize(row_size * height);
+            CopyRows(pixels, stride, scratch.Data, row_size, row_size, height);
+            pixels = scratch.Data;
+        }
+        IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", renderer->WriteFrame(RendererContext, pixels));
+    }
+    else
+        return false;
+
+    FrameReady = true;
+    return true;
+}
+
+bool Image::UpdatePixels(const uint8_t* pixels, int stride)
+{
+    return UpdatePixels(pixels, stride, 0, 0, Width, Height);
+}
+
+// Texture coordinate of a point of the oriented image.
+static ImVec2 OrientUV(ImageOrientation orientation, float u, float v)
+{
+    switch (orientation)
+    {
+    case ImageOrientation::FlipHorizontal: return ImVec2(1 - u, v);
+    case ImageOrientation::Rotate180:      return ImVec2(1 - u, 1 - v);
+    case ImageOrientation::FlipVertical:   return ImVec2(u, 1 - v);
+    case ImageOrientation::Transpose:      return ImVec2(v, u);
+    case ImageOrientation::Rotate90:       return ImVec2(v, 1 - u);
+    case ImageOrientation::Transverse:     return ImVec2(1 - v, 1 - u);
+    case ImageOrientation::Rotate270:      return ImVec2(1 - v, u);
+    default:                               return ImVec2(u, v);
+    }
+}
+
+static void AddOrientedImage(ImDrawList* draw_list, ImTextureID texture, ImageOrientation orientation,
+                             const ImVec2& p_min, const ImVec2& p_max, const ImVec2& uv0, const ImVec2& uv1, ImU32 col)
+{
+    if (orientation == ImageOrientation::Normal)
+    {
+        draw_list->AddImage(texture, p_min, p_max, uv0, uv1, col);
+        return;
+    }
+    draw_list->AddImageQuad(texture, p_min, ImVec2(p_max.x, p_min.y), p_max, ImVec2(p_min.x, p_max.y),
+                            OrientUV(orientation, uv0.x, uv0.y), OrientUV(orientation, uv1.x, uv0.y),
+                            OrientUV(orientation, uv1.x, uv1.y), OrientUV(orientation, uv0.x, uv1.y), col);
+}
+
+// Same as ImGui::Image, the quad is drawn with oriented texture coordinates.
+static void OrientedImage(ImTextureID texture, ImageOrientation orientation, const ImVec2& size,
+                          const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col)
+{
+    if (orientation == ImageOrientation::Normal)
+    {
+        ImGui::Image(texture, size, uv0, uv1, tint_col, border_col);
+        return;
+    }
+
+    ImGuiWindow* window = ImGui::GetCurrentWindow();
+    if (window->SkipItems)
+        return;
+
+    const float border_size = (border_col.w > 0.0f) ? 1.0f : 0.0f;
+    const ImVec2 padding(border_size, border_size);
+    const ImRect bb(window->DC.CursorPos, window->DC.CursorPos + size + padding * 2.0f);
+    ImGui::ItemSize(bb);
+    if (!ImGui::ItemAdd(bb, 0))
+        return;
+
+    if (border_size > 0.0f)
+        window->DrawList->AddRect(bb.Min, bb.Max, ImGui::GetColorU32(border_col), 0.0f, ImDrawFlags_None, border_size);
+    AddOrientedImage(window->DrawList, texture, orientation, bb.Min + padding, bb.Max - padding, uv0, uv1, ImGui::GetColorU32(tint_col));
+}
+
+// Fill modes work on the oriented image of width x height, texture coordinates are transformed when drawing.
+static void ShowTexture(ImTextureID texture, int width, int height, ImageOrientation orientation, const ImVec2& size, ImageFillMode fill_mode,
+                        const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col)
+{
+    if (fill_mode == ImageFillMode::Stretch)
+        OrientedImage(texture, orientation, size, uv0, uv1, tint_col, border_col);
+    else if (fill_mode == ImMedia::ImageFillMode::Fill)
+    {
+        // We use int to avoid floating-point rounding errors.
+        int p0_x = (int)(uv0.x * width);
+        int p0_y = (int)(uv0.y * height);
+        int p1_x = (int)(uv1.x * width);
+        int p1_y = (int)(uv1.y * height);
+
+        int w = p1_x - p0_x;
+        int h = p1_y - p0_y;
+
+        // I couldn't have found a better name.
+        double r = fmax(size.x / w, size.y / h);
+        int s_w = (int)(size.x / r);
+        int s_h = (int)(size.y / r);
+
+        int p3_x = 0;
+        int p3_y = 0;
+        int p4_x = w;
+        int p4_y = h;
+
+        int x = (w - s_w) / 2;
+        int y = (h - s_h) / 2;
+
+        p3_x += x;
+        p3_y += y;
+        p4_x -= x;
+        p4_y -= y;
+
+        p3_x += p0_x;
+        p3_y += p0_y;
+        p4_x += p0_x;
+        p4_y += p0_y;
+
+        ImVec2 p0 = ImVec2((float)p3_x, (float)p3_y) / ImVec2((float)width, (float)height);
+        ImVec2 p1 = ImVec2((float)p4_x, (float)p4_y) / ImVec2((float)width, (float)height);
+
+        OrientedImage(texture, orientation, size, p0, p1, tint_col, border_col);
+    }
+    else if (fill_mode == ImageFillMode::Center)
+    {
+        ImGuiWindow* window = ImGui::GetCurrentWindow();
+        if (window->SkipItems)
+            return;
+
+        const float border_size = (border_col.w > 0.0f) ? 1.0f : 0.0f;
+        const ImVec2 padding(border_size, border_size);
+        const ImRect bb(window->DC.CursorPos, window->DC.CursorPos + size + padding * 2.0f);
+        ImGui::ItemSize(bb);
+        if (!ImGui::ItemAdd(bb, 0))
+            return;
+
+        int w = (int)(width  * (uv1.x - uv0.x));
+        int h = (int)(height * (uv1.y - uv0.y));
+        double r = fmin(size.x / w, size.y / h);
+        w = (int)(r * w);
+        h = (int)(r * h);
+        ImVec2 offset((size.x - w) / 2, (size.y - h) / 2);
+
+        if (border_size > 0.0f)
+            window->DrawList->AddRect(bb.Min + offset, bb.Max - offset, ImGui::GetColorU32(border_col), 0.0f, ImDrawFlags_None, border_size);
+        AddOrientedImage(window->DrawList, texture, orientation, bb.Min + padding + offset, bb.Max - padding - offset, uv0, uv1, ImGui::GetColorU32(tint_col));
+    }
+}
+
+void Image::Show(const ImVec2& size, ImageFillMode fill_mode, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col) const
+{
+    if (!RendererContext)
+    {
+        ImGui::Dummy(size);
+        return;
+    }
+
+    if (ImGui::IsRectVisible(size))
+        const_cast<Image*>(this)->LastVisibleFrame = ImGui::GetFrameCount();
+
+    Play();
+
+    ShowTexture(GetTexture(), GetWidth(), GetHeight(), Orientation, size, fill_mode, uv0, uv1, tint_col, border_col);
+}
+
+
+
+// Triple buffer, producer and consumer own one buffer each and swap with the middle one.
+// Bits 0-1 of Middle is the index of the middle buffer, bit 2 is set if it contains a new frame.
+struct StreamImageState
+{
+    uint8_t*         Buffers[3];
+    size_t           FrameSize;
+    int              WriteIndex;
+    int              ReadIndex;
+    std::atomic<int> Middle;
+};
+
+#define STREAM_IMAGE_FRESH 0x4
+
+StreamImage::StreamImage(int width, int height, PixelFormat format) noexcept
+{
+    Target.Width           = width;
+    Target.Height          = height;
+    Target.Format          = format;
+    assert(IsPixelFormatSupported(format));
+    Target.RendererContext = GetImageRenderer()->CreateContext(width, height, format, true);
+
+    State = new StreamImageState();
+    State->FrameSize = GetFrameSize(width, height, format);
+    for (int i = 0; i < 3; ++i)
+        State->Buffers[i] = new uint8_t[State->FrameSize];
+    State->WriteIndex = 0;
+    State->ReadIndex  = 1;
+    State->Middle.store(2);
+}
+
+StreamImage::~StreamImage()
+{
+    // Streaming textures are not pooled.
+    GetImageRenderer()->DeleteContext(Target.RendererContext);
+    Target.RendererContext = nullptr;
+
+    for (int i = 0; i < 3; ++i)
+        delete[] State->Buffers[i];
+    delete State;
+}
+
+int StreamImage::GetWidth() const
+{
+    return Target.GetWidth();
+}
+
+int StreamImage::GetHeight() const
+{
+    return Target.GetHeight();
+}
+
+ImVec2 StreamImage::GetSize() const
+{
+    return Target.GetSize();
+}
+
+uint8_t* StreamImage::BeginWrite()
+{
+    return State->Buffers[State->WriteIndex];
+}
+
+void StreamImage::EndWrite()
+{
+    int middle = State->Middle.exchange(State->WriteIndex | STREAM_IMAGE_FRESH, std::memory_order_acq_rel);
+    State->WriteIndex = middle & 0x3;
+    RequestWakeUp();
+}
+
+void StreamImage::Submit(const uint8_t* pixels, int stride)
+{
+    // Planes and palette are copied whole, they have no common stride.
+    if (PIXEL_FORMAT_IS_PLANAR(Target.Format) || PIXEL_FORMAT_HAS_PALETTE(Target.Format))
+    {
+        if (stride != 0)
+            return;
+        memcpy(BeginWrite(), pixels, State->FrameSize);
+        EndWrite();
+        return;
+    }
+
+    const size_t row_size = (size_t)Target.Width * PIXEL_FORMAT_SIZE(Target.Format);
+    uint8_t* buffer = BeginWrite();
+    CopyRows(pixels, stride == 0 ? (int)row_size : stride, buffer, (int)row_size, row_size, Target.Height);
+    EndWrite();
+}
+
+ImTextureID StreamImage::GetTexture() const
+{
+    Play();
+    return Target.GetTexture();
+}
+
+void StreamImage::Play() const
+{
+    if ((State->Middle.load(std::memory_order_relaxed) & STREAM_IMAGE_FRESH) == 0)
+        return;
+    int middle = State->Middle.exchange(State->ReadIndex, std::memory_order_acq_rel);
+    State->ReadIndex = middle & 0x3;
+    const_cast<Image&>(Target).UpdatePixels(State->Buffers[State->ReadIndex]);
+}
+
+void StreamImage::Show(const ImVec2& size, ImageFillMode fill_mode, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col) const
+{
+    Play();
+    Target.Show(size, fill_mode, uv0, uv1, tint_col, border_col);
+}
+
+struct ScalarImageState
+{
+    ScalarType        Type;
+    int               Width;
+    ImVector<uint8_t> Values;
+    ImVector<uint8_t> Pixels;  // RGBA8888.
+    uint8_t           Palette[256 * 4];
+    float             Low;
+    float             High;
+    bool              HasValues;
+    bool              Dirty;
+};
+
+// Indices are mapped in chunks on stack, so they stay in cache between the two passes.
+#define SCALAR_IMAGE_CHUNK_SIZE 4096
+
+static void MapScalarRows(int begin, int end, void* user_data)
+{
+    ScalarImageState* state = reinterpret_cast<ScalarImageState*>(user_data);
+    uint8_t indices[SCALAR_IMAGE_CHUNK_SIZE];
+    const size_t last = (size_t)end * state->Width;
+    for (size_t i = (size_t)begin * state->Width; i < last; i += SCALAR_IMAGE_CHUNK_SIZE)
+    {
+        const size_t count = ImMin(last - i, (size_t)SCALAR_IMAGE_CHUNK_SIZE);
+        if (state->Type == ScalarType::Float32)
+            QuantizeScalars(reinterpret_cast<const float*>(state->Values.Data) + i, indices, count, state->Low, state->High);
+        else
+            QuantizeScalars(reinterpret_cast<const uint16_t*>(state->Values.Data) + i, indices, count, state->Low, state->High);
+        ExpandPalette(indices, state->Palette, state->Pixels.Data + i * 4, PixelFormat::RGBA8888, count);
+    }
+}
+
+// Polynomial fits of the colormaps, t in [0, 1].
+static void EvaluateColormap(ScalarColormap colormap, float t, float* rgb)
+{
+    if (colormap == ScalarColormap::Viridis)
+    {
+        static const float c[7][3] = {
+            {  0.2777273272234177f,  0.005407344544966578f,  0.3340998053353061f  },
+            {  0.1050930431085774f,  1.404613529898575f,     1.384590162594685f   },
+            { -0.3308618287255563f,  0.214847559468213f,     0.09509516302823659f },
+            { -4.634230498983486f,  -5.799100973351585f,   -19.33244095627987f    },
+            {  6.228269936347081f,  14.17993336680509f,     56.69055260068105f    },
+            {  4.776384997670288f, -13.74514537774601f,    -65.35303263337234f    },
+            { -5.435455855934631f,   4.645852612178535f,    26.3124352495832f     },
+        };
+        for (int i = 0; i < 3; ++i)
+        {
+            float v = c[6][i];
+            for (int j = 5; j >= 0; --j)
+                v = v * t + c[j][i];
+            rgb[i] = v;
+        }
+    }
+    else if (colormap == ScalarColormap::Turbo)
+    {
+        static const float c[6][3] = {
+            {    0.13572138f,   0.09140261f,   0.10667330f },
+            {    4.61539260f,   2.19418839f,  12.64194608f },
+            {  -42.66032258f,   4.84296658f, -60.58204836f },
+            {  132.13108234f, -14.18503333f, 110.36276771f },
+            { -152.94239396f,   4.27729857f, -89.90310912f },
+            {   59.28637943f,   2.82956604f,  27.34824973f },
+        };
+        for (int i = 0; i < 3; ++i)
+        {
+            float v = c[5][i];
+            for (int j = 4; j >= 0; --j)
+                v = v * t + c[j][i];
+            rgb[i] = v;
+        }
+    }
+    else
+        rgb[0] = rgb[1] = rgb[2] = t;
+}
+
+ScalarImage::ScalarImage(int width, int height, ScalarType type) noexcept
+{
+    Target.Width           = width;
+    Target.Height          = height;
+    Target.Format          = PixelFormat::RGBA8888;
+    Target.RendererContext = GetImageRenderer()->CreateContext(width, height, PixelFormat::RGBA8888, true);
+
+    State = new ScalarImageState();
+    State->Type  = type;
+    State->Width = width;
+    State->Values.resize(width * height * (type == ScalarType::Float32 ? 4 : 2));
+    State->Pixels.resize(width * height * 4);
+    State->Low       = 0.0f;
+    State->High      = type == ScalarType::Float32 ? 1.0f : 65535.0f;
+    State->HasValues = false;
+    State->Dirty     = false;
+    SetColormap(ScalarColormap::Gray);
+}
+
+ScalarImage::~ScalarImage()
+{
+    // Streaming textures are not pooled.
+    GetImageRenderer()->DeleteContext(Target.RendererContext);
+    Target.RendererContext = nullptr;
+    delete State;
+}
+
+int ScalarImage::GetWidth() const
+{
+    return Target.GetWidth();
+}
+
+int ScalarImage::GetHeight() const
+{
+    return Target.GetHeight();
+}
+
+ImVec2 ScalarImage::GetSize() const
+{
+    return Target.GetSize();
+}
+
+void ScalarImage::Submit(const void* values, int stride)
+{
+    const size_t row_size = (size_t)State->Values.Size / Target.Height;
+    CopyRows(reinterpret_cast<const uint8_t*>(values), stride == 0 ? (int)row_size : stride, State->Values.Data, (int)row_size, row_size, Target.Height);
+    State->HasValues = true;
+    State->Dirty     = true;
+}
+
+void ScalarImage::SetRange(float low, float high)
+{
+    State->Low   = low;
+    State->High  = high;
+    State->Dirty = true;
+}
+
+void ScalarImage::SetWindowLevel(float window, float level)
+{
+    SetRange(level - window * 0.5f, level + window * 0.5f);
+}
+
+void ScalarImage::FitRange()
+{
+    if (!State->HasValues)
+        return;
+
+    float low  = FLT_MAX;
+    float high = -FLT_MAX;
+    if (State->Type == ScalarType::Float32)
+    {
+        const float* values = reinterpret_cast<const float*>(State->Values.Data);
+        const int    count  = State->Values.Size / 4;
+        for (int i = 0; i < count; ++i)
+        {
+            low  = values[i] < low  ? values[i] : low;
+            high = values[i] > high ? values[i] : high;
+        }
+    }
+    else
+    {
+        const uint16_t* values = reinterpret_cast<const uint16_t*>(State->Values.Data);
+        const int       count  = State->Values.Size / 2;
+        uint16_t min_value = 0xFFFF, max_value = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            min_value = ImMin(min_value, values[i]);
+            max_value = ImMax(max_value, values[i]);
+        }
+        low  = min_value;
+        high = max_value;
+    }
+    if (low <= high)
+        SetRange(low, high);
+}
+
+void ScalarImage::GetRange(float* low, float* high) const
+{
+    *low  = State->Low;
+    *high = State->High;
+}
+
+void ScalarImage::SetColormap(ScalarColormap colormap)
+{
+    for (int i = 0; i < 256; ++i)
+    {
+        float rgb[3];
+        EvaluateColormap(colormap, (float)i / 255.0f, rgb);
+        for (int c = 0; c < 3; ++c)
+            State->Palette[i * 4 + c] = (uint8_t)(ImClamp(rgb[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+        State->Palette[i * 4 + 3] = 0xFF;
+    }
+    State->Dirty = true;
+}
+
+void ScalarImage::SetColormap(const uint8_t* palette)
+{
+    memcpy(State->Palette, palette, sizeof(State->Palette));
+    State->Dirty = true;
+}
+
+ImTextureID ScalarImage::GetTexture() const
+{
+    Play();
+    return Target.GetTexture();
+}
+
+void ScalarImage::Play() const
+{
+    if (!State->Dirty || !State->HasValues)
+        return;
+    State->Dirty = false;
+
+    // Small images are not worth waking up worker threads.
+    const int width  = Target.Width;
+    const int height = Target.Height;
+    if ((size_t)width * height >= 512 * 512)
+        GetWorkerPool()->ParallelFor(height, MapScalarRows, State);
+    else
+        MapScalarRows(0, height, State);
+    const_cast<Image&>(Target).UpdatePixels(State->Pixels.Data);
+}
+
+void ScalarImage::Show(const ImVec2& size, ImageFillMode fill_mode, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col) const
+{
+    Play();
+    Target.Show(size, fill_mode, uv0, uv1, tint_col, border_col);
+}
+
+ImageHandle ImageHandleStorage::Add(Image* image)
+{
+    uint32_t index;
+    if (!FreeIndices.empty())
+    {
+        index = FreeIndices.back();
+        FreeIndices.pop_back();
+    }
+    else
+    {
+        index = (uint32_t)Images.Size;
+        Generations.push_back(1);
+        States.push_back(ImageHandleState::Free);
+        LastUsedFrames.push_back(0);
+        NextFrameTimes.push_back(SIZE_MAX);
+        Textures.push_back(ImTextureID());
+        Sizes.push_back(ImVec2(0, 0));
+        Images.push_back(nullptr);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+        Filenames.push_back(nullptr);
+        Decoders.push_back(nullptr);
+#endif
+    }
+
+    States[index]         = ImageHandleState::Loaded;
+    LastUsedFrames[index] = ImGui::GetFrameCount();
+    Sizes[index]          = image->GetSize();
+    Images[index]         = image;
+    Refresh(index);
+
+    ImageHandle handle;
+    handle.Index      = index;
+    handle.Generation = Generations[index];
+    return handle;
+}
+
+void ImageHandleStorage::Remove(uint32_t index)
 {
+    delete Images[index];
+    Images[index] = nullptr;
 #ifndef IMMEDIA_NO_IMAGE_DECODER
+    delete[] Filenames[index];
+    Filenames[index] = nullptr;
+    Decoders[index]  = nullptr;
+#endif
+    States[index]         = ImageHandleState::Free;
+    NextFrameTimes[index] = SIZE_MAX;
+    Textures[index]       = ImTextureID();
+    Sizes[index]          = ImVec2(0, 0);
+    if (++Generations[index] == 0)
+        Generations[index] = 1;
+    FreeIndices.push_back(index);
+}
 
-    if (!Decoder || !DecoderContext)
-        return;
-
-    const size_t curremt_time = static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000);
-    if (curremt_time < NextFrameTime)
-        return;
-
-    Image* p = const_cast<Image*>(this);
-    uint8_t* pixels;
-    int      delay;
-    if (Decoder->ReadFrame(DecoderContext, &pixels, &delay))
+// Copy texture and deadline of the image, or keep it pending while its frame is queued for upload.
+void ImageHandleStorage::Refresh(uint32_t index)
+{
+    const Image* image = Images[index];
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    if (image->UploadQueued)
     {
-        GetImageRenderer()->WriteFrame(RendererContext, pixels);
-        bool has_next_frame = false;
-        if (Decoder->ReadNextFrame)
-            has_next_frame = Decoder->ReadNextFrame(DecoderContext);
-        p->NextFrameTime = curremt_time + delay;
-        if (!has_next_frame)
-        {
-            p->NextFrameTime = SIZE_MAX;
-            Decoder->DeleteContext(DecoderContext);
-            p->Decoder = nullptr;
-            p->DecoderContext = nullptr;
-        }
+        NextFrameTimes[index] = SIZE_MAX;
+        PendingIndices.push_back(index);
+        return;
     }
+    NextFrameTimes[index] = image->HasAnim ? image->NextFrameTime : SIZE_MAX;
+#endif
+    if (!image->RendererContext || !image->FrameReady)
+        Textures[index] = g_context->EmptyImage->GetTexture();
     else
+        Textures[index] = GetImageRenderer()->GetTexture(image->RendererContext);
+}
+
+// Mark the image used in this frame, load it again if it was evicted.
+Image* ImageHandleStorage::Use(uint32_t index)
+{
+    LastUsedFrames[index] = ImGui::GetFrameCount();
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    if (States[index] == ImageHandleState::Evicted)
     {
-        Decoder->DeleteContext(DecoderContext);
-        p->Decoder = nullptr;
-        p->DecoderContext = nullptr;
+        Images[index] = new Image(Filenames[index], Decoders[index]);
+        States[index] = ImageHandleState::Loaded;
+        Refresh(index);
     }
-
-#endif // !IMMEDIA_NO_IMAGE_DECODER
+#endif
+    return Images[index];
 }
 
-void Image::Show(const ImVec2& size, ImageFillMode fill_mode, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col) const
+void ImageHandleStorage::Show(uint32_t index, const ImVec2& size, ImageFillMode fill_mode,
+                              const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col)
 {
-    if (!RendererContext)
+    Image* image = Use(index);
+    if (!image->RendererContext)
     {
         ImGui::Dummy(size);
         return;
     }
 
-    Play();
+    if (ImGui::IsRectVisible(size))
+        image->LastVisibleFrame = ImGui::GetFrameCount();
 
-    if (fill_mode == ImageFillMode::Stretch)
-        ImGui::Image(GetTexture(), size, uv0, uv1, tint_col, border_col);
-    else if (fill_mode == ImMedia::ImageFillMode::Fill)
-    {
-        // We use int to avoid floating-point rounding errors.
-        int p0_x = (int)(uv0.x * Width);
-        int p0_y = (int)(uv0.y * Height);
-        int p1_x = (int)(uv1.x * Width);
-        int p1_y = (int)(uv1.y * Height);
+    ShowTexture(Textures[index], (int)Sizes[index].x, (int)Sizes[index].y, image->Orientation,
+                size, fill_mode, uv0, uv1, tint_col, border_col);
+}
 
-        int w = p1_x - p0_x;
-        int h = p1_y - p0_y;
+// Advance animations used in this frame and evict images unused for too long.
+void ImageHandleStorage::Tick()
+{
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    if (Images.empty())
+        return;
 
-        // I couldn't have found a better name.
-        double r = fmax(size.x / w, size.y / h);
-        int s_w = (int)(size.x / r);
-        int s_h = (int)(size.y / r);
+    const int    frame        = ImGui::GetFrameCount();
+    const size_t curremt_time = static_cast<size_t>(ImGui::GetCurrentContext()->Time * 1000);
+    for (int i = 0; i < NextFrameTimes.Size; ++i)
+    {
+        if (LastUsedFrames[i] != frame)
+            continue;
+        if (NextFrameTimes[i] <= curremt_time)
+        {
+            NextFrameTimes[i] = SIZE_MAX;
+            Images[i]->Play();
+            PendingIndices.push_back((uint32_t)i);
+        }
+        else
+            RecordAnimationDeadline(NextFrameTimes[i]);
+    }
 
-        int p3_x = 0;
-        int p3_y = 0;
-        int p4_x = w;
-        int p4_y = h;
+    if (EvictAfterFrames <= 0)
+        return;
+    const int min_frame = frame - EvictAfterFrames;
+    for (int i = 0; i < LastUsedFrames.Size; ++i)
+    {
+        if (LastUsedFrames[i] < min_frame && States[i] == ImageHandleState::Loaded && Filenames[i])
+        {
+            delete Images[i];
+            Images[i]         = nullptr;
+            States[i]         = ImageHandleState::Evicted;
+            NextFrameTimes[i] = SIZE_MAX;
+            Textures[i]       = g_context->EmptyImage->GetTexture();
+        }
+    }
+#endif
+}
 
-        int x = (w - s_w) / 2;
-        int y = (h - s_h) / 2;
+void ImageHandleStorage::RefreshPending()
+{
+    if (PendingIndices.empty())
+        return;
+    ImVector<uint32_t> pending;
+    pending.swap(PendingIndices);
+    for (int i = 0; i < pending.Size; ++i)
+        if (Images[pending[i]])
+            Refresh(pending[i]);
+}
 
-        p3_x += x;
-        p3_y += y;
-        p4_x -= x;
-        p4_y -= y;
+void ImageHandleStorage::Clear()
+{
+    for (int i = 0; i < Images.Size; ++i)
+    {
+        delete Images[i];
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+        delete[] Filenames[i];
+#endif
+    }
+    *this = ImageHandleStorage();
+}
 
-        p3_x += p0_x;
-        p3_y += p0_y;
-        p4_x += p0_x;
-        p4_y += p0_y;
+static ImageHandle AddImageHandle(Image* image)
+{
+    assert(g_context);
+    return g_context->Handles.Add(image);
+}
 
-        ImVec2 p0 = ImVec2((float)p3_x, (float)p3_y) / ImVec2((float)Width, (float)Height);
-        ImVec2 p1 = ImVec2((float)p4_x, (float)p4_y) / ImVec2((float)Width, (float)Height);
+#ifndef IMMEDIA_NO_IMAGE_DECODER
 
-        ImGui::Image(GetTexture(), size, p0, p1, tint_col, border_col);
-    }
-    else if (fill_mode == ImageFillMode::Center)
-    {
-        ImGuiWindow* window = ImGui::GetCurrentWindow();
-        if (window->SkipItems)
-            return;
+ImageHandle CreateImageHandle(const char* filename, const char* format)
+{
+    assert(g_context);
+    ImageHandleStorage& handles = g_context->Handles;
+    const ImageDecoder* decoder = GetFileDecoder(filename, format);
+    ImageHandle handle = handles.Add(new Image(filename, decoder));
+    char* copy = new char[strlen(filename) + 1];
+    strcpy(copy, filename);
+    handles.Filenames[handle.Index] = copy;
+    handles.Decoders[handle.Index]  = decoder;
+    return handle;
+}
 
-        const float border_size = (border_col.w > 0.0f) ? 1.0f : 0.0f;
-        const ImVec2 padding(border_size, border_size);
-        const ImRect bb(window->DC.CursorPos, window->DC.CursorPos + size + padding * 2.0f);
-        ImGui::ItemSize(bb);
-        if (!ImGui::ItemAdd(bb, 0))
-            return;
+ImageHandle CreateImageHandle(void* decoder_context, const ImageDecoder* decoder)
+{
+    return AddImageHandle(new Image(decoder_context, decoder));
+}
 
-        int w = (int)(Width  * (uv1.x - uv0.x));
-        int h = (int)(Height * (uv1.y - uv0.y));
-        double r = fmin(size.x / w, size.y / h);
-        w = (int)(r * w);
-        h = (int)(r * h);
-        ImVec2 offset((size.x - w) / 2, (size.y - h) / 2);
+#endif // !IMMEDIA_NO_IMAGE_DECODER
 
-        if (border_size > 0.0f)
-            window->DrawList->AddRect(bb.Min + offset, bb.Max - offset, ImGui::GetColorU32(border_col), 0.0f, ImDrawFlags_None, border_size);
-        window->DrawList->AddImage(GetTexture(), bb.Min + padding + offset, bb.Max - padding - offset, uv0, uv1, ImGui::GetColorU32(tint_col));
-    }
+ImageHandle CreateImageHandle(int width, int height, PixelFormat format, const uint8_t* pixels)
+{
+    return AddImageHandle(new Image(width, height, format, pixels));
 }
 
-#ifndef IMMEDIA_NO_IMAGE_DECODER
+void DestroyImageHandle(ImageHandle handle)
+{
+    if (IsImageHandleValid(handle))
+        g_context->Handles.Remove(handle.Index);
+}
 
-void Image::Load(const char* filename, const ImageDecoder* decoder)
+bool IsImageHandleValid(ImageHandle handle)
 {
-    if (!filename || !decoder)
-        return;
+    assert(g_context);
+    const ImageHandleStorage& handles = g_context->Handles;
+    return handle.Index < (uint32_t)handles.Generations.Size
+        && handles.Generations[handle.Index] == handle.Generation
+        && handles.States[handle.Index] != ImageHandleState::Free;
+}
 
-    FILE* f = fopen(filename, "rb");
-    if (!f)
-        return;
+ImVec2 GetImageHandleSize(ImageHandle handle)
+{
+    if (!IsImageHandleValid(handle))
+        return ImVec2(0, 0);
+    return g_context->Handles.Sizes[handle.Index];
+}
 
-    fseek(f, 0, SEEK_END);
-    size_t file_size = ftell(f);
-    fseek(f, 0, SEEK_SET);
+ImTextureID GetImageHandleTexture(ImageHandle handle)
+{
+    if (!IsImageHandleValid(handle))
+        return g_context->EmptyImage->GetTexture();
+    ImageHandleStorage& handles = g_context->Handles;
+    handles.Use(handle.Index);
+    return handles.Textures[handle.Index];
+}
 
-    if (decoder->CreateContextFromFile)
-        Load(decoder->CreateContextFromFile(f, file_size), decoder);
-    else
+void ShowImageHandle(ImageHandle handle, const ImVec2& size, ImageFillMode fill_mode, const ImVec2& uv0, const ImVec2& uv1, const ImVec4& tint_col, const ImVec4& border_col)
+{
+    if (!IsImageHandleValid(handle))
     {
-        uint8_t* data = new uint8_t[file_size];
-        fread(data, 1, file_size, f);
-        fclose(f);
-        Load(decoder->CreateContextFromData(data, file_size), decoder);
-        delete[] data;
+        ImGui::Dummy(size);
+        return;
     }
+    g_context->Handles.Show(handle.Index, size, fill_mode, uv0, uv1, tint_col, border_col);
+}
+
+void SetImageHandleEviction(int max_unused_frames)
+{
+    assert(g_context);
+    g_context->Handles.EvictAfterFrames = max_unused_frames;
+}
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+void Image::Load(const char* filename, const ImageDecoder* decoder)
+{
+    if (g_context->FormatCompactionEnabled && filename)
+        FormatKey = ImHashStr(filename);
+    Load(CreateDecoderContext(filename, decoder), decoder);
 }
 
 void Image::Load(const uint8_t* data, size_t data_size, const ImageDecoder* decoder)
 {
     if (!data || !decoder)
         return;
-    Load(decoder->CreateContextFromData(data, data_size), decoder);
+    Load(IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData", decoder->CreateContextFromData(data, data_size)), decoder);
 }
 
 void Image::Load(void* decoder_context, const ImageDecoder* decoder)
 {
+    IMMEDIA_TRACE_SCOPE("Image::Load");
     assert(GetImageRenderer());
 
     if (!decoder_context || !decoder)
         return;
 
+    // Planar and palette frames skip color conversion on CPU, the renderer converts them while uploading.
+    if (decoder->SetOutputFormat)
+    {
+        static const PixelFormat compact_formats[] = { PixelFormat::YUV420P, PixelFormat::Indexed8 };
+        for (PixelFormat compact_format : compact_formats)
+            if (IsPixelFormatSupported(compact_format) && decoder->SetOutputFormat(decoder_context, compact_format))
+                break;
+    }
+
     PixelFormat format;
     int         framt_count;
     decoder->GetInfo(decoder_context, &Width, &Height, &format, &framt_count);
     HasAnim = framt_count > 0;
+    Format          = format;
+    Orientation     = decoder->GetOrientation ? decoder->GetOrientation(decoder_context) : ImageOrientation::Normal;
     Decoder         = decoder;
     DecoderContext  = decoder_context;
-    RendererContext = GetImageRenderer()->CreateContext(Width, Height, format, HasAnim);
+
+    // Frames timed by the decoder are not the same in every loop.
+    const bool timed_frames = decoder->GetLoopCount && decoder->GetLoopCount(decoder_context) < 0;
+    if (HasAnim && g_context->FrameCacheEnabled && !timed_frames)
+    {
+        const size_t bytes = (size_t)Width * Height * 4 * framt_count;
+        if (bytes <= g_context->FrameCacheMaxImageBytes
+            && (g_context->FrameCacheMaxTotalBytes == 0 || g_context->FrameCacheBytes + bytes <= g_context->FrameCacheMaxTotalBytes))
+        {
+            FrameCache = new ImageFrameCache();
+            FrameCache->FrameCount = framt_count;
+            FrameCache->FrameIndex  = 0;
+            FrameCache->LoopCount   = 0;
+            FrameCache->PlayedLoops = 0;
+            FrameCache->Bytes       = bytes;
+            FrameCache->Complete   = false;
+            g_context->FrameCacheBytes += bytes;
+        }
+    }
+
+    // Frames of cached animations are written once, their textures don't need to be streaming.
+    RendererContext = CreateRendererContext(Width, Height, format, HasAnim && !FrameCache);
+    if (FrameCache)
+        FrameCache->Contexts.push_back(RendererContext);
 
     Play();
 }
 
+void Image::UploadFrame(size_t current_time)
+{
+    if (!Decoder || !DecoderContext)
+        return;
+
+    uint8_t* pixels;
+    int      delay;
+    if (IMMEDIA_TRACE_CALL("ImageDecoder::ReadFrame", Decoder->ReadFrame(DecoderContext, &pixels, &delay)))
+    {
+        if (!pixels)
+        {
+            NextFrameTime = current_time + delay;
+            return;
+        }
+        if (!FrameReady && !HasAnim && g_context->FormatCompactionEnabled)
+            pixels = CompactFrame(pixels);
+        else if (FrameReady && !HasAnim)
+        {
+            // Refined pass of a still image, which is in the decoder format again if the first pass was compacted.
+            int         width, height, frame_count;
+            PixelFormat decoded_format;
+            Decoder->GetInfo(DecoderContext, &width, &height, &decoded_format, &frame_count);
+            if (decoded_format != Format)
+            {
+                DeleteRendererContext(RendererContext, Width, Height, Format, false);
+                RendererContext = CreateRendererContext(Width, Height, decoded_format, false);
+                Format          = decoded_format;
+            }
+        }
+
+        const ImageRenderer* renderer = GetImageRenderer();
+        int x, y, w, h;
+        if (FrameCache)
+        {
+            // Each frame gets its own texture, the first one is created in Load.
+            const int index = FrameCache->Delays.Size;
+            if (index == FrameCache->Contexts.Size)
+                FrameCache->Contexts.push_back(CreateRendererContext(Width, Height, Format, false));
+            RendererContext = FrameCache->Contexts[index];
+            FrameCache->Delays.push_back(delay);
+            FrameCache->FrameIndex = index;
+            IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", renderer->WriteFrame(RendererContext, pixels));
+        }
+        else if (FrameReady && renderer->WriteRegion && Decoder->GetDirtyRect
+            && !PIXEL_FORMAT_IS_PLANAR(Format) && !PIXEL_FORMAT_HAS_PALETTE(Format)
+            && Decoder->GetDirtyRect(DecoderContext, &x, &y, &w, &h))
+        {
+            const int stride = Width * PIXEL_FORMAT_SIZE(Format);
+            if (w > 0 && h > 0)
+                IMMEDIA_TRACE_CALL("ImageRenderer::WriteRegion", renderer->WriteRegion(RendererContext, pixels + (size_t)y * stride + (size_t)x * PIXEL_FORMAT_SIZE(Format), stride, x, y, w, h));
+        }
+        else
+            IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", renderer->WriteFrame(RendererContext, pixels));
+        FrameReady = true;
+        bool has_next_frame = false;
+        if (Decoder->ReadNextFrame)
+            has_next_frame = IMMEDIA_TRACE_CALL("ImageDecoder::ReadNextFrame", Decoder->ReadNextFrame(DecoderContext));
+        NextFrameTime = current_time + delay;
+        if (!has_next_frame)
+            NextFrameTime = SIZE_MAX;
+        if (FrameCache && has_next_frame && FrameCache->Delays.Size == FrameCache->FrameCount)
+        {
+            // First loop is done, later loops only switch textures.
+            FrameCache->Complete    = true;
+            FrameCache->LoopCount   = Decoder->GetLoopCount ? Decoder->GetLoopCount(DecoderContext) : 0;
+            FrameCache->PlayedLoops = 1;
+            has_next_frame = false;
+        }
+        if (!has_next_frame)
+        {
+            Decoder->DeleteContext(DecoderContext);
+            Decoder = nullptr;
+            DecoderContext = nullptr;
+        }
+    }
+    else
+    {
+        Decoder->DeleteContext(DecoderContext);
+        Decoder = nullptr;
+        DecoderContext = nullptr;
+    }
+}
+
+// The texture is recreated in the new format, it is not visible before the first frame is written.
+uint8_t* Image::CompactFrame(uint8_t* pixels)
+{
+    if (Format != PixelFormat::RGB888 && Format != PixelFormat::RGBA8888)
+        return pixels;
+
+    ImGuiID key = 0;
+    if (FormatKey != 0)
+    {
+        const int info[3] = { Width, Height, (int)Format };
+        key = ImHashData(info, sizeof(info), FormatKey);
+    }
+
+    const size_t       pixel_count = (size_t)Width * Height;
+    ImVector<uint8_t>& scratch     = g_context->ScratchPixels;
+    PixelFormat        format      = key != 0 ? (PixelFormat)g_context->FormatCache.GetInt(key, 0) : (PixelFormat)0;
+    bool               palettized  = false;
+    if ((int)format == 0 || !IsPixelFormatSupported(format))
+    {
+        // Palette textures are expanded to RGBA by the renderer, so gray formats come first.
+        bool opaque, gray;
+        AnalyzePixels(pixels, Format, pixel_count, &opaque, &gray);
+        const PixelFormat gray_format = opaque ? PixelFormat::L8 : PixelFormat::LA88;
+        format = Format;
+        if (gray && IsPixelFormatSupported(gray_format))
+            format = gray_format;
+        else if (IsPixelFormatSupported(PixelFormat::Indexed8))
+        {
+            scratch.resize((int)GetFrameSize(Width, Height, PixelFormat::Indexed8));
+            palettized = PalettizePixels(pixels, Format, pixel_count, scratch.Data);
+            if (palettized)
+                format = PixelFormat::Indexed8;
+        }
+        if (format == Format && opaque)
+            format = PixelFormat::RGB888;
+        if (key != 0)
+            g_context->FormatCache.SetInt(key, (int)format);
+    }
+    if (format == Format)
+        return pixels;
+
+    if (format == PixelFormat::Indexed8)
+    {
+        if (!palettized)
+        {
+            scratch.resize((int)GetFrameSize(Width, Height, format));
+            if (!PalettizePixels(pixels, Format, pixel_count, scratch.Data))
+                return pixels;
+        }
+    }
+    else
+    {
+        scratch.resize((int)GetFrameSize(Width, Height, format));
+        if (!ConvertPixels(pixels, Format, 0, scratch.Data, format, 0, Width, Height))
+            return pixels;
+    }
+
+    DeleteRendererContext(RendererContext, Width, Height, Format, false);
+    RendererContext = CreateRendererContext(Width, Height, format, false);
+    Format          = format;
+    return scratch.Data;
+}
+
+void Image::PlayCachedFrame(size_t current_time)
+{
+    if (current_time < NextFrameTime)
+        return;
+    if (FrameCache->FrameIndex + 1 == FrameCache->Contexts.Size)
+    {
+        // Stay on the last frame once the decoder's loop count is played.
+        if (FrameCache->LoopCount > 0 && FrameCache->PlayedLoops >= FrameCache->LoopCount)
+        {
+            NextFrameTime = SIZE_MAX;
+            return;
+        }
+        ++FrameCache->PlayedLoops;
+    }
+    FrameCache->FrameIndex = (FrameCache->FrameIndex + 1) % FrameCache->Contexts.Size;
+    RendererContext = FrameCache->Contexts[FrameCache->FrameIndex];
+    NextFrameTime   = current_time + FrameCache->Delays[FrameCache->FrameIndex];
+}
+
+Image Image::CreateThumbnail(const char* filename, int max_width, int max_height, ResizeFilter filter, const char* format) noexcept
+{
+    const ImageDecoder* decoder = GetFileDecoder(filename, format);
+    return CreateThumbnail(CreateDecoderContext(filename, decoder), decoder, max_width, max_height, filter);
+}
+
+Image Image::CreateThumbnail(void* decoder_context, const ImageDecoder* decoder, int max_width, int max_height, ResizeFilter filter) noexcept
+{
+    Image image;
+    if (!decoder_context || !decoder)
+        return image;
+
+    // Bounds are of the oriented image.
+    const ImageOrientation orientation = decoder->GetOrientation ? decoder->GetOrientation(decoder_context) : ImageOrientation::Normal;
+    if (IMAGE_ORIENTATION_IS_TRANSPOSED(orientation))
+        ImSwap(max_width, max_height);
+    if (decoder->SetTargetSize)
+        decoder->SetTargetSize(decoder_context, max_width, max_height);
+
+    int         width, height;
+    PixelFormat format;
+    decoder->GetInfo(decoder_context, &width, &height, &format, nullptr);
+
+    uint8_t* pixels;
+    int      delay;
+    if (ReadFinalFrame(decoder_context, decoder, &pixels, &delay))
+    {
+        int thumbnail_width, thumbnail_height;
+        FitSize(width, height, max_width, max_height, &thumbnail_width, &thumbnail_height);
+
+        // Small images are not worth waking up worker threads.
+        ThreadPool* pool = nullptr;
+        if ((size_t)width * height >= 512 * 512)
+            pool = GetWorkerPool();
+
+        ImVector<uint8_t> thumbnail;
+        thumbnail.resize(thumbnail_width * thumbnail_height * PIXEL_FORMAT_SIZE(format));
+        if (Resize(pixels, width, height, 0, thumbnail.Data, thumbnail_width, thumbnail_height, 0, format, filter, pool))
+        {
+            image = Image(thumbnail_width, thumbnail_height, format, thumbnail.Data);
+            image.Orientation = orientation;
+        }
+    }
+
+    decoder->DeleteContext(decoder_context);
+    return image;
+}
+
 #endif // !IMMEDIA_NO_IMAGE_DECODER
 
 
 
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+// Pack entries know their format, other files are looked up by extension, then by signature.
+const ImageDecoder* GetFileDecoder(const char* filename, const char* format)
+{
+    if (format != nullptr)
+        return GetImageDecoder(format);
+    if (IsPackPath(filename))
+        return GetPackEntryDecoder(filename);
+    const ImageDecoder* decoder = GetImageDecoder(GetFileExtension(filename));
+    if (decoder)
+        return decoder;
+
+    // Unknown extension, detect by signature.
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return nullptr;
+    uint8_t head[32];
+    const size_t head_size = fread(head, 1, sizeof(head), f);
+    fclose(f);
+    return GetImageDecoder(DetectImageFormat(head, head_size));
+}
+
+ImGuiID HashFormat(const char* format)
+{
+    ImGuiID hash = 2166136261u;
+    for (; *format != '\0'; ++format)
+    {
+        hash ^= (uint8_t)tolower(*format);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void InstallDefaultImageSignatures()
+{
+    static const uint8_t png[]  = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    static const uint8_t jpg[]  = { 0xFF, 0xD8, 0xFF };
+    static const uint8_t gif[]  = { 'G', 'I', 'F', '8' };
+    static const uint8_t webp[] = { 'W', 'E', 'B', 'P' };
+    static const uint8_t avi[]  = { 'A', 'V', 'I', ' ' };
+    static const uint8_t qoi[]  = { 'q', 'o', 'i', 'f' };
+    static const uint8_t bmp[]  = { 'B', 'M' };
+    static const uint8_t psd[]  = { '8', 'B', 'P', 'S' };
+    static const uint8_t pic[]  = { 0x53, 0x80, 0xF6, 0x34 };
+    static const uint8_t pgm[]  = { 'P', '5' };
+    static const uint8_t pnm[]  = { 'P', '6' };
+    static const uint8_t jxl[]  = { 0xFF, 0x0A };
+    static const uint8_t jxl_container[] = { 0x00, 0x00, 0x00, 0x0C, 'J', 'X', 'L', ' ', 0x0D, 0x0A, 0x87, 0x0A };
+
+    InstallImageSignature("png",  png,  sizeof(png));
+    InstallImageSignature("jpg",  jpg,  sizeof(jpg));
+    InstallImageSignature("gif",  gif,  sizeof(gif));
+    InstallImageSignature("webp", webp, sizeof(webp), 8);  // After "RIFF" and chunk size.
+    InstallImageSignature("avi",  avi,  sizeof(avi),  8);
+    InstallImageSignature("qoi",  qoi,  sizeof(qoi));
+    InstallImageSignature("bmp",  bmp,  sizeof(bmp));
+    InstallImageSignature("psd",  psd,  sizeof(psd));
+    InstallImageSignature("pic",  pic,  sizeof(pic));
+    InstallImageSignature("pgm",  pgm,  sizeof(pgm));
+    InstallImageSignature("pnm",  pnm,  sizeof(pnm));
+    InstallImageSignature("jxl",  jxl,  sizeof(jxl));  // Bare codestream.
+    InstallImageSignature("jxl",  jxl_container, sizeof(jxl_container));
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
 const char* GetFileExtension(const char* filename)
 {
     const char* p0 = filename;
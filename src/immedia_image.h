@@ -15,6 +15,19 @@
 //   ImMedia::DestoryContext();
 //
 //
+// Threading:
+//   CreateContext and DestoryContext are called while no other thread uses immedia.
+//   Decoding is thread-safe: decoder and signature install and lookup, ProbeImage, CreateDecoderContext,
+//   packs and pixel conversion may be called from any thread. A decoder context is used by one thread at a time,
+//   it can be created on a worker thread and handed to the render thread with Image(decoder_context, decoder).
+//   Everything which touches textures, Image, EndFrame and the Enable/Disable settings, is render thread only.
+//
+//   // Worker thread.
+//   void* context = ImMedia::CreateDecoderContext("photo.jpg", ImMedia::GetImageDecoder("jpg"));
+//   // Render thread.
+//   ImMedia::Image photo(context, ImMedia::GetImageDecoder("jpg"));
+//
+//
 //  Define IMMEDIA_NO_IMAGE_DECODER macro to disable decoder feature.
 //
 
@@ -45,15 +58,101 @@ enum class PixelFormat : int
 {                            // | ID | alpha | size |
     RGB888   = PIXEL_FORMAT_INFO( 1,   0,      3    ),
     RGBA8888 = PIXEL_FORMAT_INFO( 2,   1,      4    ),
+
+    // Planar, size is of a luma sample. Y plane of width x height, followed by U and V planes of
+    // ((width + 1) / 2) x ((height + 1) / 2), rows tightly packed, full range BT.601 as in JPEG.
+    // Only emitted by decoders when the renderer supports it, see also @ref IsPixelFormatSupported.
+    YUV420P  = PIXEL_FORMAT_INFO( 3,   0,      1    ),
+
+    // Palette, size is of an index. Index plane of width x height, followed by 256 RGBA8888 entries.
+    // Only emitted by decoders when the renderer supports it, see also @ref IsPixelFormatSupported.
+    Indexed8 = PIXEL_FORMAT_INFO( 4,   1,      1    ),
+
+    // Gray and gray with alpha, shown as RGB(A) with equal color channels.
+    // Only emitted by @ref EnableFormatCompaction when the renderer supports it.
+    L8       = PIXEL_FORMAT_INFO( 5,   0,      1    ),
+    LA88     = PIXEL_FORMAT_INFO( 6,   1,      2    ),
 };
 
 #define PIXEL_FORMAT_SIZE(PIXEL_FORMAT)      ((int)PIXEL_FORMAT & 0x0FF)
 #define PIXEL_FORMAT_HAS_ALPHA(PIXEL_FORMAT) ((int)PIXEL_FORMAT & 0x100)
+#define PIXEL_FORMAT_IS_PLANAR(PIXEL_FORMAT) (((int)PIXEL_FORMAT >> 9) == 3)
+#define PIXEL_FORMAT_HAS_PALETTE(PIXEL_FORMAT) (((int)PIXEL_FORMAT >> 9) == 4)
+
+/// @brief Bytes of a tightly packed frame, including all planes of planar formats.
+size_t GetFrameSize(int width, int height, PixelFormat format);
+
+// EXIF orientation, how stored pixels are transformed for display. Images apply it to texture coordinates
+// when shown, pixels are never rotated.
+enum class ImageOrientation : int
+{
+    Normal         = 1,
+    FlipHorizontal = 2,
+    Rotate180      = 3,
+    FlipVertical   = 4,
+    Transpose      = 5,  // Flip horizontal, then rotate 270 clockwise.
+    Rotate90       = 6,  // Rotate 90 clockwise.
+    Transverse     = 7,  // Flip horizontal, then rotate 90 clockwise.
+    Rotate270      = 8,  // Rotate 270 clockwise.
+};
+
+/// @return true if width and height are swapped for display.
+#define IMAGE_ORIENTATION_IS_TRANSPOSED(ORIENTATION) ((int)ORIENTATION >= 5)
+
+/// @brief Read orientation from an EXIF payload, e.g. of JPEG APP1 segment, PNG eXIf or WebP EXIF chunk.
+/// @param data TIFF header and IFDs, optionally preceded by "Exif\0\0".
+/// @return Normal if the tag is missing or the payload is invalid.
+ImageOrientation ReadExifOrientation(const uint8_t* data, size_t data_size);
 
 
 
 #ifndef IMMEDIA_NO_IMAGE_DECODER
 
+/// @brief Byte stream read by decoders, e.g. an archive entry, a pipe or a network response.
+///        Bytes are pulled while decoding, the whole payload never needs to be resident.
+struct ImageSource
+{
+    /// @brief Read up to size bytes.
+    /// @return Bytes read, 0 at the end of stream or on error.
+    size_t (*Read)(void* user_data, uint8_t* buffer, size_t size);
+
+    /// @brief Skip bytes forward.
+    ///        It can be set to null, immedia would read and discard them.
+    /// @return false if the stream ends before.
+    bool (*Skip)(void* user_data, size_t size);
+
+    /// @brief Get total size of stream, used to preallocate buffers.
+    ///        It can be set to null.
+    /// @return 0 if unknown.
+    size_t (*GetSize)(void* user_data);
+
+    /// @brief Map the whole stream to memory, decoders read it in place instead of calling @ref Read.
+    ///        It can be set to null.
+    /// @param[out] size Size of mapped memory.
+    /// @return [nullable] Memory valid until @ref Close, null if the stream can't be mapped.
+    const uint8_t* (*Map)(void* user_data, size_t* size);
+
+    /// @brief Release the stream, called once when it is no longer read.
+    ///        It can be set to null.
+    void (*Close)(void* user_data);
+
+    void* UserData;
+};
+
+/// @brief Read size bytes, unless the source ends before.
+/// @return Bytes read.
+size_t ReadImageSource(const ImageSource& source, void* buffer, size_t size);
+
+/// @brief Skip size bytes with @ref ImageSource::Skip, or read and discard them.
+/// @return false if the source ends before.
+bool SkipImageSource(const ImageSource& source, size_t size);
+
+/// @brief Append the rest of source to buffer.
+void ReadImageSourceToEnd(const ImageSource& source, ImVector<uint8_t>& buffer);
+
+/// @brief Call @ref ImageSource::Close if it is set.
+void CloseImageSource(const ImageSource& source);
+
 struct ImageDecoder
 {
     /// @brief Create context from filename.
@@ -84,28 +183,148 @@ struct ImageDecoder
     /// @brief Read current frame from decoder context.
     /// @param context Decoder context.
     /// @param[out] pixels A pointer to frame pixels, valid until call @ref ReadNext.
+    ///                    Set to null if the frame is not ready yet, the image keeps showing previous frame
+    ///                    and calls @ref ReadFrame again after delay, without calling @ref ReadNextFrame.
     /// @param[out] delay 0 if the image dosen't contain animation or is the last frame.
     /// @return true if success.
     bool (*ReadFrame)(void* context, uint8_t** pixels, int* delay_in_ms);
 
     /// @brief Read next frame from decoder context.
     ///        It can be set to null if the decoder doesn't support animation.
+    ///        Still images may have a next frame too, a refined pass of the same image, e.g. progressive JPEG XL.
     /// @param context Decoder context.
     /// @return true if has next frame.
     bool (*ReadNextFrame)(void* context);
+
+    /// @brief Get the region of last @ref ReadFrame which differs from the frame before it.
+    ///        It can be set to null, the whole frame is treated as changed.
+    /// @param context Decoder context.
+    /// @return false if the whole frame changed.
+    bool (*GetDirtyRect)(void* context, int* x, int* y, int* width, int* height);
+
+    /// @brief Create context from a byte stream, so decoding can overlap reading.
+    ///        It can be set to null, immedia would use @ref ImageSource::Map or read the whole stream
+    ///        and switch to @ref CreateContextFromData.
+    /// @param source Decoder takes ownership of source, and must call @ref CloseImageSource once, also if it fails.
+    /// @return [nullable] null if can't parsered from source.
+    void* (*CreateContextFromSource)(const ImageSource& source);
+
+    /// @brief Read image info from the head of a file, without creating a context or decoding pixels.
+    ///        It can be set to null, immedia would create a context and call @ref GetInfo.
+    /// @param data First bytes of the file, it may end anywhere after the header.
+    /// @param[out] frame_count [nullable] 0 if the image doesn't contain animation, -1 if it can't be told from data.
+    /// @return false if data is not in this format, or too short to contain the header.
+    bool (*Probe)(const uint8_t* data, size_t data_size, int* width, int* height, PixelFormat* format, int* frame_count);
+
+    /// @brief Ask the decoder to emit frames in another format, called before @ref GetInfo.
+    ///        It can be set to null, frames are always in the format from @ref GetInfo.
+    ///        Images request planar and palette formats only if the renderer supports them.
+    /// @return false if the format is not supported for this image, the output format is unchanged.
+    bool (*SetOutputFormat)(void* context, PixelFormat format);
+
+    /// @brief Get orientation stored in metadata, e.g. EXIF. Frames are still read as stored, sizes are of stored pixels.
+    ///        It can be set to null, images are shown as stored.
+    ImageOrientation (*GetOrientation)(void* context);
+
+    /// @brief Ask the decoder to emit frames reduced to about the size they are shown at, called before @ref GetInfo.
+    ///        It can be set to null, frames are decoded at full size.
+    ///        The decoder picks the smallest size it decodes cheaply which still covers the image fitted in
+    ///        width x height, e.g. JPEG DCT scaling by 1/2, 1/4 or 1/8. @ref GetInfo reports the reduced size.
+    /// @param width Bounds width, of stored pixels.
+    /// @param height Bounds height, of stored pixels.
+    /// @return false if the size is unchanged.
+    bool (*SetTargetSize)(void* context, int width, int height);
+
+    /// @brief Get how many times the animation plays, as @ref ReadNextFrame enforces it.
+    ///        It can be set to null, animations loop forever. Images caching the frames of the first loop
+    ///        replay them as many times, see @ref EnableFrameCache.
+    /// @return 0 if the animation loops forever, -1 if frames depend on playback time, e.g. dropped to keep up
+    ///         with a clock, so they are never cached.
+    int (*GetLoopCount)(void* context);
 };
 
-/// @brief Installs decoder for the specified format.
-///        Note: If install for an existing format, the old decoder would be overwritten.
+/// @brief Installs decoder for the specified format, thread-safe.
+///        Note: If install for an existing format, the old decoder would be replaced for later lookups,
+///        pointers to it stay valid until @ref DestoryContext.
 /// @param format Image format string in lowercase, must keep valid before call @ref DestoryContext.
 /// @param decoder ImageDecoder struct.
 void InstallImageDecoder(const char* format, const ImageDecoder& decoder);
 
-/// @brief Get decoder for the format.
+/// @brief Installs the decoder of a shared library for the format, thread-safe. The library is loaded the first time
+///        @ref GetImageDecoder looks up the format, and installs its decoders from @ref IMMEDIA_DECODER_PLUGIN_ENTRY.
+///        Formats of the same library share one load. Plug-ins call immedia of the application, so the application
+///        exports its symbols, e.g. linked with -rdynamic.
+///        Note: If the library can't be loaded or doesn't install the format, lookups of the format return null.
+/// @param format Image format string in lowercase, must keep valid before call @ref DestoryContext.
+/// @param library Path passed to dlopen or LoadLibrary, must keep valid before call @ref DestoryContext.
+void InstallImageDecoder(const char* format, const char* library);
+
+// Function exported by decoder plug-in libraries, which installs their decoders.
+// Decoders of src/decoder define it if IMMEDIA_DECODER_PLUGIN is defined.
+#ifdef _WIN32
+#define IMMEDIA_DECODER_PLUGIN_ENTRY extern "C" __declspec(dllexport) void ImMedia_InstallDecoderPlugin()
+#else
+#define IMMEDIA_DECODER_PLUGIN_ENTRY extern "C" __attribute__((visibility("default"))) void ImMedia_InstallDecoderPlugin()
+#endif
+
+/// @brief Get decoder for the format, thread-safe and lock-free, except the first lookup of a plug-in format loads its library.
 /// @param format Image format string, case insensitive.
 /// @return [nullable] null if no corresponding decoder is installed.
 const ImageDecoder* GetImageDecoder(const char* format);
 
+/// @brief Installs a signature to select decoders by the first bytes of file, see also @ref DetectImageFormat.
+///        Signatures of formats supported by immedia decoders are installed by @ref CreateContext. Thread-safe.
+/// @param format Image format string in lowercase, must keep valid before call @ref DestoryContext.
+/// @param signature Bytes to match, must keep valid before call @ref DestoryContext.
+/// @param offset Position of signature from start of file.
+void InstallImageSignature(const char* format, const uint8_t* signature, int signature_size, int offset = 0);
+
+/// @brief Detect format by signatures of installed decoders, signatures installed later are matched first.
+///        Thread-safe and lock-free.
+/// @return [nullable] null if no signature matches, or no decoder is installed for the format.
+const char* DetectImageFormat(const uint8_t* data, size_t data_size);
+
+struct ImageInfo
+{
+    const ImageDecoder* Decoder;
+    int                 Width;
+    int                 Height;
+    PixelFormat         Format;
+    int                 FrameCount;  // 0 if the image doesn't contain animation, -1 if it is not known without decoding.
+};
+
+/// @brief Get image info by reading only the head of file, the decoder is selected by signature, then by extension.
+///        Falls back to creating a decoder context if the decoder has no @ref ImageDecoder::Probe. Thread-safe if the decoder is.
+/// @param format [nullable] Image format, null to detect it.
+/// @return false if no decoder is found or the file can't be parsered.
+bool ProbeImage(const char* filename, ImageInfo* info, const char* format = nullptr);
+
+/// @brief Same as above, data may be the head of file only if the decoder has @ref ImageDecoder::Probe.
+bool ProbeImage(const uint8_t* data, size_t data_size, ImageInfo* info, const char* format = nullptr);
+
+/// @brief Get decoder of a file by format if it is given, else by extension, then by signature of the head of file.
+///        Pack entries use their stored format. Thread-safe.
+/// @param format [nullable]
+/// @return [nullable] null if no installed decoder matches.
+const ImageDecoder* GetFileDecoder(const char* filename, const char* format = nullptr);
+
+/// @brief Open file and create decoder context with @ref ImageDecoder::CreateContextFromFile, or read the whole file for
+///        @ref ImageDecoder::CreateContextFromData. Thread-safe if the decoder is.
+/// @param decoder [nullable]
+/// @return [nullable] null if the file can't be opened or parsered.
+void* CreateDecoderContext(const char* filename, const ImageDecoder* decoder);
+
+/// @brief Create decoder context from source, see also @ref ImageDecoder::CreateContextFromSource.
+///        The source is closed even if it fails. Thread-safe if the decoder is.
+/// @param decoder [nullable]
+/// @return [nullable] null if the source can't be parsered.
+void* CreateDecoderContext(const ImageSource& source, const ImageDecoder* decoder);
+
+/// @brief Read the first frame with @ref ImageDecoder::ReadFrame, of still images refined in passes the last pass,
+///        for consumers which show a single frame, e.g. thumbnails. Thread-safe if the decoder is.
+/// @return true if success and pixels are not null.
+bool ReadFinalFrame(void* context, const ImageDecoder* decoder, uint8_t** pixels, int* delay_in_ms);
+
 #endif // !IMMEDIA_NO_IMAGE_DECODER
 
 
@@ -133,11 +352,101 @@ struct ImageRenderer
     /// @param context Renderer context.
     /// @return ImTextureID of current frame, the value may be different for each call.
     ImTextureID (*GetTexture)(void* context);
+
+    /// @brief Called before a batch of @ref WriteFrame in @ref EndFrame, setup shared upload state here.
+    ///        It can be set to null.
+    void (*BeginUpload)();
+
+    /// @brief Called after a batch of @ref WriteFrame in @ref EndFrame, restore state changed by @ref BeginUpload.
+    ///        It can be set to null.
+    void (*EndUpload)();
+
+    /// @brief Write pixels to a region of renderer context, without reallocating the texture.
+    ///        It can be set to null, immedia would repack pixels and switch to @ref WriteFrame for full updates.
+    /// @param context Renderer context.
+    /// @param pixels A pointer to the top left pixel of region, in the same format from @ref CreateContext.
+    /// @param stride Bytes between two rows of pixels.
+    void (*WriteRegion)(void* context, const uint8_t* pixels, int stride, int x, int y, int width, int height);
+
+    /// @brief Whether @ref CreateContext accepts the format, the texture from @ref GetTexture is RGB(A) regardless.
+    ///        It can be set to null, only RGB888 and RGBA8888 are supported.
+    ///        Contexts of planar and palette formats are only written by @ref WriteFrame.
+    bool (*SupportsFormat)(PixelFormat format);
 };
 
+/// @brief Install the renderer once, on the render thread.
+///        It is published atomically, @ref GetImageRenderer on other threads returns null or the whole renderer.
 void InstallImageRenderer(const ImageRenderer& renderer);
 const ImageRenderer* GetImageRenderer();
 
+/// @brief RGB888 and RGBA8888 are always supported, other formats if the renderer reports them.
+bool IsPixelFormatSupported(PixelFormat format);
+
+
+
+/// @brief Defer frame uploads of images to @ref EndFrame instead of uploading them in @ref Image::Play.
+///        Visible images are uploaded first, then the ones closest to their frame deadline.
+///        At least one frame is uploaded per @ref EndFrame, even if it exceeds the budget.
+/// @param max_bytes_per_frame Upload budget in bytes, 0 for unlimited.
+/// @param max_ms_per_frame Upload budget in milliseconds, 0 for unlimited.
+void EnableUploadQueue(size_t max_bytes_per_frame = 0, float max_ms_per_frame = 0.0f);
+
+/// @brief Upload all pending frames and go back to upload in @ref Image::Play.
+void DisableUploadQueue();
+
+/// @brief Flush upload queue within the budget, age the texture pool and stream trace events,
+///        call it once per frame after all images are shown.
+void EndFrame();
+
+/// @brief Time the next animation frame is due among images played in the last frame, in seconds of ImGui::GetTime().
+///        Call it after @ref EndFrame, an event-driven loop can wait for events until then instead of redrawing.
+///        It is the current time while uploads are queued, or once after @ref RequestWakeUp.
+/// @return -1 if nothing is animating.
+double GetNextAnimationDeadline();
+
+/// @brief Set a function called by @ref RequestWakeUp, e.g. to push an event waking the loop.
+///        Set it before starting loaders, it is called on their threads.
+/// @param callback [nullable] Null to remove it.
+void SetWakeUpCallback(void (*callback)(void* user_data), void* user_data);
+
+/// @brief [Any thread] Request a frame, called when an @ref ImageGrid cell is decoded, a file of @ref LoadImages is
+///        loaded, or a @ref StreamImage frame is submitted.
+void RequestWakeUp();
+
+/// @brief Keep a texture per frame for animations loaded later, when all frames fit in the budget.
+///        After the first loop, they play by switching textures, without decoding or uploading.
+///        Cached animations stop after the loop count of their decoder, see @ref ImageDecoder::GetLoopCount.
+///        Image sequences are never cached, their frames depend on playback time.
+///        Texture size is estimated at 4 bytes per pixel.
+/// @param max_bytes_per_image Animations larger than this are decoded in every loop.
+/// @param max_total_bytes Budget of all cached frames, 0 for unlimited.
+void EnableFrameCache(size_t max_bytes_per_image = 4 * 1024 * 1024, size_t max_total_bytes = 64 * 1024 * 1024);
+
+/// @brief Animations loaded later are decoded in every loop, existing caches are kept.
+void DisableFrameCache();
+
+/// @brief Scan the first frame of still images loaded later and upload it in the smallest format the renderer supports,
+///        L8 or LA88 for gray content, Indexed8 for up to 256 colors, RGB888 for opaque RGBA.
+///        The format chosen for a file is remembered by name, loading it again skips the scan.
+///        @ref Image::UpdatePixels of these images takes pixels in the compacted format, see @ref Image::GetFormat.
+void EnableFormatCompaction();
+
+/// @brief Images loaded later keep the format of their decoder, remembered formats are kept.
+void DisableFormatCompaction();
+
+/// @brief Forget formats remembered by @ref EnableFormatCompaction, call it after files are changed.
+void ClearFormatCache();
+
+/// @brief Keep renderer contexts of destroyed images and give them to new images of the same size, format
+///        and animation flag, so scrolling through images of a few sizes doesn't allocate textures.
+///        Texture size is estimated at 4 bytes per pixel, the least recently released ones are deleted first.
+/// @param max_bytes Budget of pooled textures.
+/// @param max_age_frames Pooled textures unused for more frames are deleted in @ref EndFrame, 0 to keep them.
+void EnableTexturePool(size_t max_bytes = 32 * 1024 * 1024, int max_age_frames = 120);
+
+/// @brief Delete pooled textures, images go back to delete their textures.
+void DisableTexturePool();
+
 
 
 enum class ImageFillMode
@@ -147,6 +456,15 @@ enum class ImageFillMode
     Fill
 };
 
+enum class ResizeFilter
+{
+    Box,       // Average, fastest, for large downscale factors.
+    Mitchell,  // Smooth, without ringing.
+    Lanczos3   // Sharpest, may ring around hard edges.
+};
+
+
+struct ImageFrameCache;
 
 class Image
 {
@@ -157,21 +475,42 @@ public:
     Image(const uint8_t* data, size_t data_size, const char* format) noexcept;
     Image(const uint8_t* data, size_t data_size, const ImageDecoder* decoder) noexcept;
     Image(void* decoder_context, const ImageDecoder* decoder) noexcept;
+    Image(const ImageSource& source, const char* format) noexcept;
+    Image(const ImageSource& source, const ImageDecoder* decoder) noexcept;
 #endif // !IMMEDIA_NO_IMAGE_DECODER
 
     Image(int width, int height, PixelFormat format, const uint8_t* pixels) noexcept;
 
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+    /// @brief Decode the first frame and create an image fitting in max_width x max_height with the same aspect ratio.
+    ///        Only the downscaled pixels are uploaded to renderer, see also @ref Resize to resample into your buffer.
+    /// @param format [nullable] Image format, null to use file extension.
+    static Image CreateThumbnail(const char* filename, int max_width, int max_height,
+                                 ResizeFilter filter = ResizeFilter::Lanczos3, const char* format = nullptr) noexcept;
+
+    /// @brief Same as above, the decoder context is deleted before return.
+    static Image CreateThumbnail(void* decoder_context, const ImageDecoder* decoder, int max_width, int max_height,
+                                 ResizeFilter filter = ResizeFilter::Lanczos3) noexcept;
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
     ~Image();
 
     Image(const Image&) = delete;
     Image& operator=(const Image&) = delete;
-    Image(Image&&) = default;
-    Image& operator=(Image&&) = default;
+    Image(Image&& other) noexcept;
+    Image& operator=(Image&& other) noexcept;
 
+    /// @brief Size for display, width and height are swapped for transposed orientations.
     int GetWidth() const;
     int GetHeight() const;
     ImVec2 GetSize() const;
 
+    /// @brief Orientation applied by @ref Show, from @ref ImageDecoder::GetOrientation.
+    ImageOrientation GetOrientation() const;
+
+    /// @brief Format of pixels written to renderer, it may differ from the decoder, see @ref EnableFormatCompaction.
+    PixelFormat GetFormat() const;
+
     bool HasAnimation() const;
 
     /// @brief Get current ImTextureID.
@@ -182,7 +521,16 @@ public:
     /// @brief Call it to keep animation playing without call \ref Show.
     void Play() const;
 
-    /// @brief Show image, call \ref Play internally.
+    /// @brief Update pixels of a region, the texture is reused. Not for images with animation.
+    ///        Pixels and region are as stored, before orientation is applied.
+    /// @param pixels A pointer to the top left pixel of region, in the format of the image.
+    /// @param stride Bytes between two rows of pixels, 0 if rows are tightly packed.
+    /// @return false if the region is out of image, or is not the whole tightly packed frame of a planar or palette image.
+    bool UpdatePixels(const uint8_t* pixels, int stride, int x, int y, int width, int height);
+    bool UpdatePixels(const uint8_t* pixels, int stride = 0);
+
+    /// @brief Show image with orientation applied, call \ref Play internally.
+    /// @param uv0, uv1 Region of the oriented image.
     void Show(const ImVec2& size,
               ImageFillMode fill_mode = ImageFillMode::Stretch,
               const ImVec2& uv0 = ImVec2(0, 0),
@@ -191,21 +539,210 @@ public:
               const ImVec4& border_col = ImVec4(0, 0, 0, 0)) const;
 
 private:
-    int    Width   = 0;
+    friend class StreamImage;
+    friend class ScalarImage;
+    friend struct ImageHandleStorage;
+
+    int    Width   = 0;  // Of stored pixels.
     int    Height  = 0;
+    PixelFormat Format = PixelFormat::RGBA8888;
+    ImageOrientation Orientation = ImageOrientation::Normal;
 
     void*  RendererContext = nullptr;
+    bool   FrameReady      = false;
+    int    LastVisibleFrame = -1;
 
 #ifndef IMMEDIA_NO_IMAGE_DECODER
     void*               DecoderContext  = nullptr;
     const ImageDecoder* Decoder         = nullptr;
     bool                HasAnim         = false;
+    bool                UploadQueued    = false;
     size_t              NextFrameTime   = 0;
+    ImageFrameCache*    FrameCache      = nullptr;  // RendererContext is one of its textures if set.
+    ImGuiID             FormatKey       = 0;        // Hash of filename for the format cache, 0 if not loaded from file.
 
     void Load(const char* filename, const ImageDecoder* decoder);
     void Load(const uint8_t* data, size_t data_size, const ImageDecoder* decoder);
     void Load(void* decoder_context, const ImageDecoder* decoder);
+
+    void UploadFrame(size_t current_time);
+    uint8_t* CompactFrame(uint8_t* pixels);
+    void PlayCachedFrame(size_t current_time);
+    void Release();
+
+    friend void EndFrame();
+    friend void DisableUploadQueue();
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+    Image() = default;
+};
+
+
+// Handle of an image stored by the context, for applications tracking a large number of images.
+// Sizes, states, frame deadlines and textures of all handles are kept in contiguous arrays, animations are advanced
+// and unused images are evicted by scanning them in @ref EndFrame, instead of polling each image in Show.
+// Handles of destroyed images are detected by generation and treated as empty.
+struct ImageHandle
+{
+    uint32_t Index      = 0;
+    uint32_t Generation = 0;  // 0 is never valid.
+};
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+/// @brief Load image, images loaded from file can be evicted, see @ref SetImageHandleEviction.
+/// @param format [nullable] Image format, null to detect it.
+ImageHandle CreateImageHandle(const char* filename, const char* format = nullptr);
+ImageHandle CreateImageHandle(void* decoder_context, const ImageDecoder* decoder);
 #endif // !IMMEDIA_NO_IMAGE_DECODER
+ImageHandle CreateImageHandle(int width, int height, PixelFormat format, const uint8_t* pixels);
+
+void DestroyImageHandle(ImageHandle handle);
+bool IsImageHandleValid(ImageHandle handle);
+
+/// @return Size for display, 0 if the handle is not valid.
+ImVec2 GetImageHandleSize(ImageHandle handle);
+
+/// @brief Get current texture, marks the image as used in this frame. Animations advance in @ref EndFrame.
+///        Evicted images are loaded again here.
+ImTextureID GetImageHandleTexture(ImageHandle handle);
+
+/// @brief Same as @ref Image::Show, without polling the animation.
+void ShowImageHandle(ImageHandle handle, const ImVec2& size,
+                     ImageFillMode fill_mode = ImageFillMode::Stretch,
+                     const ImVec2& uv0 = ImVec2(0, 0),
+                     const ImVec2& uv1 = ImVec2(1, 1),
+                     const ImVec4& tint_col   = ImVec4(1, 1, 1, 1),
+                     const ImVec4& border_col = ImVec4(0, 0, 0, 0));
+
+/// @brief Release textures and decoders of images loaded from file and not used for more frames,
+///        they are loaded again when used. Checked in @ref EndFrame.
+/// @param max_unused_frames 0 to keep all images.
+void SetImageHandleEviction(int max_unused_frames);
+
+
+
+struct StreamImageState;
+
+/// @brief Image fed by an external producer at high rate, e.g. camera or simulation output.
+///        One producer thread submits frames, the render thread uploads the latest one in @ref Play,
+///        frames submitted in between are dropped. No allocation happens after construction.
+class StreamImage
+{
+public:
+    /// @brief Create the streaming texture, format must be supported by the renderer, see @ref IsPixelFormatSupported.
+    StreamImage(int width, int height, PixelFormat format) noexcept;
+    ~StreamImage();
+
+    StreamImage(const StreamImage&) = delete;
+    StreamImage& operator=(const StreamImage&) = delete;
+
+    int GetWidth() const;
+    int GetHeight() const;
+    ImVec2 GetSize() const;
+
+    /// @brief [Producer thread] Get the buffer to write next frame to, tightly packed, of @ref GetFrameSize bytes.
+    ///        The buffer keeps valid until @ref EndWrite.
+    uint8_t* BeginWrite();
+
+    /// @brief [Producer thread] Publish the frame written to buffer from @ref BeginWrite.
+    void EndWrite();
+
+    /// @brief [Producer thread] Copy and publish a frame.
+    /// @param stride Bytes between two rows of pixels, 0 if rows are tightly packed.
+    ///               Frames of planar and palette formats must be tightly packed, they are not submitted otherwise.
+    void Submit(const uint8_t* pixels, int stride = 0);
+
+    /// @brief Get current ImTextureID.
+    ImTextureID GetTexture() const;
+
+    /// @brief Upload the latest submitted frame if there is a new one.
+    void Play() const;
+
+    /// @brief Show image, call \ref Play internally.
+    void Show(const ImVec2& size,
+              ImageFillMode fill_mode = ImageFillMode::Stretch,
+              const ImVec2& uv0 = ImVec2(0, 0),
+              const ImVec2& uv1 = ImVec2(1, 1),
+              const ImVec4& tint_col   = ImVec4(1, 1, 1, 1),
+              const ImVec4& border_col = ImVec4(0, 0, 0, 0)) const;
+
+private:
+    Image             Target;
+    StreamImageState* State = nullptr;
+};
+
+
+
+enum class ScalarType
+{
+    Float32,
+    UInt16,
+};
+
+enum class ScalarColormap
+{
+    Gray,
+    Viridis,
+    Turbo,
+};
+
+struct ScalarImageState;
+
+/// @brief Single channel field of float or 16 bits values, e.g. sensor or simulation output, shown through a colormap.
+///        Values are kept on CPU and mapped to RGBA in @ref Play with SIMD kernels on worker threads,
+///        changing range or colormap maps them again without submitting them again. Render thread only.
+class ScalarImage
+{
+public:
+    /// @brief Range is [0, 1] for Float32 and [0, 65535] for UInt16, colormap is Gray.
+    ScalarImage(int width, int height, ScalarType type) noexcept;
+    ~ScalarImage();
+
+    ScalarImage(const ScalarImage&) = delete;
+    ScalarImage& operator=(const ScalarImage&) = delete;
+
+    int GetWidth() const;
+    int GetHeight() const;
+    ImVec2 GetSize() const;
+
+    /// @brief Copy values, they are mapped in the next @ref Play.
+    /// @param values float or uint16_t of the type of image.
+    /// @param stride Bytes between two rows of values, 0 if rows are tightly packed.
+    void Submit(const void* values, int stride = 0);
+
+    /// @brief Map low to the first colormap entry and high to the last one, values out of range are clamped.
+    void SetRange(float low, float high);
+
+    /// @brief Same as SetRange(level - window / 2, level + window / 2).
+    void SetWindowLevel(float window, float level);
+
+    /// @brief Set range to minimum and maximum of submitted values, NaN are ignored.
+    void FitRange();
+
+    void GetRange(float* low, float* high) const;
+
+    void SetColormap(ScalarColormap colormap);
+
+    /// @param palette 256 RGBA8888 entries, from low to high.
+    void SetColormap(const uint8_t* palette);
+
+    /// @brief Get current ImTextureID.
+    ImTextureID GetTexture() const;
+
+    /// @brief Map values if they, the range or the colormap changed since the last call, and upload them.
+    void Play() const;
+
+    /// @brief Show image, call \ref Play internally.
+    void Show(const ImVec2& size,
+              ImageFillMode fill_mode = ImageFillMode::Stretch,
+              const ImVec2& uv0 = ImVec2(0, 0),
+              const ImVec2& uv1 = ImVec2(1, 1),
+              const ImVec4& tint_col   = ImVec4(1, 1, 1, 1),
+              const ImVec4& border_col = ImVec4(0, 0, 0, 0)) const;
+
+private:
+    Image             Target;
+    ScalarImageState* State = nullptr;
 };
 
 }
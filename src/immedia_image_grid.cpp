@@ -0,0 +1,389 @@
+#include "immedia_image_grid.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+#include <string.h>
+
+#include <atomic>
+
+#include "imgui_internal.h"
+
+#include "immedia_pixel_convert.h"
+#include "immedia_resize.h"
+#include "immedia_thread_pool.h"
+#include "immedia_trace.h"
+
+namespace ImMedia {
+
+enum GridItemState
+{
+    GridItemState_Unloaded,
+    GridItemState_Loading,
+    GridItemState_Loaded,
+    GridItemState_Failed
+};
+
+enum GridRequestStatus
+{
+    GridRequestStatus_Pending,
+    GridRequestStatus_Done,
+    GridRequestStatus_Failed
+};
+
+struct GridItem
+{
+    char*               Filename;
+    const ImageDecoder* Decoder;
+    int                 State;
+    int                 Slot;     // Index of GridSlot if loaded.
+};
+
+// Cell sized texture, reused by items entering the view.
+struct GridSlot
+{
+    void* RendererContext;
+    int   Item;                   // -1 if free.
+};
+
+struct GridRequest
+{
+    int                 Item;
+    const char*         Filename;
+    const ImageDecoder* Decoder;
+    int                 CellWidth;
+    int                 CellHeight;
+    ResizeFilter        Filter;
+
+    std::atomic<int>    Status;
+    std::atomic<bool>   Cancelled;
+    ImVector<uint8_t>   Pixels;   // Cell sized RGBA8888, written by worker.
+};
+
+struct ImageGridState
+{
+    ImageGridConfig         Config;
+    ThreadPool              Pool;
+
+    ImVector<GridItem>      Items;
+    ImVector<GridSlot>      Slots;
+    ImVector<GridRequest*>  Requests;
+    int                     LoadingCount   = 0;  // Requests not cancelled yet.
+
+    float                   PrevScrollY    = 0.0f;
+    int                     ScrollDir      = 1;
+
+    explicit ImageGridState(const ImageGridConfig& config)
+        : Config(config), Pool(config.WorkerCount)
+    {}
+};
+
+
+
+// Runs on worker thread, decodes the first frame and fits it in the center of a transparent cell.
+static void LoadCell(void* user_data)
+{
+    GridRequest* request = reinterpret_cast<GridRequest*>(user_data);
+    if (request->Cancelled.load(std::memory_order_acquire))
+    {
+        request->Status.store(GridRequestStatus_Done, std::memory_order_release);
+        return;
+    }
+
+    bool  success = false;
+    void* context = CreateDecoderContext(request->Filename, request->Decoder);
+    if (context)
+    {
+        const ImageDecoder* decoder = request->Decoder;
+        if (decoder->SetTargetSize)
+            decoder->SetTargetSize(context, request->CellWidth, request->CellHeight);
+
+        int         width, height;
+        PixelFormat format;
+        decoder->GetInfo(context, &width, &height, &format, nullptr);
+
+        uint8_t* pixels;
+        int      delay;
+        if (ReadFinalFrame(context, decoder, &pixels, &delay)
+            && !request->Cancelled.load(std::memory_order_acquire))
+        {
+            int thumbnail_width, thumbnail_height;
+            FitSize(width, height, request->CellWidth, request->CellHeight, &thumbnail_width, &thumbnail_height);
+
+            const int cell_stride = request->CellWidth * 4;
+            request->Pixels.resize(cell_stride * request->CellHeight);
+            memset(request->Pixels.Data, 0, request->Pixels.Size);
+            uint8_t* dst = request->Pixels.Data
+                         + (size_t)((request->CellHeight - thumbnail_height) / 2) * cell_stride
+                         + (size_t)((request->CellWidth - thumbnail_width) / 2) * 4;
+
+            if (format == PixelFormat::RGBA8888)
+                success = Resize(pixels, width, height, 0, dst, thumbnail_width, thumbnail_height, cell_stride, format, request->Filter);
+            else
+            {
+                ImVector<uint8_t> thumbnail;
+                thumbnail.resize(thumbnail_width * thumbnail_height * PIXEL_FORMAT_SIZE(format));
+                success = Resize(pixels, width, height, 0, thumbnail.Data, thumbnail_width, thumbnail_height, 0, format, request->Filter)
+                       && ConvertPixels(thumbnail.Data, format, 0, dst, PixelFormat::RGBA8888, cell_stride, thumbnail_width, thumbnail_height);
+            }
+        }
+        decoder->DeleteContext(context);
+    }
+
+    request->Status.store(success ? GridRequestStatus_Done : GridRequestStatus_Failed, std::memory_order_release);
+    RequestWakeUp();
+}
+
+static void ReleaseSlot(ImageGridState* state, int item_index)
+{
+    GridItem& item = state->Items[item_index];
+    state->Slots[item.Slot].Item = -1;
+    item.Slot  = -1;
+    item.State = GridItemState_Unloaded;
+}
+
+static int AcquireSlot(ImageGridState* state, int item_index)
+{
+    for (int i = 0; i < state->Slots.Size; ++i)
+    {
+        if (state->Slots[i].Item == -1)
+        {
+            state->Slots[i].Item = item_index;
+            return i;
+        }
+    }
+    GridSlot slot;
+    slot.RendererContext = GetImageRenderer()->CreateContext((int)state->Config.CellSize.x, (int)state->Config.CellSize.y,
+                                                             PixelFormat::RGBA8888, false);
+    slot.Item = item_index;
+    state->Slots.push_back(slot);
+    return state->Slots.Size - 1;
+}
+
+static void RequestItem(ImageGridState* state, int item_index)
+{
+    GridItem& item = state->Items[item_index];
+    GridRequest* request = new GridRequest();
+    request->Item       = item_index;
+    request->Filename   = item.Filename;
+    request->Decoder    = item.Decoder;
+    request->CellWidth  = (int)state->Config.CellSize.x;
+    request->CellHeight = (int)state->Config.CellSize.y;
+    request->Filter     = state->Config.Filter;
+    request->Status.store(GridRequestStatus_Pending, std::memory_order_relaxed);
+    request->Cancelled.store(false, std::memory_order_relaxed);
+
+    item.State = GridItemState_Loading;
+    state->Requests.push_back(request);
+    ++state->LoadingCount;
+    state->Pool.Submit(LoadCell, request);
+}
+
+// Items in [range_begin, range_end) are wanted, the visible ones are [visible_begin, visible_end).
+static void UpdateRequests(ImageGridState* state, int visible_begin, int visible_end, int range_begin, int range_end)
+{
+    const ImageRenderer* renderer = GetImageRenderer();
+
+    // Collect finished requests, cancelled ones no longer own their item.
+    for (int i = 0; i < state->Requests.Size; )
+    {
+        GridRequest* request = state->Requests[i];
+        const int status = request->Status.load(std::memory_order_acquire);
+        if (status == GridRequestStatus_Pending)
+        {
+            ++i;
+            continue;
+        }
+        if (!request->Cancelled.load(std::memory_order_relaxed))
+        {
+            GridItem& item = state->Items[request->Item];
+            if (status == GridRequestStatus_Done)
+            {
+                item.Slot  = AcquireSlot(state, request->Item);
+                item.State = GridItemState_Loaded;
+                IMMEDIA_TRACE_CALL("ImageRenderer::WriteFrame", renderer->WriteFrame(state->Slots[item.Slot].RendererContext, request->Pixels.Data));
+            }
+            else
+                item.State = GridItemState_Failed;
+            --state->LoadingCount;
+        }
+        delete request;
+        state->Requests.erase(state->Requests.begin() + i);
+    }
+
+    // Cancel requests out of range, workers skip them if not started yet.
+    for (int i = 0; i < state->Requests.Size; ++i)
+    {
+        GridRequest* request = state->Requests[i];
+        if ((request->Item < range_begin || request->Item >= range_end) && !request->Cancelled.load(std::memory_order_relaxed))
+        {
+            request->Cancelled.store(true, std::memory_order_release);
+            state->Items[request->Item].State = GridItemState_Unloaded;
+            --state->LoadingCount;
+        }
+    }
+
+    // Free textures of cells out of range.
+    for (int i = 0; i < state->Slots.Size; ++i)
+    {
+        const int item = state->Slots[i].Item;
+        if (item != -1 && (item < range_begin || item >= range_end))
+            ReleaseSlot(state, item);
+    }
+
+    // Visible cells first, then prefetch margin from the nearest cell.
+    // Keep a few requests in flight only, so cells scrolled through quickly are never queued.
+    const int max_loading = state->Pool.GetThreadCount() * 2;
+    for (int i = visible_begin; i < visible_end && state->LoadingCount < max_loading; ++i)
+        if (state->Items[i].State == GridItemState_Unloaded)
+            RequestItem(state, i);
+    if (state->ScrollDir > 0)
+    {
+        for (int i = visible_end; i < range_end && state->LoadingCount < max_loading; ++i)
+            if (state->Items[i].State == GridItemState_Unloaded)
+                RequestItem(state, i);
+    }
+    else
+    {
+        for (int i = visible_begin - 1; i >= range_begin && state->LoadingCount < max_loading; --i)
+            if (state->Items[i].State == GridItemState_Unloaded)
+                RequestItem(state, i);
+    }
+}
+
+// Cancel all requests and wait for the running ones, items are left unloaded.
+static void CancelRequests(ImageGridState* state)
+{
+    for (int i = 0; i < state->Requests.Size; ++i)
+        state->Requests[i]->Cancelled.store(true, std::memory_order_release);
+    state->Pool.Wait();
+    for (int i = 0; i < state->Requests.Size; ++i)
+        delete state->Requests[i];
+    state->Requests.clear();
+    state->LoadingCount = 0;
+}
+
+
+
+ImageGrid::ImageGrid(const ImageGridConfig& config) noexcept
+{
+    State = new ImageGridState(config);
+}
+
+ImageGrid::~ImageGrid()
+{
+    Clear();
+    const ImageRenderer* renderer = GetImageRenderer();
+    for (int i = 0; i < State->Slots.Size; ++i)
+        renderer->DeleteContext(State->Slots[i].RendererContext);
+    delete State;
+}
+
+void ImageGrid::AddItem(const char* filename, const char* format)
+{
+    // Same lookup as Image, files with an unknown extension have their head read for the signature.
+    const ImageDecoder* decoder = GetFileDecoder(filename, format);
+
+    GridItem item;
+    item.Filename = new char[strlen(filename) + 1];
+    strcpy(item.Filename, filename);
+    item.Decoder  = decoder;
+    item.State    = item.Decoder ? GridItemState_Unloaded : GridItemState_Failed;
+    item.Slot     = -1;
+    State->Items.push_back(item);
+}
+
+void ImageGrid::Clear()
+{
+    CancelRequests(State);
+    for (int i = 0; i < State->Slots.Size; ++i)
+        State->Slots[i].Item = -1;
+    for (int i = 0; i < State->Items.Size; ++i)
+        delete[] State->Items[i].Filename;
+    State->Items.clear();
+}
+
+int ImageGrid::GetItemCount() const
+{
+    return State->Items.Size;
+}
+
+int ImageGrid::Show(const char* str_id, const ImVec2& size)
+{
+    int clicked = -1;
+    const ImVec2 cell_size = State->Config.CellSize;
+
+    ImGui::BeginChild(str_id, size);
+
+    const ImVec2 spacing   = ImGui::GetStyle().ItemSpacing;
+    const float  avail     = ImGui::GetContentRegionAvail().x;
+    const int    columns   = ImMax(1, (int)((avail + spacing.x) / (cell_size.x + spacing.x)));
+    const int    row_count = (State->Items.Size + columns - 1) / columns;
+
+    int first_row = row_count;
+    int last_row  = 0;
+
+    ImGuiListClipper clipper;
+    clipper.Begin(row_count, cell_size.y + spacing.y);
+    while (clipper.Step())
+    {
+        first_row = ImMin(first_row, clipper.DisplayStart);
+        last_row  = ImMax(last_row, clipper.DisplayEnd);
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+        {
+            for (int column = 0; column < columns; ++column)
+            {
+                const int index = row * columns + column;
+                if (index >= State->Items.Size)
+                    break;
+                if (column > 0)
+                    ImGui::SameLine();
+
+                ImGui::PushID(index);
+                if (ImGui::InvisibleButton("##cell", cell_size))
+                    clicked = index;
+                const ImVec2 p0 = ImGui::GetItemRectMin();
+                const ImVec2 p1 = ImGui::GetItemRectMax();
+                ImDrawList* draw_list = ImGui::GetWindowDrawList();
+
+                const GridItem& item = State->Items[index];
+                if (item.State == GridItemState_Loaded)
+                {
+                    const ImageRenderer* renderer = GetImageRenderer();
+                    draw_list->AddImage(renderer->GetTexture(State->Slots[item.Slot].RendererContext), p0, p1);
+                }
+                else
+                    draw_list->AddRectFilled(p0, p1, ImGui::GetColorU32(item.State == GridItemState_Failed ? ImGuiCol_FrameBgActive : ImGuiCol_FrameBg));
+                if (ImGui::IsItemHovered())
+                    draw_list->AddRect(p0, p1, ImGui::GetColorU32(ImGuiCol_ButtonHovered));
+                ImGui::PopID();
+            }
+        }
+    }
+    clipper.End();
+
+    const float scroll_y = ImGui::GetScrollY();
+    if (scroll_y != State->PrevScrollY)
+        State->ScrollDir = scroll_y > State->PrevScrollY ? 1 : -1;
+    State->PrevScrollY = scroll_y;
+
+    ImGui::EndChild();
+
+    if (first_row >= last_row)
+    {
+        UpdateRequests(State, 0, 0, 0, 0);
+        return clicked;
+    }
+
+    const int prefetch      = State->Config.PrefetchRows;
+    const int range_first   = State->ScrollDir < 0 ? ImMax(0, first_row - prefetch) : first_row;
+    const int range_last    = State->ScrollDir > 0 ? ImMin(row_count, last_row + prefetch) : last_row;
+    const int visible_begin = first_row * columns;
+    const int visible_end   = ImMin(State->Items.Size, last_row * columns);
+    UpdateRequests(State, visible_begin, visible_end, range_first * columns, ImMin(State->Items.Size, range_last * columns));
+
+    return clicked;
+}
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
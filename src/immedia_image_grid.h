@@ -0,0 +1,64 @@
+// Virtualized grid of image thumbnails.
+//
+// Only cells in view and a prefetch margin in scroll direction are decoded, on worker threads.
+// Requests which scroll out of range are cancelled and textures of cells leaving the view are reused,
+// so memory and decoding work are proportional to what is on screen instead of the item count:
+//
+//     ImMedia::ImageGrid grid;
+//     for (const char* path : paths)
+//         grid.AddItem(path);
+//     // ...
+//     int clicked = grid.Show("##gallery");
+//
+
+#ifndef IMMEDIA_IMAGE_GRID_H
+#define IMMEDIA_IMAGE_GRID_H
+
+#include "immedia_image.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+namespace ImMedia {
+
+struct ImageGridConfig
+{
+    ImVec2       CellSize     = ImVec2(96, 96);
+    int          PrefetchRows = 2;     // Rows loaded beyond the view in scroll direction.
+    int          WorkerCount  = 0;     // Decoding threads, 0 to use the number of hardware threads.
+    ResizeFilter Filter       = ResizeFilter::Mitchell;
+};
+
+struct ImageGridState;
+
+class ImageGrid
+{
+public:
+    explicit ImageGrid(const ImageGridConfig& config = ImageGridConfig()) noexcept;
+    ~ImageGrid();
+
+    ImageGrid(const ImageGrid&) = delete;
+    ImageGrid& operator=(const ImageGrid&) = delete;
+
+    /// @brief Append an image file, nothing is read until its cell gets near the view.
+    /// @param format [nullable] Image format, null to use file extension, or the format recorded for "pack://" entries.
+    void AddItem(const char* filename, const char* format = nullptr);
+
+    /// @brief Remove all items, blocks until running decodes are finished.
+    void Clear();
+
+    int GetItemCount() const;
+
+    /// @brief Show grid in a child window, thumbnails are centered in cells.
+    /// @param size Size of child window, 0 to fill available space.
+    /// @return Index of clicked item, -1 if none.
+    int Show(const char* str_id, const ImVec2& size = ImVec2(0, 0));
+
+private:
+    ImageGridState* State = nullptr;
+};
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+#endif // !IMMEDIA_IMAGE_GRID_H
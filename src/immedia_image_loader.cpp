@@ -0,0 +1,494 @@
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include "immedia_image_loader.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && !defined(IMMEDIA_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IMMEDIA_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#include "immedia_pack.h"
+#include "immedia_thread_pool.h"
+#include "immedia_trace.h"
+
+namespace ImMedia {
+
+struct LoaderState;
+
+struct LoaderFile
+{
+    int          Index;
+    const char*  Filename;
+    int          Fd;          // -1 if not opened, pack entries are read in place.
+    uint8_t*     Data;
+    size_t       Size;
+    size_t       Offset;      // Bytes read, the rest is read with pread by the decoding job.
+    bool         Dispatched;
+    LoaderState* State;
+#ifdef IMMEDIA_IO_URING
+    iovec        Vec;
+    bool         InFlight;    // The kernel may write to Data until the request is reaped.
+#endif
+};
+
+struct LoaderState
+{
+    ThreadPool              Pool;
+    void                  (*Callback)(const ImageLoadResult& result, void* user_data);
+    void*                   UserData;
+    std::atomic<int>        Loaded{ 0 };
+
+    std::mutex              Mutex;
+    std::condition_variable JobDone;
+    int                     Pending = 0;  // Files handed to workers and not finished yet.
+
+    explicit LoaderState(int worker_count) : Pool(worker_count) {}
+};
+
+static const ImageDecoder* FindLoaderDecoder(const char* filename, const uint8_t* data, size_t data_size)
+{
+    const ImageDecoder* decoder = GetImageDecoder(DetectImageFormat(data, data_size));
+    if (decoder)
+        return decoder;
+    const char* dot = strrchr(filename, '.');
+    return dot ? GetImageDecoder(dot + 1) : nullptr;
+}
+
+// The buffer is allocated here so reads can be queued right after.
+static void OpenLoaderFile(LoaderFile* file, bool advise)
+{
+#ifndef _WIN32
+    file->Fd = open(file->Filename, O_RDONLY | O_CLOEXEC);
+    if (file->Fd < 0)
+        return;
+    struct stat st;
+    if (fstat(file->Fd, &st) == 0 && st.st_size > 0)
+    {
+        file->Size = (size_t)st.st_size;
+        file->Data = (uint8_t*)malloc(file->Size);
+    }
+    if (!file->Data)
+    {
+        close(file->Fd);
+        file->Fd = -1;
+        return;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    // Start readahead now, the worker reading it later finds pages in cache.
+    if (advise)
+        posix_fadvise(file->Fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+#endif
+    IM_UNUSED(advise);
+}
+
+static void CloseLoaderFile(LoaderFile* file)
+{
+#ifndef _WIN32
+    if (file->Fd >= 0)
+        close(file->Fd);
+#endif
+    file->Fd = -1;
+    free(file->Data);
+    file->Data = nullptr;
+}
+
+// Read what is left after io_uring, the whole file for pread, or everything on platforms without pread.
+static bool ReadLoaderFile(LoaderFile* file)
+{
+#ifdef _WIN32
+    FILE* f = fopen(file->Filename, "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > 0)
+    {
+        file->Data = (uint8_t*)malloc((size_t)size);
+        file->Size = file->Data ? fread(file->Data, 1, (size_t)size, f) : 0;
+    }
+    fclose(f);
+    return file->Size > 0;
+#else
+    if (file->Fd < 0)
+        return false;
+    while (file->Offset < file->Size)
+    {
+        ssize_t n = pread(file->Fd, file->Data + file->Offset, file->Size - file->Offset, (off_t)file->Offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        file->Offset += (size_t)n;
+    }
+    // The file may have been truncated since it was opened.
+    file->Size = file->Offset;
+    return file->Size > 0;
+#endif
+}
+
+static void LoadFileJob(void* user_data)
+{
+    LoaderFile*  file  = reinterpret_cast<LoaderFile*>(user_data);
+    LoaderState* state = file->State;
+
+    ImageLoadResult result = { file->Index, file->Filename, nullptr, nullptr };
+    if (IsPackPath(file->Filename))
+    {
+        result.Decoder        = GetPackEntryDecoder(file->Filename);
+        result.DecoderContext = CreateDecoderContext(file->Filename, result.Decoder);
+    }
+    else if (ReadLoaderFile(file))
+    {
+        result.Decoder = FindLoaderDecoder(file->Filename, file->Data, file->Size);
+        if (result.Decoder)
+            result.DecoderContext = IMMEDIA_TRACE_CALL("ImageDecoder::CreateContextFromData",
+                                                       result.Decoder->CreateContextFromData(file->Data, file->Size));
+    }
+    CloseLoaderFile(file);
+
+    if (result.DecoderContext)
+        state->Loaded.fetch_add(1, std::memory_order_relaxed);
+    state->Callback(result, state->UserData);
+    RequestWakeUp();
+
+    {
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        --state->Pending;
+    }
+    state->JobDone.notify_one();
+}
+
+static void DispatchLoaderFile(LoaderState* state, LoaderFile* file)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->Mutex);
+        ++state->Pending;
+    }
+    file->Dispatched = true;
+    state->Pool.Submit(LoadFileJob, file);
+}
+
+static bool IsLoaderBacklogged(LoaderState* state, int limit)
+{
+    std::lock_guard<std::mutex> lock(state->Mutex);
+    return state->Pending >= limit;
+}
+
+// Keep at most limit files read ahead of decoding, so memory is bounded by queue depth instead of file count.
+static void WaitLoaderBacklog(LoaderState* state, int limit)
+{
+    std::unique_lock<std::mutex> lock(state->Mutex);
+    state->JobDone.wait(lock, [state, limit] { return state->Pending < limit; });
+}
+
+static void LoadWithPread(LoaderState* state, LoaderFile* files, int begin, int count, int depth)
+{
+    for (int i = begin; i < count; ++i)
+    {
+        WaitLoaderBacklog(state, depth);
+        if (!IsPackPath(files[i].Filename))
+            OpenLoaderFile(&files[i], true);
+        DispatchLoaderFile(state, &files[i]);
+    }
+}
+
+#ifdef IMMEDIA_IO_URING
+
+// Minimal ring over raw syscalls, so there is no dependency on liburing.
+struct IoUring
+{
+    int           Fd         = -1;
+    unsigned      Entries    = 0;
+    void*         SqRing     = MAP_FAILED;
+    size_t        SqRingSize = 0;
+    void*         CqRing     = MAP_FAILED;
+    size_t        CqRingSize = 0;
+    io_uring_sqe* Sqes       = (io_uring_sqe*)MAP_FAILED;
+    size_t        SqesSize   = 0;
+
+    unsigned*     SqHead;
+    unsigned*     SqTail;
+    unsigned*     SqMask;
+    unsigned*     SqArray;
+    unsigned*     CqHead;
+    unsigned*     CqTail;
+    unsigned*     CqMask;
+    io_uring_cqe* Cqes;
+};
+
+static void IoUringDestroy(IoUring* ring)
+{
+    if (ring->Sqes != MAP_FAILED)
+        munmap(ring->Sqes, ring->SqesSize);
+    if (ring->CqRing != MAP_FAILED && ring->CqRing != ring->SqRing)
+        munmap(ring->CqRing, ring->CqRingSize);
+    if (ring->SqRing != MAP_FAILED)
+        munmap(ring->SqRing, ring->SqRingSize);
+    // Closing the ring cancels requests still in flight without waiting for them, reap them before.
+    if (ring->Fd >= 0)
+        close(ring->Fd);
+}
+
+static bool IoUringInit(IoUring* ring, unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->Fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->Fd < 0)
+        return false;
+
+    ring->Entries    = params.sq_entries;
+    ring->SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+        ring->SqRingSize = ring->CqRingSize = ring->SqRingSize > ring->CqRingSize ? ring->SqRingSize : ring->CqRingSize;
+#endif
+
+    ring->SqRing = mmap(nullptr, ring->SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->Fd, IORING_OFF_SQ_RING);
+    if (ring->SqRing == MAP_FAILED)
+        return false;
+    ring->CqRing = single_mmap ? ring->SqRing
+                 : mmap(nullptr, ring->CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->Fd, IORING_OFF_CQ_RING);
+    if (ring->CqRing == MAP_FAILED)
+        return false;
+    ring->SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    ring->Sqes = (io_uring_sqe*)mmap(nullptr, ring->SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->Fd, IORING_OFF_SQES);
+    if (ring->Sqes == MAP_FAILED)
+        return false;
+
+    uint8_t* sq = (uint8_t*)ring->SqRing;
+    uint8_t* cq = (uint8_t*)ring->CqRing;
+    ring->SqHead  = (unsigned*)(sq + params.sq_off.head);
+    ring->SqTail  = (unsigned*)(sq + params.sq_off.tail);
+    ring->SqMask  = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->SqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->CqHead  = (unsigned*)(cq + params.cq_off.head);
+    ring->CqTail  = (unsigned*)(cq + params.cq_off.tail);
+    ring->CqMask  = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->Cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Read the rest of file in one request, short reads are queued again.
+static void IoUringQueueRead(IoUring* ring, LoaderFile* file)
+{
+    const unsigned tail  = *ring->SqTail;
+    const unsigned index = tail & *ring->SqMask;
+    io_uring_sqe* sqe = &ring->Sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    file->Vec.iov_base = file->Data + file->Offset;
+    file->Vec.iov_len  = file->Size - file->Offset;
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = file->Fd;
+    sqe->addr      = (uint64_t)(uintptr_t)&file->Vec;
+    sqe->len       = 1;
+    sqe->off       = file->Offset;
+    sqe->user_data = (uint64_t)(uintptr_t)file;
+    file->InFlight = true;
+    ring->SqArray[index] = index;
+    __atomic_store_n(ring->SqTail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool IoUringSubmitAndWait(IoUring* ring)
+{
+    while (true)
+    {
+        const unsigned to_submit = *ring->SqTail - __atomic_load_n(ring->SqHead, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->Fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+            return true;
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return false;
+    }
+}
+
+// Take back entries the kernel hasn't consumed, then reap requests until none is in flight.
+// Returns false if the ring can't be waited on, files with InFlight set may still be written then.
+static bool IoUringDrain(IoUring* ring, int* in_flight)
+{
+    // Without SQPOLL the kernel consumes entries in io_uring_enter only, so the tail can be moved back.
+    const unsigned sq_head = __atomic_load_n(ring->SqHead, __ATOMIC_ACQUIRE);
+    for (unsigned i = sq_head; i != *ring->SqTail; ++i)
+    {
+        const io_uring_sqe& sqe = ring->Sqes[ring->SqArray[i & *ring->SqMask]];
+        reinterpret_cast<LoaderFile*>((uintptr_t)sqe.user_data)->InFlight = false;
+        --*in_flight;
+    }
+    __atomic_store_n(ring->SqTail, sq_head, __ATOMIC_RELEASE);
+
+    while (true)
+    {
+        unsigned       head = *ring->CqHead;
+        const unsigned tail = __atomic_load_n(ring->CqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe  = ring->Cqes[head & *ring->CqMask];
+            LoaderFile*         file = reinterpret_cast<LoaderFile*>((uintptr_t)cqe.user_data);
+            if (cqe.res > 0)
+                file->Offset += (size_t)cqe.res;
+            file->InFlight = false;
+            --*in_flight;
+        }
+        __atomic_store_n(ring->CqHead, head, __ATOMIC_RELEASE);
+        if (*in_flight == 0)
+            return true;
+
+        if (syscall(__NR_io_uring_enter, ring->Fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+            && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return false;
+    }
+}
+
+// Files are opened and read in batches while earlier ones are decoded.
+// Returns the index of the first file left to the pread path, count if all are handled.
+static int LoadWithIoUring(LoaderState* state, LoaderFile* files, int count, int depth)
+{
+    IoUring ring;
+    if (!IoUringInit(&ring, (unsigned)depth))
+    {
+        IoUringDestroy(&ring);
+        return 0;
+    }
+
+    int next      = 0;
+    int in_flight = 0;
+    while (next < count || in_flight > 0)
+    {
+        // Keep the device queue full, unless decoding lags behind.
+        while (next < count && in_flight < (int)ring.Entries && !IsLoaderBacklogged(state, depth))
+        {
+            LoaderFile* file = &files[next++];
+            if (!IsPackPath(file->Filename))
+                OpenLoaderFile(file, false);
+            if (file->Fd < 0)
+                DispatchLoaderFile(state, file);  // Pack entry, or failed and reported by the job.
+            else
+            {
+                IoUringQueueRead(&ring, file);
+                ++in_flight;
+            }
+        }
+        if (in_flight == 0)
+        {
+            WaitLoaderBacklog(state, depth);
+            continue;
+        }
+
+        if (!IoUringSubmitAndWait(&ring))
+        {
+            // The rest of opened files is read with pread once the kernel is done with their buffers.
+            const bool drained = IoUringDrain(&ring, &in_flight);
+            IoUringDestroy(&ring);
+            for (int i = 0; i < next; ++i)
+            {
+                LoaderFile* file = &files[i];
+                if (file->Dispatched)
+                    continue;
+                if (!drained && file->InFlight)
+                {
+                    // Leak the buffer rather than free it under a pending read, the job reports the file as failed.
+                    close(file->Fd);
+                    file->Fd   = -1;
+                    file->Data = nullptr;
+                }
+                DispatchLoaderFile(state, file);
+            }
+            return next;
+        }
+
+        unsigned       head = *ring.CqHead;
+        const unsigned tail = __atomic_load_n(ring.CqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe& cqe  = ring.Cqes[head & *ring.CqMask];
+            LoaderFile*         file = reinterpret_cast<LoaderFile*>((uintptr_t)cqe.user_data);
+            if (cqe.res > 0)
+            {
+                file->Offset += (size_t)cqe.res;
+                if (file->Offset < file->Size)
+                {
+                    IoUringQueueRead(&ring, file);
+                    continue;
+                }
+            }
+            else if (cqe.res == 0)
+                file->Size = file->Offset;
+            // On error, the job retries the rest with pread.
+            file->InFlight = false;
+            --in_flight;
+            DispatchLoaderFile(state, file);
+        }
+        __atomic_store_n(ring.CqHead, head, __ATOMIC_RELEASE);
+    }
+
+    IoUringDestroy(&ring);
+    return count;
+}
+
+#endif // IMMEDIA_IO_URING
+
+int LoadImages(const char* const* filenames, int count,
+               void (*callback)(const ImageLoadResult& result, void* user_data), void* user_data,
+               const ImageLoaderConfig& config)
+{
+    if (count <= 0)
+        return 0;
+
+    const int depth = config.QueueDepth > 0 ? config.QueueDepth : 1;
+    LoaderState state(config.WorkerCount);
+    state.Callback = callback;
+    state.UserData = user_data;
+
+    ImVector<LoaderFile> files;
+    files.resize(count);
+    memset(files.Data, 0, sizeof(LoaderFile) * (size_t)count);
+    for (int i = 0; i < count; ++i)
+    {
+        files[i].Index    = i;
+        files[i].Filename = filenames[i];
+        files[i].Fd       = -1;
+        files[i].State    = &state;
+    }
+
+    int next = 0;
+#ifdef IMMEDIA_IO_URING
+    if (config.UseIoUring)
+        next = LoadWithIoUring(&state, files.Data, count, depth);
+#endif
+    LoadWithPread(&state, files.Data, next, count, depth);
+
+    state.Pool.Wait();
+    return state.Loaded.load(std::memory_order_relaxed);
+}
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
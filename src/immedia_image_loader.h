@@ -0,0 +1,52 @@
+// Bulk loading of many image files, e.g. opening a folder.
+//
+// Reads are batched through io_uring on Linux, so the device queue is kept full instead of reading one file
+// at a time. Elsewhere, or if io_uring is not available, files are opened and hinted with posix_fadvise ahead of
+// worker threads reading them with pread. Each file is handed to a decoding worker as soon as it is read.
+//
+//     // Loading thread.
+//     ImMedia::LoadImages(paths, path_count, [](const ImMedia::ImageLoadResult& result, void* user_data) {
+//         // Worker thread, hand result.DecoderContext to the render thread,
+//         // which creates ImMedia::Image(result.DecoderContext, result.Decoder).
+//     }, nullptr);
+//
+// Define IMMEDIA_NO_IO_URING to always use pread.
+//
+
+#ifndef IMMEDIA_IMAGE_LOADER_H
+#define IMMEDIA_IMAGE_LOADER_H
+
+#include "immedia_image.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+namespace ImMedia {
+
+struct ImageLoadResult
+{
+    int                 Index;           // Index of file in filenames.
+    const char*         Filename;
+    const ImageDecoder* Decoder;         // [nullable] null if no decoder is found.
+    void*               DecoderContext;  // [nullable] null if the file can't be read or parsered, owned by callback.
+};
+
+struct ImageLoaderConfig
+{
+    int  QueueDepth  = 64;    // Reads in flight, also files read but not decoded yet.
+    int  WorkerCount = 0;     // Decoding threads, 0 to use the number of hardware threads.
+    bool UseIoUring  = true;  // Linux only, pread is used if it is disabled or not supported by kernel.
+};
+
+/// @brief Read files and create their decoder contexts, blocks until all are done. Thread-safe.
+///        The decoder is selected by signature, then by extension, "pack://" entries are read in place.
+/// @param callback Called once per file on worker threads, concurrently and in completion order.
+/// @return Number of decoder contexts created.
+int LoadImages(const char* const* filenames, int count,
+               void (*callback)(const ImageLoadResult& result, void* user_data), void* user_data,
+               const ImageLoaderConfig& config = ImageLoaderConfig());
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+#endif // !IMMEDIA_IMAGE_LOADER_H
@@ -0,0 +1,558 @@
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include "immedia_image_sequence.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "immedia_thread_pool.h"
+
+namespace ImMedia {
+
+enum SequenceSlotState
+{
+    SequenceSlotState_Idle,
+    SequenceSlotState_Busy,
+    SequenceSlotState_Ready,
+    SequenceSlotState_Failed
+};
+
+struct SequenceContext;
+
+struct SequenceSlot
+{
+    SequenceContext* Owner;
+    long long        Position;   // Playback position without wrapping, -1 if never used.
+    int              FrameIndex;
+    std::atomic<int> State;
+    uint8_t*         Pixels;
+};
+
+struct SequenceContext
+{
+    // Numbered files.
+    char*    Pattern;
+    int      FirstIndex;
+
+    // Motion-JPEG, frames are slices of Data.
+    uint8_t*            Data;
+    size_t              DataSize;
+    ImVector<size_t>    FrameOffsets;
+    ImVector<size_t>    FrameSizes;
+    const ImageDecoder* FrameDecoder;
+
+    int         FrameCount;
+    int         Width;
+    int         Height;
+    PixelFormat Format;
+    size_t      FrameSize;
+
+    ImageSequenceConfig Config;
+    double              FrameInterval; // In milliseconds.
+
+    SequenceSlot*     Slots;
+    int               SlotCount;
+    ThreadPool*       Pool;
+    std::atomic<bool> Stopping;
+
+    long long Position;
+    bool      Presented;
+    bool      Started;
+    std::chrono::steady_clock::time_point StartTime;
+};
+
+static void* CreateContextFromFile(void* f, size_t file_size);
+static void* CreateContextFromData(const uint8_t* data, size_t data_size);
+static void DeleteContext(void* context);
+
+static void GetInfo(void* context, int* width, int* height, PixelFormat* format, int* frame_count);
+
+static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms);
+static bool ReadNextFrame(void* context);
+static int GetLoopCount(void* context);
+
+static const ImageDecoder g_SequenceDecoder = {
+    CreateContextFromFile,
+    CreateContextFromData,
+    DeleteContext,
+    GetInfo,
+    ReadFrame,
+    ReadNextFrame,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    GetLoopCount
+};
+
+const ImageDecoder* GetImageSequenceDecoder()
+{
+    return &g_SequenceDecoder;
+}
+
+
+
+// Returns null if the size of file can't be told.
+static uint8_t* ReadWholeFile(FILE* f, size_t* file_size)
+{
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0)
+        return nullptr;
+    uint8_t* data = new uint8_t[size > 0 ? (size_t)size : 1];
+    *file_size = fread(data, 1, (size_t)size, f);
+    return data;
+}
+
+static void FormatFramePath(const char* pattern, int index, ImVector<char>& path)
+{
+    path.resize(snprintf(nullptr, 0, pattern, index) + 1);
+    snprintf(path.Data, (size_t)path.Size, pattern, index);
+}
+
+// Create decoder context of a single frame, returns null if it can't be decoded.
+static void* OpenFrame(const SequenceContext* ctx, int frame_index, const ImageDecoder** decoder)
+{
+    if (ctx->Pattern)
+    {
+        ImVector<char> path;
+        FormatFramePath(ctx->Pattern, ctx->FirstIndex + frame_index, path);
+        *decoder = GetFileDecoder(path.Data);
+        return CreateDecoderContext(path.Data, *decoder);
+    }
+
+    *decoder = ctx->FrameDecoder;
+    return ctx->FrameDecoder->CreateContextFromData(ctx->Data + ctx->FrameOffsets[frame_index], ctx->FrameSizes[frame_index]);
+}
+
+static bool DecodeFrame(const SequenceContext* ctx, int frame_index, uint8_t* out)
+{
+    const ImageDecoder* decoder;
+    void* frame = OpenFrame(ctx, frame_index, &decoder);
+    if (!frame)
+        return false;
+
+    int         width, height, frame_count;
+    PixelFormat format;
+    decoder->GetInfo(frame, &width, &height, &format, &frame_count);
+
+    uint8_t* pixels = nullptr;
+    int      delay;
+    bool ok = width == ctx->Width && height == ctx->Height && format == ctx->Format
+           && ReadFinalFrame(frame, decoder, &pixels, &delay);
+    if (ok)
+        memcpy(out, pixels, ctx->FrameSize);
+    decoder->DeleteContext(frame);
+    return ok;
+}
+
+static void DecodeJob(void* user_data)
+{
+    SequenceSlot* slot = reinterpret_cast<SequenceSlot*>(user_data);
+    if (slot->Owner->Stopping.load(std::memory_order_relaxed))
+    {
+        slot->State.store(SequenceSlotState_Idle, std::memory_order_release);
+        return;
+    }
+    bool ok = DecodeFrame(slot->Owner, slot->FrameIndex, slot->Pixels);
+    slot->State.store(ok ? SequenceSlotState_Ready : SequenceSlotState_Failed, std::memory_order_release);
+}
+
+// Queue decoding of frames from current position to the end of read-ahead window.
+static void Schedule(SequenceContext* ctx)
+{
+    for (long long p = ctx->Position; p < ctx->Position + ctx->SlotCount; ++p)
+    {
+        if (!ctx->Config.Loop && p >= ctx->FrameCount)
+            break;
+
+        SequenceSlot& slot = ctx->Slots[p % ctx->SlotCount];
+        int state = slot.State.load(std::memory_order_acquire);
+        if (state == SequenceSlotState_Busy || (slot.Position == p && state != SequenceSlotState_Idle))
+            continue;
+
+        slot.Position   = p;
+        slot.FrameIndex = (int)(p % ctx->FrameCount);
+        slot.State.store(SequenceSlotState_Busy, std::memory_order_relaxed);
+        ctx->Pool->Submit(DecodeJob, &slot);
+    }
+}
+
+static double GetElapsedTime(const SequenceContext* ctx)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - ctx->StartTime;
+    return elapsed.count();
+}
+
+static SequenceContext* CreateSequence(SequenceContext* ctx, const ImageSequenceConfig& config, float stored_frame_rate)
+{
+    ctx->Config = config;
+    float frame_rate = config.FrameRate > 0.0f ? config.FrameRate : stored_frame_rate > 0.0f ? stored_frame_rate : 30.0f;
+    ctx->FrameInterval = 1000.0 / frame_rate;
+
+    const ImageDecoder* decoder;
+    void* first = ctx->FrameCount > 0 ? OpenFrame(ctx, 0, &decoder) : nullptr;
+    if (!first)
+    {
+        DeleteContext(ctx);
+        return nullptr;
+    }
+
+    int frame_count;
+    decoder->GetInfo(first, &ctx->Width, &ctx->Height, &ctx->Format, &frame_count);
+    ctx->FrameSize = (size_t)ctx->Width * ctx->Height * PIXEL_FORMAT_SIZE(ctx->Format);
+
+    ctx->SlotCount = (config.ReadAhead > 1 ? config.ReadAhead : 1) + 1;
+    ctx->Slots = new SequenceSlot[ctx->SlotCount];
+    for (int i = 0; i < ctx->SlotCount; ++i)
+    {
+        SequenceSlot& slot = ctx->Slots[i];
+        slot.Owner      = ctx;
+        slot.Position   = -1;
+        slot.FrameIndex = -1;
+        slot.Pixels     = new uint8_t[ctx->FrameSize];
+        slot.State.store(SequenceSlotState_Idle);
+    }
+
+    // The first frame is decoded on caller thread since its info is needed anyway.
+    uint8_t* pixels = nullptr;
+    int      delay;
+    if (ReadFinalFrame(first, decoder, &pixels, &delay))
+    {
+        memcpy(ctx->Slots[0].Pixels, pixels, ctx->FrameSize);
+        ctx->Slots[0].Position   = 0;
+        ctx->Slots[0].FrameIndex = 0;
+        ctx->Slots[0].State.store(SequenceSlotState_Ready);
+    }
+    decoder->DeleteContext(first);
+    if (!pixels)
+    {
+        DeleteContext(ctx);
+        return nullptr;
+    }
+
+    ctx->Pool = new ThreadPool(config.WorkerCount);
+    Schedule(ctx);
+    return ctx;
+}
+
+static SequenceContext* NewSequenceContext()
+{
+    SequenceContext* ctx = new SequenceContext();
+    ctx->Pattern      = nullptr;
+    ctx->FirstIndex   = 0;
+    ctx->Data         = nullptr;
+    ctx->DataSize     = 0;
+    ctx->FrameDecoder = nullptr;
+    ctx->FrameCount   = 0;
+    ctx->Slots        = nullptr;
+    ctx->SlotCount    = 0;
+    ctx->Pool         = nullptr;
+    ctx->Position     = 0;
+    ctx->Presented    = false;
+    ctx->Started      = false;
+    ctx->Stopping.store(false);
+    return ctx;
+}
+
+
+
+static uint32_t ReadLE32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Walk RIFF chunks, collect '##dc' compressed video chunks and frame duration from 'avih'.
+// '##db' chunks are uncompressed DIB frames, and '##dc' of other codecs than MJPG are not JPEG either.
+static void ParseAVIChunks(SequenceContext* ctx, size_t begin, size_t end, uint32_t* us_per_frame, bool* mjpeg)
+{
+    const uint8_t* data = ctx->Data;
+    size_t p = begin;
+    while (p + 8 <= end)
+    {
+        const uint8_t* id = data + p;
+        size_t body = p + 8;
+        size_t size = ReadLE32(data + p + 4);
+        if (size > end - body)
+            size = end - body;
+
+        if (memcmp(id, "LIST", 4) == 0 && size >= 4)
+            ParseAVIChunks(ctx, body + 4, body + size, us_per_frame, mjpeg);
+        else if (memcmp(id, "avih", 4) == 0 && size >= 4)
+            *us_per_frame = ReadLE32(data + body);
+        else if (memcmp(id, "strh", 4) == 0 && size >= 8 && memcmp(data + body, "vids", 4) == 0)
+        {
+            // Handler is 'MJPG', some writers use lowercase.
+            const uint8_t* handler = data + body + 4;
+            *mjpeg = (handler[0] | 0x20) == 'm' && (handler[1] | 0x20) == 'j' && (handler[2] | 0x20) == 'p' && (handler[3] | 0x20) == 'g';
+        }
+        else if (id[2] == 'd' && id[3] == 'c' && size > 0 && *mjpeg)
+        {
+            ctx->FrameOffsets.push_back(body);
+            ctx->FrameSizes.push_back(size);
+        }
+        p = body + size + (size & 1);
+    }
+}
+
+// Find the end of the JPEG starting at SOI, returns 0 if it's truncated.
+static size_t FindJPEGEnd(const uint8_t* data, size_t start, size_t size)
+{
+    size_t p = start + 2;
+    while (p < size)
+    {
+        if (data[p] != 0xFF)
+            return 0;
+        while (p < size && data[p] == 0xFF)
+            ++p;
+        if (p >= size)
+            return 0;
+
+        uint8_t marker = data[p++];
+        if (marker == 0xD9)
+            return p;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue;
+        if (p + 2 > size)
+            return 0;
+
+        size_t length = ((size_t)data[p] << 8) | data[p + 1];
+        p += length;
+        if (marker != 0xDA)
+            continue;
+
+        // Entropy coded data ends at the first marker which is neither stuffed byte nor RST.
+        while (p + 1 < size)
+        {
+            if (data[p] == 0xFF && data[p + 1] != 0x00 && !(data[p + 1] >= 0xD0 && data[p + 1] <= 0xD7))
+                break;
+            ++p;
+        }
+    }
+    return 0;
+}
+
+static void ParseMJPEG(SequenceContext* ctx)
+{
+    const uint8_t* data = ctx->Data;
+    const size_t   size = ctx->DataSize;
+    size_t p = 0;
+    while (p + 4 <= size)
+    {
+        if (data[p] != 0xFF || data[p + 1] != 0xD8)
+        {
+            ++p;
+            continue;
+        }
+        size_t end = FindJPEGEnd(data, p, size);
+        if (end == 0)
+            break;
+        ctx->FrameOffsets.push_back(p);
+        ctx->FrameSizes.push_back(end - p);
+        p = end;
+    }
+}
+
+static SequenceContext* CreateMJPEG(uint8_t* data, size_t data_size, const ImageSequenceConfig& config)
+{
+    SequenceContext* ctx = NewSequenceContext();
+    ctx->Data         = data;
+    ctx->DataSize     = data_size;
+    ctx->FrameDecoder = GetImageDecoder("jpg");
+
+    uint32_t us_per_frame = 0;
+    bool     mjpeg        = false;
+    if (data_size >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "AVI ", 4) == 0)
+        ParseAVIChunks(ctx, 12, data_size, &us_per_frame, &mjpeg);
+    else
+        ParseMJPEG(ctx);
+    ctx->FrameCount = ctx->FrameOffsets.Size;
+
+    if (!ctx->FrameDecoder)
+        ctx->FrameCount = 0;
+
+    return CreateSequence(ctx, config, us_per_frame > 0 ? 1000000.0f / us_per_frame : 0.0f);
+}
+
+
+
+void* CreateImageSequence(const char* pattern, int first_index, int frame_count, const ImageSequenceConfig& config)
+{
+    if (!pattern)
+        return nullptr;
+
+    SequenceContext* ctx = NewSequenceContext();
+    size_t length = strlen(pattern);
+    ctx->Pattern = new char[length + 1];
+    memcpy(ctx->Pattern, pattern, length + 1);
+    ctx->FirstIndex = first_index;
+
+    if (frame_count <= 0)
+    {
+        ImVector<char> path;
+        frame_count = 0;
+        while (true)
+        {
+            FormatFramePath(pattern, first_index + frame_count, path);
+            FILE* f = fopen(path.Data, "rb");
+            if (!f)
+                break;
+            fclose(f);
+            ++frame_count;
+        }
+    }
+    ctx->FrameCount = frame_count;
+
+    return CreateSequence(ctx, config, 0.0f);
+}
+
+void* CreateMJPEGSequence(const char* filename, const ImageSequenceConfig& config)
+{
+    if (!filename)
+        return nullptr;
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return nullptr;
+    size_t data_size;
+    uint8_t* data = ReadWholeFile(f, &data_size);
+    fclose(f);
+    if (!data)
+        return nullptr;
+    return CreateMJPEG(data, data_size, config);
+}
+
+static void* CreateContextFromFile(void* f, size_t file_size)
+{
+    FILE* fp = reinterpret_cast<FILE*>(f);
+    uint8_t* data = new uint8_t[file_size > 0 ? file_size : 1];
+    file_size = fread(data, 1, file_size, fp);
+    fclose(fp);
+    return CreateMJPEG(data, file_size, ImageSequenceConfig());
+}
+
+static void* CreateContextFromData(const uint8_t* data, size_t data_size)
+{
+    uint8_t* copy = new uint8_t[data_size > 0 ? data_size : 1];
+    memcpy(copy, data, data_size);
+    return CreateMJPEG(copy, data_size, ImageSequenceConfig());
+}
+
+static void DeleteContext(void* context)
+{
+    SequenceContext* ctx = reinterpret_cast<SequenceContext*>(context);
+    ctx->Stopping.store(true);
+    delete ctx->Pool;
+    if (ctx->Slots)
+    {
+        for (int i = 0; i < ctx->SlotCount; ++i)
+            delete[] ctx->Slots[i].Pixels;
+        delete[] ctx->Slots;
+    }
+    delete[] ctx->Pattern;
+    delete[] ctx->Data;
+    delete ctx;
+}
+
+static void GetInfo(void* context, int* width, int* height, PixelFormat* format, int* frame_count)
+{
+    SequenceContext* ctx = reinterpret_cast<SequenceContext*>(context);
+    if (width)
+        *width = ctx->Width;
+    if (height)
+        *height = ctx->Height;
+    if (format)
+        *format = ctx->Format;
+    if (frame_count)
+        *frame_count = ctx->FrameCount > 1 ? ctx->FrameCount : 0;
+}
+
+static bool ReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
+{
+    SequenceContext* ctx = reinterpret_cast<SequenceContext*>(context);
+
+    SequenceSlot& slot = ctx->Slots[ctx->Position % ctx->SlotCount];
+    int state = slot.State.load(std::memory_order_acquire);
+
+    *pixels = nullptr;
+    *delay_in_ms = 0;
+
+    if (slot.Position != ctx->Position || state == SequenceSlotState_Busy || state == SequenceSlotState_Idle)
+    {
+        // Not decoded yet, poll again next frame.
+        Schedule(ctx);
+        return true;
+    }
+
+    if (state == SequenceSlotState_Failed)
+    {
+        // Skip broken frame.
+        if (!ctx->Config.Loop && ctx->Position + 1 >= ctx->FrameCount)
+            return false;
+        ++ctx->Position;
+        Schedule(ctx);
+        return true;
+    }
+
+    const double due = ctx->Position * ctx->FrameInterval;
+    if (!ctx->Started)
+    {
+        ctx->StartTime = std::chrono::steady_clock::now() - std::chrono::microseconds((long long)(due * 1000));
+        ctx->Started   = true;
+    }
+    else if (!ctx->Config.DropFrames && GetElapsedTime(ctx) > due)
+    {
+        // Frame is late, shift the clock instead of skipping frames.
+        ctx->StartTime = std::chrono::steady_clock::now() - std::chrono::microseconds((long long)(due * 1000));
+    }
+
+    double delay = (ctx->Position + 1) * ctx->FrameInterval - GetElapsedTime(ctx);
+    *pixels      = slot.Pixels;
+    *delay_in_ms = delay > 0.0 ? (int)delay : 0;
+    ctx->Presented = true;
+    return true;
+}
+
+static bool ReadNextFrame(void* context)
+{
+    SequenceContext* ctx = reinterpret_cast<SequenceContext*>(context);
+
+    if (ctx->FrameCount <= 1)
+        return false;
+    if (!ctx->Presented)
+        return true;
+    ctx->Presented = false;
+
+    long long next = ctx->Position + 1;
+    if (ctx->Config.DropFrames && ctx->Started)
+    {
+        long long due = (long long)(GetElapsedTime(ctx) / ctx->FrameInterval);
+        if (due > next)
+            next = due;
+    }
+    if (!ctx->Config.Loop && next >= ctx->FrameCount)
+        return false;
+
+    ctx->Position = next;
+    Schedule(ctx);
+    return true;
+}
+
+// Frames are dropped to keep up with the clock and broken ones are skipped, so loops differ.
+static int GetLoopCount(void*)
+{
+    return -1;
+}
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
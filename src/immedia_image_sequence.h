@@ -0,0 +1,53 @@
+// Image sequence source for numbered frame files and Motion-JPEG.
+//
+// Frames are decoded ahead of time by the installed decoders on worker threads,
+// the sequence itself is an ImageDecoder so it plays through ImMedia::Image:
+//
+//     ImMedia::ImageSequenceConfig config;
+//     config.FrameRate = 24.0f;
+//     ImMedia::Image video(ImMedia::CreateImageSequence("frames/%04d.png", 1, 0, config),
+//                          ImMedia::GetImageSequenceDecoder());
+//
+// Motion-JPEG files (concatenated JPEG or AVI) can be installed as a format too:
+//
+//     ImMedia::InstallImageDecoder("avi", *ImMedia::GetImageSequenceDecoder());
+//
+
+#ifndef IMMEDIA_IMAGE_SEQUENCE_H
+#define IMMEDIA_IMAGE_SEQUENCE_H
+
+#include "immedia_image.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+namespace ImMedia {
+
+struct ImageSequenceConfig
+{
+    float FrameRate   = 0.0f;  // Frames per second, 0 to use the rate stored in AVI or 30.
+    int   ReadAhead   = 8;     // Number of frames decoded ahead.
+    int   WorkerCount = 0;     // Decoding threads, 0 to use the number of hardware threads.
+    bool  DropFrames  = true;  // Skip frames which are late, instead of slowing down playback.
+    bool  Loop        = true;
+};
+
+/// @brief Create sequence from numbered files.
+/// @param pattern printf style pattern with a single int conversion, e.g. "frames/%04d.png".
+/// @param first_index Index of the first frame.
+/// @param frame_count Number of frames, 0 to count existing files from first_index.
+/// @return [nullable] Decoder context for @ref GetImageSequenceDecoder, null if the first frame can't be decoded.
+void* CreateImageSequence(const char* pattern, int first_index, int frame_count, const ImageSequenceConfig& config = ImageSequenceConfig());
+
+/// @brief Create sequence from a Motion-JPEG file, either concatenated JPEG or AVI with MJPEG stream.
+/// @return [nullable] Decoder context for @ref GetImageSequenceDecoder, null if the file has no decodable frame.
+void* CreateMJPEGSequence(const char* filename, const ImageSequenceConfig& config = ImageSequenceConfig());
+
+/// @brief Decoder of sequence contexts.
+///        Its CreateContextFromFile and CreateContextFromData read Motion-JPEG with default config.
+const ImageDecoder* GetImageSequenceDecoder();
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+#endif // !IMMEDIA_IMAGE_SEQUENCE_H
@@ -0,0 +1,627 @@
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include "immedia_pack.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "immedia_pixel_convert.h"
+
+namespace ImMedia {
+
+static_assert(sizeof(PackHeader) == 32, "PackHeader is read in place");
+static_assert(sizeof(PackEntry) == 64, "PackEntry is read in place");
+static_assert(sizeof(PackPixelsHeader) == 16, "PackPixelsHeader is read in place");
+
+#define PACK_DATA_ALIGNMENT 16
+
+uint32_t HashPackName(const char* name, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+
+// Owned by the mount list and by each open entry source, unmapped when the last one is released.
+struct Pack
+{
+    char*            Filename;
+    const uint8_t*   Data;
+    size_t           Size;
+    const PackEntry* Entries;
+    const uint32_t*  Buckets;
+    uint32_t         EntryCount;
+    uint32_t         BucketMask;
+    std::atomic<int> RefCount;
+};
+
+struct PackEntryStream
+{
+    Pack*          Owner;
+    const uint8_t* Data;
+    size_t         Size;
+    size_t         Offset;
+};
+
+static std::mutex     g_pack_mutex;
+static ImVector<Pack*> g_packs;
+
+static const uint8_t* MapFile(const char* filename, size_t* size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+    LARGE_INTEGER file_size;
+    const uint8_t* data = nullptr;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+            *size = (size_t)file_size.QuadPart;
+        }
+    }
+    CloseHandle(file);
+    return data;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    const uint8_t* data = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            data  = (const uint8_t*)p;
+            *size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+#endif
+}
+
+static void UnmapFile(const uint8_t* data, size_t size)
+{
+#ifdef _WIN32
+    IM_UNUSED(size);
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+static bool IsRangeValid(uint64_t offset, uint64_t size, size_t file_size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+// Checked once at mount, so lookups and entry sources don't need bounds checks.
+static bool ValidatePack(const uint8_t* data, size_t size)
+{
+    if (size < sizeof(PackHeader))
+        return false;
+    const PackHeader* header = (const PackHeader*)data;
+    if (memcmp(header->Magic, "IMPK", 4) != 0 || header->Version != IMMEDIA_PACK_VERSION)
+        return false;
+    if (header->BucketCount == 0 || (header->BucketCount & (header->BucketCount - 1)) != 0
+        || header->BucketCount <= header->EntryCount)
+        return false;
+    if (header->EntriesOffset % alignof(PackEntry) != 0 || header->BucketsOffset % alignof(uint32_t) != 0)
+        return false;
+    if (!IsRangeValid(header->EntriesOffset, (uint64_t)header->EntryCount * sizeof(PackEntry), size)
+        || !IsRangeValid(header->BucketsOffset, (uint64_t)header->BucketCount * sizeof(uint32_t), size))
+        return false;
+
+    const PackEntry* entries = (const PackEntry*)(data + header->EntriesOffset);
+    for (uint32_t i = 0; i < header->EntryCount; ++i)
+    {
+        const PackEntry& entry = entries[i];
+        if (!IsRangeValid(entry.NameOffset, (uint64_t)entry.NameSize + 1, size)
+            || !IsRangeValid(entry.DataOffset, entry.DataSize, size))
+            return false;
+        if (data[entry.NameOffset + entry.NameSize] != '\0' || entry.FileFormat[sizeof(entry.FileFormat) - 1] != '\0')
+            return false;
+    }
+
+    // An empty bucket ends every probe sequence.
+    const uint32_t* buckets = (const uint32_t*)(data + header->BucketsOffset);
+    bool has_empty_bucket = false;
+    for (uint32_t i = 0; i < header->BucketCount; ++i)
+    {
+        if (buckets[i] > header->EntryCount)
+            return false;
+        has_empty_bucket |= buckets[i] == 0;
+    }
+    return has_empty_bucket;
+}
+
+static void ReleasePack(Pack* pack)
+{
+    if (pack->RefCount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    UnmapFile(pack->Data, pack->Size);
+    delete[] pack->Filename;
+    delete pack;
+}
+
+static const PackEntry* FindEntry(const Pack* pack, const char* name, size_t name_size, uint32_t hash)
+{
+    for (uint32_t i = hash & pack->BucketMask; ; i = (i + 1) & pack->BucketMask)
+    {
+        uint32_t index = pack->Buckets[i];
+        if (index == 0)
+            return nullptr;
+        const PackEntry* entry = &pack->Entries[index - 1];
+        if (entry->NameHash == hash && entry->NameSize == name_size
+            && memcmp(pack->Data + entry->NameOffset, name, name_size) == 0)
+            return entry;
+    }
+}
+
+static const char* StripPackPrefix(const char* name)
+{
+    return IsPackPath(name) ? name + sizeof(IMMEDIA_PACK_PREFIX) - 1 : name;
+}
+
+// Must be called with g_pack_mutex locked.
+static const PackEntry* FindEntry(const char* name, Pack** owner)
+{
+    name = StripPackPrefix(name);
+    const size_t   name_size = strlen(name);
+    const uint32_t hash      = HashPackName(name, name_size);
+    for (int i = g_packs.Size - 1; i >= 0; --i)
+    {
+        if (const PackEntry* entry = FindEntry(g_packs[i], name, name_size, hash))
+        {
+            if (owner)
+                *owner = g_packs[i];
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+bool MountPack(const char* filename)
+{
+    size_t size = 0;
+    const uint8_t* data = MapFile(filename, &size);
+    if (!data)
+        return false;
+    if (!ValidatePack(data, size))
+    {
+        UnmapFile(data, size);
+        return false;
+    }
+
+    const PackHeader* header = (const PackHeader*)data;
+    Pack* pack = new Pack();
+    pack->Filename   = new char[strlen(filename) + 1];
+    strcpy(pack->Filename, filename);
+    pack->Data       = data;
+    pack->Size       = size;
+    pack->Entries    = (const PackEntry*)(data + header->EntriesOffset);
+    pack->Buckets    = (const uint32_t*)(data + header->BucketsOffset);
+    pack->EntryCount = header->EntryCount;
+    pack->BucketMask = header->BucketCount - 1;
+    pack->RefCount.store(1);
+
+    std::lock_guard<std::mutex> lock(g_pack_mutex);
+    g_packs.push_back(pack);
+    return true;
+}
+
+void UnmountPack(const char* filename)
+{
+    Pack* pack = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(g_pack_mutex);
+        for (int i = g_packs.Size - 1; i >= 0; --i)
+            if (strcmp(g_packs[i]->Filename, filename) == 0)
+            {
+                pack = g_packs[i];
+                g_packs.erase(g_packs.begin() + i);
+                break;
+            }
+    }
+    if (pack)
+        ReleasePack(pack);
+}
+
+void UnmountAllPacks()
+{
+    ImVector<Pack*> packs;
+    {
+        std::lock_guard<std::mutex> lock(g_pack_mutex);
+        packs.swap(g_packs);
+    }
+    for (int i = 0; i < packs.Size; ++i)
+        ReleasePack(packs[i]);
+}
+
+bool IsPackPath(const char* filename)
+{
+    return strncmp(filename, IMMEDIA_PACK_PREFIX, sizeof(IMMEDIA_PACK_PREFIX) - 1) == 0;
+}
+
+bool GetPackEntryInfo(const char* name, PackEntryInfo* info)
+{
+    std::lock_guard<std::mutex> lock(g_pack_mutex);
+    const PackEntry* entry = FindEntry(name, nullptr);
+    if (!entry)
+        return false;
+    info->FileFormat = entry->FileFormat;
+    info->Encoding   = (PackEncoding)entry->Encoding;
+    info->Width      = entry->Width;
+    info->Height     = entry->Height;
+    info->Format     = (PixelFormat)entry->Format;
+    info->FrameCount = entry->FrameCount;
+    info->DataSize   = (size_t)entry->DataSize;
+    return true;
+}
+
+static size_t PackEntryStreamRead(void* user_data, uint8_t* buffer, size_t size)
+{
+    PackEntryStream* stream = reinterpret_cast<PackEntryStream*>(user_data);
+    const size_t remaining = stream->Size - stream->Offset;
+    const size_t n = size < remaining ? size : remaining;
+    memcpy(buffer, stream->Data + stream->Offset, n);
+    stream->Offset += n;
+    return n;
+}
+
+static bool PackEntryStreamSkip(void* user_data, size_t size)
+{
+    PackEntryStream* stream = reinterpret_cast<PackEntryStream*>(user_data);
+    if (size > stream->Size - stream->Offset)
+    {
+        stream->Offset = stream->Size;
+        return false;
+    }
+    stream->Offset += size;
+    return true;
+}
+
+static size_t PackEntryStreamGetSize(void* user_data)
+{
+    return reinterpret_cast<PackEntryStream*>(user_data)->Size;
+}
+
+static const uint8_t* PackEntryStreamMap(void* user_data, size_t* size)
+{
+    PackEntryStream* stream = reinterpret_cast<PackEntryStream*>(user_data);
+    *size = stream->Size;
+    return stream->Data;
+}
+
+static void PackEntryStreamClose(void* user_data)
+{
+    PackEntryStream* stream = reinterpret_cast<PackEntryStream*>(user_data);
+    ReleasePack(stream->Owner);
+    delete stream;
+}
+
+bool OpenPackEntry(const char* name, ImageSource* source)
+{
+    std::lock_guard<std::mutex> lock(g_pack_mutex);
+    Pack* pack = nullptr;
+    const PackEntry* entry = FindEntry(name, &pack);
+    if (!entry)
+        return false;
+
+    pack->RefCount.fetch_add(1, std::memory_order_relaxed);
+    PackEntryStream* stream = new PackEntryStream{ pack, pack->Data + entry->DataOffset, (size_t)entry->DataSize, 0 };
+    *source = {
+        PackEntryStreamRead,
+        PackEntryStreamSkip,
+        PackEntryStreamGetSize,
+        PackEntryStreamMap,
+        PackEntryStreamClose,
+        stream
+    };
+    return true;
+}
+
+const ImageDecoder* GetPackEntryDecoder(const char* name)
+{
+    PackEntryInfo info;
+    if (!GetPackEntryInfo(name, &info))
+        return nullptr;
+    switch (info.Encoding)
+    {
+    case PackEncoding::Original: return GetImageDecoder(info.FileFormat);
+    case PackEncoding::QOI:      return GetImageDecoder("qoi");
+    case PackEncoding::Pixels:   return GetPackPixelsDecoder();
+    }
+    return nullptr;
+}
+
+
+
+struct PackPixelsContext
+{
+    PackPixelsHeader  Header;
+    const uint8_t*    Pixels;
+    ImageSource       Source;   // Kept open while pixels are read in place.
+    bool              SourceOpen;
+    ImVector<uint8_t> Storage;
+};
+
+static bool IsPixelsDataValid(const uint8_t* data, size_t size)
+{
+    if (size < sizeof(PackPixelsHeader))
+        return false;
+    const PackPixelsHeader* header = (const PackPixelsHeader*)data;
+    if (memcmp(header->Magic, "IMPX", 4) != 0 || header->Width <= 0 || header->Height <= 0)
+        return false;
+    const PixelFormat format = (PixelFormat)header->Format;
+    if (format != PixelFormat::RGB888 && format != PixelFormat::RGBA8888)
+        return false;
+    return (size - sizeof(PackPixelsHeader)) / PIXEL_FORMAT_SIZE(format) / header->Width >= (size_t)header->Height;
+}
+
+static void* PixelsCreateContextFromData(const uint8_t* data, size_t data_size)
+{
+    if (!IsPixelsDataValid(data, data_size))
+        return nullptr;
+    PackPixelsContext* ctx = new PackPixelsContext();
+    memcpy(&ctx->Header, data, sizeof(PackPixelsHeader));
+    ctx->Storage.resize((int)(data_size - sizeof(PackPixelsHeader)));
+    memcpy(ctx->Storage.Data, data + sizeof(PackPixelsHeader), ctx->Storage.Size);
+    ctx->Pixels     = ctx->Storage.Data;
+    ctx->SourceOpen = false;
+    return ctx;
+}
+
+static void* PixelsCreateContextFromSource(const ImageSource& source)
+{
+    size_t         mapped_size = 0;
+    const uint8_t* mapped      = source.Map ? source.Map(source.UserData, &mapped_size) : nullptr;
+    if (!mapped)
+    {
+        ImVector<uint8_t> data;
+        ReadImageSourceToEnd(source, data);
+        CloseImageSource(source);
+        return PixelsCreateContextFromData(data.Data, data.Size);
+    }
+    if (!IsPixelsDataValid(mapped, mapped_size))
+    {
+        CloseImageSource(source);
+        return nullptr;
+    }
+
+    PackPixelsContext* ctx = new PackPixelsContext();
+    memcpy(&ctx->Header, mapped, sizeof(PackPixelsHeader));
+    ctx->Pixels     = mapped + sizeof(PackPixelsHeader);
+    ctx->Source     = source;
+    ctx->SourceOpen = true;
+    return ctx;
+}
+
+static void PixelsDeleteContext(void* context)
+{
+    PackPixelsContext* ctx = reinterpret_cast<PackPixelsContext*>(context);
+    if (ctx->SourceOpen)
+        CloseImageSource(ctx->Source);
+    delete ctx;
+}
+
+static void PixelsGetInfo(void* context, int* width, int* height, PixelFormat* format, int* frame_count)
+{
+    const PackPixelsHeader& header = reinterpret_cast<PackPixelsContext*>(context)->Header;
+    if (width)
+        *width = header.Width;
+    if (height)
+        *height = header.Height;
+    if (format)
+        *format = (PixelFormat)header.Format;
+    if (frame_count)
+        *frame_count = 0;
+}
+
+static bool PixelsReadFrame(void* context, uint8_t** pixels, int* delay_in_ms)
+{
+    // Renderers only read frame pixels, mapped memory is never written.
+    *pixels      = const_cast<uint8_t*>(reinterpret_cast<PackPixelsContext*>(context)->Pixels);
+    *delay_in_ms = 0;
+    return true;
+}
+
+const ImageDecoder* GetPackPixelsDecoder()
+{
+    static const ImageDecoder decoder = {
+        nullptr,
+        PixelsCreateContextFromData,
+        PixelsDeleteContext,
+        PixelsGetInfo,
+        PixelsReadFrame,
+        nullptr,
+        nullptr,
+        PixelsCreateContextFromSource,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr
+    };
+    return &decoder;
+}
+
+
+
+struct PackWriterEntry
+{
+    char*     Name;
+    size_t    NameSize;
+    PackEntry Entry;
+    uint8_t*  Data;
+};
+
+static void DeleteWriterEntry(PackWriterEntry* entry)
+{
+    delete[] entry->Name;
+    delete[] entry->Data;
+    delete entry;
+}
+
+PackWriter::~PackWriter()
+{
+    for (int i = 0; i < Entries.Size; ++i)
+        DeleteWriterEntry(Entries[i]);
+}
+
+void PackWriter::AddEntry(const char* name, const PackEntryInfo& info, const uint8_t* data, size_t data_size)
+{
+    PackWriterEntry* entry = new PackWriterEntry();
+    entry->NameSize = strlen(name);
+    entry->Name     = new char[entry->NameSize + 1];
+    memcpy(entry->Name, name, entry->NameSize + 1);
+    entry->Data     = new uint8_t[data_size > 0 ? data_size : 1];
+    memcpy(entry->Data, data, data_size);
+
+    PackEntry& e = entry->Entry;
+    memset(&e, 0, sizeof(e));
+    e.DataSize   = data_size;
+    e.NameSize   = (uint32_t)entry->NameSize;
+    e.NameHash   = HashPackName(name, entry->NameSize);
+    e.Encoding   = (uint32_t)info.Encoding;
+    e.Width      = info.Width;
+    e.Height     = info.Height;
+    e.Format     = (int32_t)info.Format;
+    e.FrameCount = info.FrameCount;
+    if (info.FileFormat)
+        strncpy(e.FileFormat, info.FileFormat, sizeof(e.FileFormat) - 1);
+
+    for (int i = 0; i < Entries.Size; ++i)
+        if (Entries[i]->NameSize == entry->NameSize && memcmp(Entries[i]->Name, name, entry->NameSize) == 0)
+        {
+            DeleteWriterEntry(Entries[i]);
+            Entries[i] = entry;
+            return;
+        }
+    Entries.push_back(entry);
+}
+
+void PackWriter::AddPixels(const char* name, const char* file_format, int width, int height, PixelFormat format,
+                           const uint8_t* pixels, int stride)
+{
+    const size_t row_size = (size_t)width * PIXEL_FORMAT_SIZE(format);
+    ImVector<uint8_t> data;
+    data.resize((int)(sizeof(PackPixelsHeader) + row_size * height));
+
+    PackPixelsHeader header = { { 'I', 'M', 'P', 'X' }, width, height, (int32_t)format };
+    memcpy(data.Data, &header, sizeof(header));
+    CopyRows(pixels, stride == 0 ? (int)row_size : stride, data.Data + sizeof(header), (int)row_size, row_size, height);
+
+    PackEntryInfo info = { file_format, PackEncoding::Pixels, width, height, format, 0, 0 };
+    AddEntry(name, info, data.Data, (size_t)data.Size);
+}
+
+int PackWriter::GetEntryCount() const
+{
+    return Entries.Size;
+}
+
+static size_t AlignPackOffset(size_t offset)
+{
+    return (offset + PACK_DATA_ALIGNMENT - 1) & ~(size_t)(PACK_DATA_ALIGNMENT - 1);
+}
+
+bool PackWriter::Write(const char* filename) const
+{
+    // Keep load factor at most 1/2, so probe sequences stay short.
+    uint32_t bucket_count = 2;
+    while (bucket_count < (uint32_t)Entries.Size * 2)
+        bucket_count *= 2;
+
+    PackHeader header = {};
+    memcpy(header.Magic, "IMPK", 4);
+    header.Version       = IMMEDIA_PACK_VERSION;
+    header.EntryCount    = (uint32_t)Entries.Size;
+    header.BucketCount   = bucket_count;
+    header.EntriesOffset = sizeof(PackHeader);
+    header.BucketsOffset = header.EntriesOffset + (uint64_t)Entries.Size * sizeof(PackEntry);
+
+    ImVector<PackEntry> entries;
+    entries.resize(Entries.Size);
+    ImVector<uint32_t> buckets;
+    buckets.resize((int)bucket_count);
+    memset(buckets.Data, 0, (size_t)buckets.size_in_bytes());
+
+    size_t offset = (size_t)header.BucketsOffset + (size_t)buckets.size_in_bytes();
+    for (int i = 0; i < Entries.Size; ++i)
+    {
+        entries[i] = Entries[i]->Entry;
+        entries[i].NameOffset = offset;
+        offset += Entries[i]->NameSize + 1;
+
+        uint32_t bucket = entries[i].NameHash & (bucket_count - 1);
+        while (buckets[bucket] != 0)
+            bucket = (bucket + 1) & (bucket_count - 1);
+        buckets[bucket] = (uint32_t)i + 1;
+    }
+    const size_t names_end = offset;
+    for (int i = 0; i < Entries.Size; ++i)
+    {
+        offset = AlignPackOffset(offset);
+        entries[i].DataOffset = offset;
+        offset += (size_t)entries[i].DataSize;
+    }
+
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && (entries.empty() || fwrite(entries.Data, (size_t)entries.size_in_bytes(), 1, f) == 1);
+    ok = ok && fwrite(buckets.Data, (size_t)buckets.size_in_bytes(), 1, f) == 1;
+    for (int i = 0; ok && i < Entries.Size; ++i)
+        ok = fwrite(Entries[i]->Name, Entries[i]->NameSize + 1, 1, f) == 1;
+
+    static const uint8_t padding[PACK_DATA_ALIGNMENT] = {};
+    size_t written = names_end;
+    for (int i = 0; ok && i < Entries.Size; ++i)
+    {
+        size_t aligned = AlignPackOffset(written);
+        ok = aligned == written || fwrite(padding, aligned - written, 1, f) == 1;
+        ok = ok && (entries[i].DataSize == 0 || fwrite(Entries[i]->Data, (size_t)entries[i].DataSize, 1, f) == 1);
+        written = aligned + (size_t)entries[i].DataSize;
+    }
+
+    ok = fclose(f) == 0 && ok;
+    return ok;
+}
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
@@ -0,0 +1,155 @@
+// Asset pack, many small images in a single memory mapped file.
+//
+// The pack starts with a hashed name index, each entry records format, size, pixel format and frame count
+// at build time, so an entry resolves in O(1) and layout can be done before anything is decoded.
+// Entries are stored as the original file, QOI encoded, or as raw pixels which are uploaded without decoding.
+//
+//     ImMedia::MountPack("assets.impack");
+//     ImMedia::PackEntryInfo info;
+//     if (ImMedia::GetPackEntryInfo("icons/save.png", &info))
+//         ; // info.Width, info.Height are known here.
+//     ImMedia::Image icon("pack://icons/save.png");
+//
+// Packs are built with tools/immedia_pack.cpp, or with @ref PackWriter.
+//
+// File layout, little-endian, every struct is read in place:
+//   PackHeader
+//   PackEntry[EntryCount]
+//   uint32_t [BucketCount]  Open addressing table of entry index + 1, 0 if empty, probed linearly from hash.
+//   char     []             Names, zero terminated.
+//   Entry data, each aligned to 16 bytes.
+//
+
+#ifndef IMMEDIA_PACK_H
+#define IMMEDIA_PACK_H
+
+#include "immedia_image.h"
+
+#ifndef IMMEDIA_NO_IMAGE_DECODER
+
+namespace ImMedia {
+
+#define IMMEDIA_PACK_PREFIX "pack://"
+#define IMMEDIA_PACK_VERSION 1
+
+enum class PackEncoding : uint32_t
+{
+    Original = 0,  // Bytes of the source file, decoded by the decoder of its format.
+    QOI      = 1,  // First frame encoded as qoi.
+    Pixels   = 2,  // PackPixelsHeader followed by tightly packed pixels of the first frame.
+};
+
+struct PackHeader
+{
+    char     Magic[4];  // "IMPK"
+    uint32_t Version;
+    uint32_t EntryCount;
+    uint32_t BucketCount;  // Power of two.
+    uint64_t EntriesOffset;
+    uint64_t BucketsOffset;
+};
+
+struct PackEntry
+{
+    uint64_t DataOffset;
+    uint64_t DataSize;
+    uint64_t NameOffset;
+    uint32_t NameSize;     // Without terminator.
+    uint32_t NameHash;     // See @ref HashPackName.
+    uint32_t Encoding;     // PackEncoding
+    int32_t  Width;
+    int32_t  Height;
+    int32_t  Format;       // PixelFormat
+    int32_t  FrameCount;
+    char     FileFormat[12];
+};
+
+struct PackPixelsHeader
+{
+    char    Magic[4];  // "IMPX"
+    int32_t Width;
+    int32_t Height;
+    int32_t Format;    // PixelFormat
+};
+
+/// @brief FNV-1a hash of entry name.
+uint32_t HashPackName(const char* name, size_t size);
+
+struct PackEntryInfo
+{
+    const char*  FileFormat;  // Format of the source file in lowercase, valid until the pack is unmounted.
+    PackEncoding Encoding;
+    int          Width;
+    int          Height;
+    PixelFormat  Format;
+    int          FrameCount;  // 0 if the image doesn't contain animation.
+    size_t       DataSize;
+};
+
+/// @brief Map a pack into memory and add its entries, thread-safe.
+///        Entries of packs mounted later hide entries with the same name.
+/// @return false if the file can't be mapped or is not a valid pack.
+bool MountPack(const char* filename);
+
+/// @brief Remove a pack, thread-safe. Its memory stays mapped until decoders reading from it are finished.
+void UnmountPack(const char* filename);
+
+/// @brief Unmount all packs, called by @ref DestoryContext.
+void UnmountAllPacks();
+
+/// @return true if filename starts with "pack://".
+bool IsPackPath(const char* filename);
+
+/// @brief Look up entry without reading its data, thread-safe.
+/// @param name Entry name, with or without "pack://".
+/// @return false if no mounted pack contains the entry.
+bool GetPackEntryInfo(const char* name, PackEntryInfo* info);
+
+/// @brief Open entry data as a source, it is read in place with @ref ImageSource::Map. Thread-safe.
+/// @param name Entry name, with or without "pack://".
+/// @return false if no mounted pack contains the entry.
+bool OpenPackEntry(const char* name, ImageSource* source);
+
+/// @brief Get decoder of entry data, according to its encoding and format.
+/// @param name Entry name, with or without "pack://".
+/// @return [nullable] null if no mounted pack contains the entry or no decoder is installed for its format.
+const ImageDecoder* GetPackEntryDecoder(const char* name);
+
+/// @brief Decoder of @ref PackEncoding::Pixels data, pixels are read in place from mapped sources.
+const ImageDecoder* GetPackPixelsDecoder();
+
+struct PackWriterEntry;
+
+/// @brief Build a pack in memory and write it to file.
+class PackWriter
+{
+public:
+    PackWriter() = default;
+    ~PackWriter();
+
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    /// @brief Add entry data, it is copied. An entry with the same name replaces the previous one.
+    /// @param info Metadata recorded in index, FileFormat is truncated to 11 characters.
+    void AddEntry(const char* name, const PackEntryInfo& info, const uint8_t* data, size_t data_size);
+
+    /// @brief Add @ref PackEncoding::Pixels entry.
+    /// @param stride Bytes between two rows of pixels, 0 if rows are tightly packed.
+    void AddPixels(const char* name, const char* file_format, int width, int height, PixelFormat format,
+                   const uint8_t* pixels, int stride = 0);
+
+    int GetEntryCount() const;
+
+    /// @return false if the file can't be written.
+    bool Write(const char* filename) const;
+
+private:
+    ImVector<PackWriterEntry*> Entries;
+};
+
+}
+
+#endif // !IMMEDIA_NO_IMAGE_DECODER
+
+#endif // !IMMEDIA_PACK_H
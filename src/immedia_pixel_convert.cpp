@@ -0,0 +1,988 @@
+#include "immedia_pixel_convert.h"
+
+#include <float.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMMEDIA_PIXEL_CONVERT_X86
+#endif
+
+#if defined(IMMEDIA_PIXEL_CONVERT_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define IMMEDIA_PIXEL_CONVERT_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(IMMEDIA_PIXEL_CONVERT_SSE2) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#define IMMEDIA_PIXEL_CONVERT_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMMEDIA_TARGET_AVX2
+#else
+#define IMMEDIA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define IMMEDIA_PIXEL_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ImMedia {
+
+typedef void (*PixelKernel)(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+typedef void (*PaletteKernel)(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, size_t pixel_count);
+// Flags are cleared when a pixel disproves them, the kernel returns once both are cleared.
+// Vector kernels AND comparisons over blocks of pixels, so the early exit test is paid once per block.
+typedef void (*AnalyzeKernel)(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray);
+#define IMMEDIA_ANALYZE_BLOCK 64
+// Index is (value - low) * scale + 0.5 truncated and clamped to [0, 255], NaN maps to 0.
+typedef void (*QuantizeFloatKernel)(const float* src, uint8_t* dst, size_t count, float low, float scale);
+typedef void (*QuantizeU16Kernel)(const uint16_t* src, uint8_t* dst, size_t count, float low, float scale);
+
+struct PixelKernels
+{
+    PixelKernel   Swizzle;
+    PixelKernel   Expand;
+    PixelKernel   Premultiply;
+    PaletteKernel PaletteRGB;
+    PaletteKernel PaletteRGBA;
+    PixelKernel   Shrink;       // RGBA8888 to RGB888.
+    PixelKernel   LumaRGB;      // RGB888 to L8.
+    PixelKernel   LumaRGBA;     // RGBA8888 to L8.
+    PixelKernel   LumaAlpha;    // RGBA8888 to LA88.
+    AnalyzeKernel AnalyzeRGB;
+    AnalyzeKernel AnalyzeRGBA;
+    QuantizeFloatKernel QuantizeFloat;
+    QuantizeU16Kernel   QuantizeU16;
+};
+
+
+
+// (x * a) / 255 with rounding, exact for 8 bits inputs.
+static inline uint8_t MulDiv255(int x, int a)
+{
+    int t = x * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void SwizzleScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, src += 4, dst += 4)
+    {
+        uint8_t r = src[0];
+        uint8_t b = src[2];
+        dst[0] = b;
+        dst[1] = src[1];
+        dst[2] = r;
+        dst[3] = src[3];
+    }
+}
+
+static void ExpandScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, src += 3, dst += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xFF;
+    }
+}
+
+static void PremultiplyScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, src += 4, dst += 4)
+    {
+        int a = src[3];
+        dst[0] = MulDiv255(src[0], a);
+        dst[1] = MulDiv255(src[1], a);
+        dst[2] = MulDiv255(src[2], a);
+        dst[3] = (uint8_t)a;
+    }
+}
+
+static void PaletteRGBScalar(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, dst += 3)
+    {
+        const uint8_t* color = palette + indices[i] * 4;
+        dst[0] = color[0];
+        dst[1] = color[1];
+        dst[2] = color[2];
+    }
+}
+
+static void PaletteRGBAScalar(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, dst += 4)
+        memcpy(dst, palette + indices[i] * 4, 4);
+}
+
+static void ShrinkScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, src += 4, dst += 3)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+
+static void LumaRGBScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i)
+        dst[i] = src[i * 3];
+}
+
+static void LumaRGBAScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i)
+        dst[i] = src[i * 4];
+}
+
+static void LumaAlphaScalar(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    for (size_t i = 0; i < pixel_count; ++i, src += 4, dst += 2)
+    {
+        dst[0] = src[0];
+        dst[1] = src[3];
+    }
+}
+
+static void AnalyzeRGBScalar(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    IM_UNUSED(opaque);
+    for (size_t i = 0; i < pixel_count && *gray; ++i, src += 3)
+        if (src[0] != src[1] || src[1] != src[2])
+            *gray = false;
+}
+
+static void AnalyzeRGBAScalar(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    for (size_t i = 0; i < pixel_count && (*opaque || *gray); ++i, src += 4)
+    {
+        if (src[3] != 0xFF)
+            *opaque = false;
+        if (src[0] != src[1] || src[1] != src[2])
+            *gray = false;
+    }
+}
+
+static inline uint8_t QuantizeValue(float value, float low, float scale)
+{
+    const float t = (value - low) * scale;
+    if (!(t > 0.0f))
+        return 0;
+    if (t >= 255.0f)
+        return 255;
+    return (uint8_t)(t + 0.5f);
+}
+
+static void QuantizeFloatScalar(const float* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = QuantizeValue(src[i], low, scale);
+}
+
+static void QuantizeU16Scalar(const uint16_t* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = QuantizeValue((float)src[i], low, scale);
+}
+
+
+
+#ifdef IMMEDIA_PIXEL_CONVERT_SSE2
+
+static void SwizzleSSE2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m128i mask_ag = _mm_set1_epi32((int)0xFF00FF00);
+    const __m128i mask_rb = _mm_set1_epi32(0x00FF00FF);
+    size_t i = 0;
+    for (; i + 4 <= pixel_count; i += 4)
+    {
+        __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i ag = _mm_and_si128(v, mask_ag);
+        __m128i rb = _mm_and_si128(v, mask_rb);
+        rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_or_si128(ag, rb));
+    }
+    SwizzleScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+static inline __m128i PremultiplySSE2Half(__m128i v, __m128i alpha_lane)
+{
+    // v holds 2 pixels as 16 bits channels, the alpha multiplier is forced to 255 to keep alpha.
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+    a = _mm_or_si128(a, alpha_lane);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static void PremultiplySSE2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m128i zero       = _mm_setzero_si128();
+    const __m128i alpha_lane = _mm_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 4 <= pixel_count; i += 4)
+    {
+        __m128i v  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        __m128i lo = PremultiplySSE2Half(_mm_unpacklo_epi8(v, zero), alpha_lane);
+        __m128i hi = PremultiplySSE2Half(_mm_unpackhi_epi8(v, zero), alpha_lane);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    PremultiplyScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+static void LumaRGBASSE2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+    {
+        const __m128i* p = reinterpret_cast<const __m128i*>(src + i * 4);
+        __m128i lo = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p),     mask), _mm_and_si128(_mm_loadu_si128(p + 1), mask));
+        __m128i hi = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), mask), _mm_and_si128(_mm_loadu_si128(p + 3), mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    LumaRGBAScalar(src + i * 4, dst + i, pixel_count - i);
+}
+
+static inline __m128i LumaAlphaSSE2Half(__m128i v)
+{
+    // Alpha is moved next to the first channel, the bias keeps the signed pack exact.
+    __m128i la = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0xFF)), _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xFF00)));
+    return _mm_sub_epi32(la, _mm_set1_epi32(0x8000));
+}
+
+static void LumaAlphaSSE2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        const __m128i* p = reinterpret_cast<const __m128i*>(src + i * 4);
+        __m128i v = _mm_packs_epi32(LumaAlphaSSE2Half(_mm_loadu_si128(p)), LumaAlphaSSE2Half(_mm_loadu_si128(p + 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), _mm_xor_si128(v, bias));
+    }
+    LumaAlphaScalar(src + i * 4, dst + i * 2, pixel_count - i);
+}
+
+static void AnalyzeRGBSSE2(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    // Each 16 bytes load covers 5 pixels, byte j is compared with byte j + 1 and the ones inside a pixel are kept.
+    const __m128i mask = _mm_setr_epi8(-1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, 0);
+    size_t i = 0;
+    while (i + 60 + 1 <= pixel_count && *gray)
+    {
+        __m128i all_equal = mask;
+        for (size_t end = i + 60; i < end; i += 5)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+            all_equal = _mm_and_si128(all_equal, _mm_cmpeq_epi8(v, _mm_srli_si128(v, 1)));
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(all_equal, mask)) != 0xFFFF)
+            *gray = false;
+    }
+    AnalyzeRGBScalar(src + i * 3, pixel_count - i, opaque, gray);
+}
+
+static void AnalyzeRGBASSE2(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i color = _mm_set1_epi32(0x0000FFFF);
+    size_t i = 0;
+    while (i + IMMEDIA_ANALYZE_BLOCK <= pixel_count && (*opaque || *gray))
+    {
+        __m128i all_alpha = alpha;
+        __m128i all_equal = color;
+        for (size_t end = i + IMMEDIA_ANALYZE_BLOCK; i < end; i += 4)
+        {
+            // Byte 0 of each pixel compares r with g, byte 1 compares g with b.
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            all_equal = _mm_and_si128(all_equal, _mm_cmpeq_epi8(v, _mm_srli_epi32(v, 8)));
+            all_alpha = _mm_and_si128(all_alpha, v);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(all_alpha, alpha)) != 0xFFFF)
+            *opaque = false;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(all_equal, color)) != 0xFFFF)
+            *gray = false;
+    }
+    AnalyzeRGBAScalar(src + i * 4, pixel_count - i, opaque, gray);
+}
+
+// maxps returns its second operand if either is NaN, so NaN clamps to 0 like the scalar path.
+static inline __m128i QuantizeSSE2x4(__m128 v, __m128 low, __m128 scale)
+{
+    __m128 t = _mm_max_ps(_mm_mul_ps(_mm_sub_ps(v, low), scale), _mm_setzero_ps());
+    t = _mm_min_ps(t, _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(_mm_add_ps(t, _mm_set1_ps(0.5f)));
+}
+
+static void QuantizeFloatSSE2(const float* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const __m128 low4   = _mm_set1_ps(low);
+    const __m128 scale4 = _mm_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i a = QuantizeSSE2x4(_mm_loadu_ps(src + i),      low4, scale4);
+        __m128i b = QuantizeSSE2x4(_mm_loadu_ps(src + i + 4),  low4, scale4);
+        __m128i c = QuantizeSSE2x4(_mm_loadu_ps(src + i + 8),  low4, scale4);
+        __m128i d = QuantizeSSE2x4(_mm_loadu_ps(src + i + 12), low4, scale4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+    QuantizeFloatScalar(src + i, dst + i, count - i, low, scale);
+}
+
+static void QuantizeU16SSE2(const uint16_t* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const __m128  low4   = _mm_set1_ps(low);
+    const __m128  scale4 = _mm_set1_ps(scale);
+    const __m128i zero   = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+        __m128i a = QuantizeSSE2x4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v0, zero)), low4, scale4);
+        __m128i b = QuantizeSSE2x4(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v0, zero)), low4, scale4);
+        __m128i c = QuantizeSSE2x4(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v1, zero)), low4, scale4);
+        __m128i d = QuantizeSSE2x4(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v1, zero)), low4, scale4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+    }
+    QuantizeU16Scalar(src + i, dst + i, count - i, low, scale);
+}
+
+#endif // IMMEDIA_PIXEL_CONVERT_SSE2
+
+
+
+#ifdef IMMEDIA_PIXEL_CONVERT_AVX2
+
+IMMEDIA_TARGET_AVX2
+static void SwizzleAVX2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(v, shuffle));
+    }
+    SwizzleScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+IMMEDIA_TARGET_AVX2
+static void ExpandAVX2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha   = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    // Each 16 bytes load covers 4 pixels and reads 4 bytes beyond them, keep them in range.
+    for (; i + 8 + 2 <= pixel_count; i += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+        __m256i v = _mm256_set_m128i(_mm_shuffle_epi8(b, shuffle), _mm_shuffle_epi8(a, shuffle));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_or_si256(v, alpha));
+    }
+    ExpandScalar(src + i * 3, dst + i * 4, pixel_count - i);
+}
+
+IMMEDIA_TARGET_AVX2
+static inline __m256i PremultiplyAVX2Half(__m256i v, __m256i alpha_lane)
+{
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xFF), 0xFF);
+    a = _mm256_or_si256(a, alpha_lane);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+IMMEDIA_TARGET_AVX2
+static void PremultiplyAVX2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m256i zero       = _mm256_setzero_si256();
+    const __m256i alpha_lane = _mm256_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        // Unpack and pack work inside 128 bits lanes, so pixel order is kept.
+        __m256i v  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        __m256i lo = PremultiplyAVX2Half(_mm256_unpacklo_epi8(v, zero), alpha_lane);
+        __m256i hi = PremultiplyAVX2Half(_mm256_unpackhi_epi8(v, zero), alpha_lane);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_packus_epi16(lo, hi));
+    }
+    PremultiplyScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+// Palette entries are fetched 8 at a time with a gather.
+IMMEDIA_TARGET_AVX2
+static void PaletteRGBAAVX2(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, size_t pixel_count)
+{
+    const int* table = reinterpret_cast<const int*>(palette);
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_i32gather_epi32(table, index, 4));
+    }
+    PaletteRGBAScalar(indices + i, palette, dst + i * 4, pixel_count - i);
+}
+
+IMMEDIA_TARGET_AVX2
+static void PaletteRGBAVX2(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, size_t pixel_count)
+{
+    const int*    table   = reinterpret_cast<const int*>(palette);
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    // Each 16 bytes store covers 4 pixels and writes 4 bytes beyond them, keep them in range.
+    for (; i + 8 + 2 <= pixel_count; i += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i)));
+        __m256i v     = _mm256_shuffle_epi8(_mm256_i32gather_epi32(table, index, 4), shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3 + 12), _mm256_extracti128_si256(v, 1));
+    }
+    PaletteRGBScalar(indices + i, palette, dst + i * 3, pixel_count - i);
+}
+
+IMMEDIA_TARGET_AVX2
+static void ShrinkAVX2(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    // Each 16 bytes store covers 4 pixels and writes 4 bytes beyond them, keep them in range.
+    for (; i + 8 + 2 <= pixel_count; i += 8)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4)), shuffle);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm256_castsi256_si128(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3 + 12), _mm256_extracti128_si256(v, 1));
+    }
+    ShrinkScalar(src + i * 4, dst + i * 3, pixel_count - i);
+}
+
+IMMEDIA_TARGET_AVX2
+static void AnalyzeRGBAAVX2(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i color = _mm256_set1_epi32(0x0000FFFF);
+    size_t i = 0;
+    while (i + IMMEDIA_ANALYZE_BLOCK <= pixel_count && (*opaque || *gray))
+    {
+        __m256i all_alpha = alpha;
+        __m256i all_equal = color;
+        for (size_t end = i + IMMEDIA_ANALYZE_BLOCK; i < end; i += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+            all_equal = _mm256_and_si256(all_equal, _mm256_cmpeq_epi8(v, _mm256_srli_epi32(v, 8)));
+            all_alpha = _mm256_and_si256(all_alpha, v);
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(all_alpha, alpha)) != -1)
+            *opaque = false;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(all_equal, color)) != -1)
+            *gray = false;
+    }
+    AnalyzeRGBAScalar(src + i * 4, pixel_count - i, opaque, gray);
+}
+
+IMMEDIA_TARGET_AVX2
+static inline __m256i QuantizeAVX2x8(__m256 v, __m256 low, __m256 scale)
+{
+    __m256 t = _mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(v, low), scale), _mm256_setzero_ps());
+    t = _mm256_min_ps(t, _mm256_set1_ps(255.0f));
+    return _mm256_cvttps_epi32(_mm256_add_ps(t, _mm256_set1_ps(0.5f)));
+}
+
+// Packs work inside 128 bits lanes, the permutes put 8 values of each input back in order.
+IMMEDIA_TARGET_AVX2
+static inline __m256i QuantizePackAVX2(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+    __m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    __m256i cd = _mm256_permute4x64_epi64(_mm256_packs_epi32(c, d), 0xD8);
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(ab, cd), 0xD8);
+}
+
+IMMEDIA_TARGET_AVX2
+static void QuantizeFloatAVX2(const float* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const __m256 low8   = _mm256_set1_ps(low);
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = QuantizeAVX2x8(_mm256_loadu_ps(src + i),      low8, scale8);
+        __m256i b = QuantizeAVX2x8(_mm256_loadu_ps(src + i + 8),  low8, scale8);
+        __m256i c = QuantizeAVX2x8(_mm256_loadu_ps(src + i + 16), low8, scale8);
+        __m256i d = QuantizeAVX2x8(_mm256_loadu_ps(src + i + 24), low8, scale8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), QuantizePackAVX2(a, b, c, d));
+    }
+    QuantizeFloatScalar(src + i, dst + i, count - i, low, scale);
+}
+
+IMMEDIA_TARGET_AVX2
+static void QuantizeU16AVX2(const uint16_t* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const __m256 low8   = _mm256_set1_ps(low);
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i v[4];
+        for (int j = 0; j < 4; ++j)
+        {
+            __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + j * 8));
+            v[j] = QuantizeAVX2x8(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(u)), low8, scale8);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), QuantizePackAVX2(v[0], v[1], v[2], v[3]));
+    }
+    QuantizeU16Scalar(src + i, dst + i, count - i, low, scale);
+}
+
+static bool CPUSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 0x6) == 0x6);
+    __cpuidex(info, 7, 0);
+    return os_avx && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // IMMEDIA_PIXEL_CONVERT_AVX2
+
+
+
+#ifdef IMMEDIA_PIXEL_CONVERT_NEON
+
+static void SwizzleNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+    {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        uint8x16_t   r = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = r;
+        vst4q_u8(dst + i * 4, v);
+    }
+    SwizzleScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+static void ExpandNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+    {
+        uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(0xFF);
+        vst4q_u8(dst + i * 4, rgba);
+    }
+    ExpandScalar(src + i * 3, dst + i * 4, pixel_count - i);
+}
+
+static inline uint8x8_t MulDiv255NEON(uint8x8_t x, uint8x8_t a)
+{
+    uint16x8_t t = vmull_u8(x, a);
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void PremultiplyNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixel_count; i += 8)
+    {
+        uint8x8x4_t v = vld4_u8(src + i * 4);
+        v.val[0] = MulDiv255NEON(v.val[0], v.val[3]);
+        v.val[1] = MulDiv255NEON(v.val[1], v.val[3]);
+        v.val[2] = MulDiv255NEON(v.val[2], v.val[3]);
+        vst4_u8(dst + i * 4, v);
+    }
+    PremultiplyScalar(src + i * 4, dst + i * 4, pixel_count - i);
+}
+
+static void ShrinkNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+    {
+        uint8x16x4_t rgba = vld4q_u8(src + i * 4);
+        uint8x16x3_t rgb;
+        rgb.val[0] = rgba.val[0];
+        rgb.val[1] = rgba.val[1];
+        rgb.val[2] = rgba.val[2];
+        vst3q_u8(dst + i * 3, rgb);
+    }
+    ShrinkScalar(src + i * 4, dst + i * 3, pixel_count - i);
+}
+
+static void LumaRGBNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+        vst1q_u8(dst + i, vld3q_u8(src + i * 3).val[0]);
+    LumaRGBScalar(src + i * 3, dst + i, pixel_count - i);
+}
+
+static void LumaRGBANEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+        vst1q_u8(dst + i, vld4q_u8(src + i * 4).val[0]);
+    LumaRGBAScalar(src + i * 4, dst + i, pixel_count - i);
+}
+
+static void LumaAlphaNEON(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixel_count; i += 16)
+    {
+        uint8x16x4_t rgba = vld4q_u8(src + i * 4);
+        uint8x16x2_t la;
+        la.val[0] = rgba.val[0];
+        la.val[1] = rgba.val[3];
+        vst2q_u8(dst + i * 2, la);
+    }
+    LumaAlphaScalar(src + i * 4, dst + i * 2, pixel_count - i);
+}
+
+static inline bool AllSetNEON(uint8x16_t v)
+{
+    uint8x8_t m = vand_u8(vget_low_u8(v), vget_high_u8(v));
+    return vget_lane_u64(vreinterpret_u64_u8(m), 0) == ~(uint64_t)0;
+}
+
+static void AnalyzeRGBNEON(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    size_t i = 0;
+    while (i + IMMEDIA_ANALYZE_BLOCK <= pixel_count && *gray)
+    {
+        uint8x16_t all_equal = vdupq_n_u8(0xFF);
+        for (size_t end = i + IMMEDIA_ANALYZE_BLOCK; i < end; i += 16)
+        {
+            uint8x16x3_t v = vld3q_u8(src + i * 3);
+            all_equal = vandq_u8(all_equal, vandq_u8(vceqq_u8(v.val[0], v.val[1]), vceqq_u8(v.val[1], v.val[2])));
+        }
+        if (!AllSetNEON(all_equal))
+            *gray = false;
+    }
+    AnalyzeRGBScalar(src + i * 3, pixel_count - i, opaque, gray);
+}
+
+static void AnalyzeRGBANEON(const uint8_t* src, size_t pixel_count, bool* opaque, bool* gray)
+{
+    size_t i = 0;
+    while (i + IMMEDIA_ANALYZE_BLOCK <= pixel_count && (*opaque || *gray))
+    {
+        uint8x16_t all_alpha = vdupq_n_u8(0xFF);
+        uint8x16_t all_equal = vdupq_n_u8(0xFF);
+        for (size_t end = i + IMMEDIA_ANALYZE_BLOCK; i < end; i += 16)
+        {
+            uint8x16x4_t v = vld4q_u8(src + i * 4);
+            all_alpha = vandq_u8(all_alpha, v.val[3]);
+            all_equal = vandq_u8(all_equal, vandq_u8(vceqq_u8(v.val[0], v.val[1]), vceqq_u8(v.val[1], v.val[2])));
+        }
+        if (!AllSetNEON(all_alpha))
+            *opaque = false;
+        if (!AllSetNEON(all_equal))
+            *gray = false;
+    }
+    AnalyzeRGBAScalar(src + i * 4, pixel_count - i, opaque, gray);
+}
+
+// Conversion to unsigned saturates negative values and NaN to 0.
+static inline uint16x4_t QuantizeNEONx4(float32x4_t v, float32x4_t low, float32x4_t scale)
+{
+    float32x4_t t = vminq_f32(vmulq_f32(vsubq_f32(v, low), scale), vdupq_n_f32(255.0f));
+    return vmovn_u32(vcvtq_u32_f32(vaddq_f32(t, vdupq_n_f32(0.5f))));
+}
+
+static void QuantizeFloatNEON(const float* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const float32x4_t low4   = vdupq_n_f32(low);
+    const float32x4_t scale4 = vdupq_n_f32(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x4_t a = QuantizeNEONx4(vld1q_f32(src + i),     low4, scale4);
+        uint16x4_t b = QuantizeNEONx4(vld1q_f32(src + i + 4), low4, scale4);
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(a, b)));
+    }
+    QuantizeFloatScalar(src + i, dst + i, count - i, low, scale);
+}
+
+static void QuantizeU16NEON(const uint16_t* src, uint8_t* dst, size_t count, float low, float scale)
+{
+    const float32x4_t low4   = vdupq_n_f32(low);
+    const float32x4_t scale4 = vdupq_n_f32(scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t v = vld1q_u16(src + i);
+        uint16x4_t a = QuantizeNEONx4(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))),  low4, scale4);
+        uint16x4_t b = QuantizeNEONx4(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), low4, scale4);
+        vst1_u8(dst + i, vqmovn_u16(vcombine_u16(a, b)));
+    }
+    QuantizeU16Scalar(src + i, dst + i, count - i, low, scale);
+}
+
+#endif // IMMEDIA_PIXEL_CONVERT_NEON
+
+
+
+static PixelKernels SelectKernels()
+{
+    PixelKernels kernels = {
+        SwizzleScalar, ExpandScalar, PremultiplyScalar, PaletteRGBScalar, PaletteRGBAScalar,
+        ShrinkScalar, LumaRGBScalar, LumaRGBAScalar, LumaAlphaScalar, AnalyzeRGBScalar, AnalyzeRGBAScalar,
+        QuantizeFloatScalar, QuantizeU16Scalar
+    };
+#ifdef IMMEDIA_PIXEL_CONVERT_SSE2
+    kernels.Swizzle     = SwizzleSSE2;
+    kernels.Premultiply = PremultiplySSE2;
+    kernels.LumaRGBA    = LumaRGBASSE2;
+    kernels.LumaAlpha   = LumaAlphaSSE2;
+    kernels.AnalyzeRGB  = AnalyzeRGBSSE2;
+    kernels.AnalyzeRGBA = AnalyzeRGBASSE2;
+    kernels.QuantizeFloat = QuantizeFloatSSE2;
+    kernels.QuantizeU16   = QuantizeU16SSE2;
+#endif
+#ifdef IMMEDIA_PIXEL_CONVERT_AVX2
+    if (CPUSupportsAVX2())
+    {
+        kernels.Swizzle     = SwizzleAVX2;
+        kernels.Expand      = ExpandAVX2;
+        kernels.Premultiply = PremultiplyAVX2;
+        kernels.PaletteRGB  = PaletteRGBAVX2;
+        kernels.PaletteRGBA = PaletteRGBAAVX2;
+        kernels.Shrink      = ShrinkAVX2;
+        kernels.AnalyzeRGBA = AnalyzeRGBAAVX2;
+        kernels.QuantizeFloat = QuantizeFloatAVX2;
+        kernels.QuantizeU16   = QuantizeU16AVX2;
+    }
+#endif
+#ifdef IMMEDIA_PIXEL_CONVERT_NEON
+    kernels.Swizzle     = SwizzleNEON;
+    kernels.Expand      = ExpandNEON;
+    kernels.Premultiply = PremultiplyNEON;
+    kernels.Shrink      = ShrinkNEON;
+    kernels.LumaRGB     = LumaRGBNEON;
+    kernels.LumaRGBA    = LumaRGBANEON;
+    kernels.LumaAlpha   = LumaAlphaNEON;
+    kernels.AnalyzeRGB  = AnalyzeRGBNEON;
+    kernels.AnalyzeRGBA = AnalyzeRGBANEON;
+    kernels.QuantizeFloat = QuantizeFloatNEON;
+    kernels.QuantizeU16   = QuantizeU16NEON;
+#endif
+    return kernels;
+}
+
+static const PixelKernels& GetKernels()
+{
+    static const PixelKernels kernels = SelectKernels();
+    return kernels;
+}
+
+
+
+void SwizzleRGBAToBGRA(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    GetKernels().Swizzle(src, dst, pixel_count);
+}
+
+void ExpandRGBToRGBA(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    GetKernels().Expand(src, dst, pixel_count);
+}
+
+void PremultiplyAlpha(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    GetKernels().Premultiply(src, dst, pixel_count);
+}
+
+void ExpandPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, PixelFormat dst_format, size_t pixel_count)
+{
+    if (dst_format == PixelFormat::RGBA8888)
+        GetKernels().PaletteRGBA(indices, palette, dst, pixel_count);
+    else
+        GetKernels().PaletteRGB(indices, palette, dst, pixel_count);
+}
+
+// Equal bounds map values below to 0 and the others to 255.
+static float GetQuantizeScale(float low, float high)
+{
+    return high != low ? 255.0f / (high - low) : FLT_MAX;
+}
+
+void QuantizeScalars(const float* src, uint8_t* dst, size_t count, float low, float high)
+{
+    GetKernels().QuantizeFloat(src, dst, count, low, GetQuantizeScale(low, high));
+}
+
+void QuantizeScalars(const uint16_t* src, uint8_t* dst, size_t count, float low, float high)
+{
+    GetKernels().QuantizeU16(src, dst, count, low, GetQuantizeScale(low, high));
+}
+
+bool AnalyzePixels(const uint8_t* pixels, PixelFormat format, size_t pixel_count, bool* opaque, bool* gray)
+{
+    bool is_opaque = true;
+    bool is_gray   = gray != nullptr;
+    if (format == PixelFormat::RGB888)
+        GetKernels().AnalyzeRGB(pixels, pixel_count, &is_opaque, &is_gray);
+    else if (format == PixelFormat::RGBA8888)
+    {
+        is_opaque = opaque != nullptr;
+        GetKernels().AnalyzeRGBA(pixels, pixel_count, &is_opaque, &is_gray);
+    }
+    else
+        return false;
+
+    if (opaque)
+        *opaque = is_opaque;
+    if (gray)
+        *gray = is_gray;
+    return true;
+}
+
+// Colors are looked up in an open addressing table twice the palette size, runs of a color skip the lookup.
+bool PalettizePixels(const uint8_t* pixels, PixelFormat format, size_t pixel_count, uint8_t* dst)
+{
+    if (format != PixelFormat::RGB888 && format != PixelFormat::RGBA8888)
+        return false;
+
+    const int pixel_size = PIXEL_FORMAT_SIZE(format);
+    uint8_t*  palette    = dst + pixel_count;
+    memset(palette, 0, 256 * 4);
+
+    uint32_t keys[512];
+    uint16_t slots[512] = {};  // Palette index + 1, 0 if empty.
+    int      color_count = 0;
+    uint32_t last_color  = 0;
+    int      last_index  = -1;
+    for (size_t i = 0; i < pixel_count; ++i, pixels += pixel_size)
+    {
+        uint8_t bytes[4] = { pixels[0], pixels[1], pixels[2], 0xFF };
+        if (pixel_size == 4)
+            bytes[3] = pixels[3];
+        uint32_t color;
+        memcpy(&color, bytes, 4);
+
+        if (color != last_color || last_index < 0)
+        {
+            uint32_t slot = (color * 2654435761u) >> 23;
+            while (slots[slot] && keys[slot] != color)
+                slot = (slot + 1) & 511;
+            if (!slots[slot])
+            {
+                if (color_count == 256)
+                    return false;
+                memcpy(palette + color_count * 4, bytes, 4);
+                keys[slot]  = color;
+                slots[slot] = (uint16_t)++color_count;
+            }
+            last_color = color;
+            last_index = slots[slot] - 1;
+        }
+        dst[i] = (uint8_t)last_index;
+    }
+    return true;
+}
+
+// Division is done by multiplying with a 16.16 reciprocal of alpha, the bottleneck is memory anyway.
+void UnpremultiplyAlpha(const uint8_t* src, uint8_t* dst, size_t pixel_count)
+{
+    struct Reciprocal
+    {
+        uint32_t Table[256];
+        Reciprocal()
+        {
+            Table[0] = 0;
+            for (uint32_t a = 1; a < 256; ++a)
+                Table[a] = ((255u << 16) + a / 2) / a;
+        }
+    };
+    static const Reciprocal reciprocal;
+
+    for (size_t i = 0; i < pixel_count; ++i, src += 4, dst += 4)
+    {
+        const uint8_t  a = src[3];
+        const uint32_t r = reciprocal.Table[a];
+        for (int c = 0; c < 3; ++c)
+        {
+            uint32_t v = (src[c] * r + 0x8000) >> 16;
+            dst[c] = (uint8_t)(v > 0xFF ? 0xFF : v);
+        }
+        dst[3] = a;
+    }
+}
+
+void CopyRows(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, size_t row_size, int row_count)
+{
+    if ((size_t)src_stride == row_size && (size_t)dst_stride == row_size)
+    {
+        memcpy(dst, src, row_size * row_count);
+        return;
+    }
+    for (int i = 0; i < row_count; ++i)
+        memcpy(dst + (size_t)i * dst_stride, src + (size_t)i * src_stride, row_size);
+}
+
+bool ConvertPixels(const uint8_t* src, PixelFormat src_format, int src_stride,
+                   uint8_t*       dst, PixelFormat dst_format, int dst_stride,
+                   int width, int height)
+{
+    const size_t src_row = (size_t)width * PIXEL_FORMAT_SIZE(src_format);
+    const size_t dst_row = (size_t)width * PIXEL_FORMAT_SIZE(dst_format);
+    if (src_stride == 0)
+        src_stride = (int)src_row;
+    if (dst_stride == 0)
+        dst_stride = (int)dst_row;
+
+    if (src_format == dst_format)
+    {
+        CopyRows(src, src_stride, dst, dst_stride, src_row, height);
+        return true;
+    }
+
+    const PixelKernels& kernels = GetKernels();
+    PixelKernel kernel = nullptr;
+    if (src_format == PixelFormat::RGB888 && dst_format == PixelFormat::RGBA8888)
+        kernel = kernels.Expand;
+    else if (src_format == PixelFormat::RGBA8888 && dst_format == PixelFormat::RGB888)
+        kernel = kernels.Shrink;
+    else if (src_format == PixelFormat::RGB888 && dst_format == PixelFormat::L8)
+        kernel = kernels.LumaRGB;
+    else if (src_format == PixelFormat::RGBA8888 && dst_format == PixelFormat::L8)
+        kernel = kernels.LumaRGBA;
+    else if (src_format == PixelFormat::RGBA8888 && dst_format == PixelFormat::LA88)
+        kernel = kernels.LumaAlpha;
+    if (!kernel)
+        return false;
+
+    // Contiguous images are converted as a single row.
+    if ((size_t)src_stride == src_row && (size_t)dst_stride == dst_row)
+    {
+        kernel(src, dst, (size_t)width * height);
+        return true;
+    }
+    for (int i = 0; i < height; ++i)
+        kernel(src + (size_t)i * src_stride, dst + (size_t)i * dst_stride, (size_t)width);
+    return true;
+}
+
+}
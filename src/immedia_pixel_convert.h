@@ -0,0 +1,66 @@
+// Pixel conversion shared by decoders and renderers.
+//
+// Kernels are selected at runtime from SSE2/AVX2 on x86 and NEON on ARM, with a scalar fallback.
+// Source and destination may be the same buffer for kernels which don't change the pixel size.
+//
+
+#ifndef IMMEDIA_PIXEL_CONVERT_H
+#define IMMEDIA_PIXEL_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "immedia_image.h"
+
+namespace ImMedia {
+
+/// @brief Swap the first and third channel of 4 bytes pixels, RGBA <-> BGRA.
+void SwizzleRGBAToBGRA(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+
+/// @brief Expand RGB888 to RGBA8888 with opaque alpha. src and dst must not overlap.
+void ExpandRGBToRGBA(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+
+/// @brief Multiply color channels of RGBA8888 by alpha.
+void PremultiplyAlpha(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+
+/// @brief Divide color channels of premultiplied RGBA8888 by alpha.
+void UnpremultiplyAlpha(const uint8_t* src, uint8_t* dst, size_t pixel_count);
+
+/// @brief Look up 8 bits indices in a palette of 256 RGBA8888 entries, see also @ref PixelFormat::Indexed8.
+/// @param dst_format RGB888 or RGBA8888, alpha of palette is dropped for RGB888.
+void ExpandPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* dst, PixelFormat dst_format, size_t pixel_count);
+
+/// @brief Map scalars to 8 bits indices, low to 0 and high to 255. Values out of range are clamped, NaN maps to 0.
+///        high may be less than low to invert the mapping.
+void QuantizeScalars(const float* src, uint8_t* dst, size_t count, float low, float high);
+void QuantizeScalars(const uint16_t* src, uint8_t* dst, size_t count, float low, float high);
+
+/// @brief Scan pixels for content which fits in a smaller format, it stops as soon as both answers are known.
+/// @param format RGB888 or RGBA8888.
+/// @param opaque [nullable] Set to true if every alpha is 255, always true for RGB888.
+/// @param gray [nullable] Set to true if the color channels of every pixel are equal.
+/// @return false if the format is not supported.
+bool AnalyzePixels(const uint8_t* pixels, PixelFormat format, size_t pixel_count, bool* opaque, bool* gray);
+
+/// @brief Build a palette of the distinct colors of pixels, see also @ref PixelFormat::Indexed8.
+/// @param format RGB888 or RGBA8888.
+/// @param dst Index plane of pixel_count bytes followed by 256 RGBA8888 entries, unused entries are zero.
+///            It must not overlap pixels, and is left undefined if false is returned.
+/// @return false if pixels contain more than 256 colors, or the format is not supported.
+bool PalettizePixels(const uint8_t* pixels, PixelFormat format, size_t pixel_count, uint8_t* dst);
+
+/// @brief Copy rows between buffers of different stride.
+void CopyRows(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, size_t row_size, int row_count);
+
+/// @brief Convert pixels between formats and strides in a single pass.
+/// @param src_stride Bytes between two rows of source, 0 if rows are tightly packed.
+/// @param dst_stride Bytes between two rows of destination, 0 if rows are tightly packed.
+///        Conversions to L8 and LA88 keep the first color channel, they are meant for gray content.
+/// @return false if the conversion is not supported.
+bool ConvertPixels(const uint8_t* src, PixelFormat src_format, int src_stride,
+                   uint8_t*       dst, PixelFormat dst_format, int dst_stride,
+                   int width, int height);
+
+}
+
+#endif // !IMMEDIA_PIXEL_CONVERT_H
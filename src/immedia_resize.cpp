@@ -0,0 +1,358 @@
+#include "immedia_resize.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMMEDIA_RESIZE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define IMMEDIA_RESIZE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ImMedia {
+
+// Weights of the source pixels contributing to one destination pixel.
+struct ResizeTaps
+{
+    int            TapCount;  // Maximum taps per pixel, weights are padded with 0.
+    ImVector<int>   First;
+    ImVector<float> Weights;  // TapCount weights per pixel.
+};
+
+struct ResizeJob
+{
+    const uint8_t* Src;
+    int            SrcWidth;
+    int            SrcStride;
+    uint8_t*       Dst;
+    int            DstWidth;
+    int            DstStride;
+    int            Channels;
+    bool           HasAlpha;
+
+    ResizeTaps     Horizontal;
+    ResizeTaps     Vertical;
+
+    float*         Rows;       // Source rows filtered horizontally, RowFloats per row.
+    int            RowFloats;
+    int            FirstRow;   // Source row of Rows[0].
+};
+
+
+
+static float FilterBox(float x)
+{
+    return (x >= -0.5f && x < 0.5f) ? 1.0f : 0.0f;
+}
+
+// Mitchell-Netravali with B = C = 1/3.
+static float FilterMitchell(float x)
+{
+    const float B = 1.0f / 3.0f;
+    const float C = 1.0f / 3.0f;
+    x = fabsf(x);
+    if (x < 1.0f)
+        return ((12 - 9 * B - 6 * C) * x * x * x + (-18 + 12 * B + 6 * C) * x * x + (6 - 2 * B)) / 6.0f;
+    if (x < 2.0f)
+        return ((-B - 6 * C) * x * x * x + (6 * B + 30 * C) * x * x + (-12 * B - 48 * C) * x + (8 * B + 24 * C)) / 6.0f;
+    return 0.0f;
+}
+
+static float Sinc(float x)
+{
+    if (x == 0.0f)
+        return 1.0f;
+    x *= 3.14159265358979f;
+    return sinf(x) / x;
+}
+
+static float FilterLanczos3(float x)
+{
+    if (x <= -3.0f || x >= 3.0f)
+        return 0.0f;
+    return Sinc(x) * Sinc(x / 3.0f);
+}
+
+static void ComputeTaps(ResizeTaps& taps, int src_size, int dst_size, ResizeFilter filter)
+{
+    float (*kernel)(float) = FilterLanczos3;
+    float support = 3.0f;
+    switch (filter)
+    {
+    case ResizeFilter::Box:      kernel = FilterBox;      support = 0.5f; break;
+    case ResizeFilter::Mitchell: kernel = FilterMitchell; support = 2.0f; break;
+    case ResizeFilter::Lanczos3: kernel = FilterLanczos3; support = 3.0f; break;
+    }
+
+    // When downscaling the filter is stretched to cover all source pixels.
+    const float scale        = (float)src_size / dst_size;
+    const float filter_scale = scale > 1.0f ? scale : 1.0f;
+    support *= filter_scale;
+
+    taps.TapCount = (int)ceilf(support * 2.0f) + 1;
+    taps.First.resize(dst_size);
+    taps.Weights.resize(dst_size * taps.TapCount);
+
+    for (int i = 0; i < dst_size; ++i)
+    {
+        const float center = (i + 0.5f) * scale - 0.5f;
+        int first = (int)ceilf(center - support);
+        int last  = (int)floorf(center + support);
+        if (first < 0)
+            first = 0;
+        if (last > src_size - 1)
+            last = src_size - 1;
+        if (last - first + 1 > taps.TapCount)
+            last = first + taps.TapCount - 1;
+
+        float* weights = &taps.Weights[i * taps.TapCount];
+        float  sum     = 0.0f;
+        for (int j = 0; j < taps.TapCount; ++j)
+        {
+            weights[j] = first + j <= last ? kernel((first + j - center) / filter_scale) : 0.0f;
+            sum += weights[j];
+        }
+
+        if (sum == 0.0f)
+        {
+            // Box filter may miss every pixel center when upscaling, use the nearest one.
+            int nearest = (int)floorf(center + 0.5f);
+            first = nearest < 0 ? 0 : (nearest > src_size - 1 ? src_size - 1 : nearest);
+            weights[0] = 1.0f;
+            for (int j = 1; j < taps.TapCount; ++j)
+                weights[j] = 0.0f;
+        }
+        else
+        {
+            for (int j = 0; j < taps.TapCount; ++j)
+                weights[j] /= sum;
+        }
+
+        taps.First[i] = first;
+    }
+}
+
+
+
+#if defined(IMMEDIA_RESIZE_SSE2)
+
+static inline void AccumulateRow(float* acc, const float* row, float weight, int count)
+{
+    const __m128 w = _mm_set1_ps(weight);
+    for (int i = 0; i < count; i += 4)
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), w)));
+}
+
+static inline void FilterPixel4(float* out, const float* row, const float* weights, int tap_count)
+{
+    __m128 acc = _mm_setzero_ps();
+    for (int j = 0; j < tap_count; ++j)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(row + j * 4), _mm_set1_ps(weights[j])));
+    _mm_storeu_ps(out, acc);
+}
+
+#elif defined(IMMEDIA_RESIZE_NEON)
+
+static inline void AccumulateRow(float* acc, const float* row, float weight, int count)
+{
+    for (int i = 0; i < count; i += 4)
+        vst1q_f32(acc + i, vmlaq_n_f32(vld1q_f32(acc + i), vld1q_f32(row + i), weight));
+}
+
+static inline void FilterPixel4(float* out, const float* row, const float* weights, int tap_count)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (int j = 0; j < tap_count; ++j)
+        acc = vmlaq_n_f32(acc, vld1q_f32(row + j * 4), weights[j]);
+    vst1q_f32(out, acc);
+}
+
+#else
+
+static inline void AccumulateRow(float* acc, const float* row, float weight, int count)
+{
+    for (int i = 0; i < count; ++i)
+        acc[i] += row[i] * weight;
+}
+
+static inline void FilterPixel4(float* out, const float* row, const float* weights, int tap_count)
+{
+    float acc[4] = {};
+    for (int j = 0; j < tap_count; ++j)
+        for (int c = 0; c < 4; ++c)
+            acc[c] += row[j * 4 + c] * weights[j];
+    memcpy(out, acc, sizeof(acc));
+}
+
+#endif
+
+// Row buffers are padded to 4 floats, so the vector loops never need a tail.
+static inline int AlignRowFloats(int count)
+{
+    return (count + 3) & ~3;
+}
+
+
+
+static void FilterRowsHorizontal(int begin, int end, void* user_data)
+{
+    ResizeJob& job = *reinterpret_cast<ResizeJob*>(user_data);
+    const int channels  = job.Channels;
+    const int tap_count = job.Horizontal.TapCount;
+
+    // Padded taps of the last pixels read past the row, they have 0 weight.
+    ImVector<float> line;
+    line.resize(AlignRowFloats((job.SrcWidth + tap_count) * channels));
+    memset(line.Data, 0, sizeof(float) * line.Size);
+
+    for (int row = begin; row < end; ++row)
+    {
+        const uint8_t* src = job.Src + (size_t)(job.FirstRow + row) * job.SrcStride;
+        for (int i = 0; i < job.SrcWidth * channels; ++i)
+            line[i] = src[i];
+        if (job.HasAlpha)
+        {
+            for (int x = 0; x < job.SrcWidth; ++x)
+            {
+                float* p = &line[x * channels];
+                const float a = p[channels - 1] * (1.0f / 255.0f);
+                for (int c = 0; c < channels - 1; ++c)
+                    p[c] *= a;
+            }
+        }
+
+        float* out = job.Rows + (size_t)row * job.RowFloats;
+        for (int x = 0; x < job.DstWidth; ++x)
+        {
+            const float* weights = &job.Horizontal.Weights[x * tap_count];
+            const float* in      = &line[job.Horizontal.First[x] * channels];
+            if (channels == 4)
+                FilterPixel4(out + x * 4, in, weights, tap_count);
+            else
+            {
+                for (int c = 0; c < channels; ++c)
+                {
+                    float acc = 0.0f;
+                    for (int j = 0; j < tap_count; ++j)
+                        acc += in[j * channels + c] * weights[j];
+                    out[x * channels + c] = acc;
+                }
+            }
+        }
+    }
+}
+
+static inline uint8_t ClampToByte(float v)
+{
+    return v <= 0.0f ? 0 : (v >= 255.0f ? 255 : (uint8_t)(v + 0.5f));
+}
+
+static void FilterRowsVertical(int begin, int end, void* user_data)
+{
+    ResizeJob& job = *reinterpret_cast<ResizeJob*>(user_data);
+    const int channels  = job.Channels;
+    const int tap_count = job.Vertical.TapCount;
+
+    ImVector<float> acc;
+    acc.resize(job.RowFloats);
+
+    for (int row = begin; row < end; ++row)
+    {
+        memset(acc.Data, 0, sizeof(float) * acc.Size);
+        const float* weights = &job.Vertical.Weights[row * tap_count];
+        const int    first   = job.Vertical.First[row] - job.FirstRow;
+        for (int j = 0; j < tap_count; ++j)
+        {
+            // Padded taps may point past the last filtered row.
+            if (weights[j] != 0.0f)
+                AccumulateRow(acc.Data, job.Rows + (size_t)(first + j) * job.RowFloats, weights[j], job.RowFloats);
+        }
+
+        uint8_t* dst = job.Dst + (size_t)row * job.DstStride;
+        if (!job.HasAlpha)
+        {
+            for (int i = 0; i < job.DstWidth * channels; ++i)
+                dst[i] = ClampToByte(acc[i]);
+            continue;
+        }
+        for (int x = 0; x < job.DstWidth; ++x)
+        {
+            const float* p = &acc[x * channels];
+            const float  a = p[channels - 1];
+            const float  unpremultiply = a > 0.0f ? 255.0f / a : 0.0f;
+            for (int c = 0; c < channels - 1; ++c)
+                dst[x * channels + c] = ClampToByte(p[c] * unpremultiply);
+            dst[x * channels + channels - 1] = ClampToByte(a);
+        }
+    }
+}
+
+
+
+bool Resize(const uint8_t* src, int src_width, int src_height, int src_stride,
+            uint8_t*       dst, int dst_width, int dst_height, int dst_stride,
+            PixelFormat format, ResizeFilter filter, ThreadPool* pool)
+{
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0)
+        return false;
+    // Planes and palette indices can't be filtered as interleaved channels.
+    if (PIXEL_FORMAT_IS_PLANAR(format) || PIXEL_FORMAT_HAS_PALETTE(format))
+        return false;
+
+    ResizeJob job;
+    job.Channels  = PIXEL_FORMAT_SIZE(format);
+    job.HasAlpha  = PIXEL_FORMAT_HAS_ALPHA(format) != 0;
+    job.Src       = src;
+    job.SrcWidth  = src_width;
+    job.SrcStride = src_stride == 0 ? src_width * job.Channels : src_stride;
+    job.Dst       = dst;
+    job.DstWidth  = dst_width;
+    job.DstStride = dst_stride == 0 ? dst_width * job.Channels : dst_stride;
+    job.RowFloats = AlignRowFloats(dst_width * job.Channels);
+
+    ComputeTaps(job.Horizontal, src_width, dst_width, filter);
+    ComputeTaps(job.Vertical, src_height, dst_height, filter);
+
+    // Only source rows reached by vertical taps are filtered horizontally.
+    job.FirstRow = job.Vertical.First[0];
+    int row_count = job.Vertical.First[dst_height - 1] + job.Vertical.TapCount - job.FirstRow;
+    if (job.FirstRow + row_count > src_height)
+        row_count = src_height - job.FirstRow;
+
+    ImVector<float> rows;
+    rows.resize(row_count * job.RowFloats);
+    memset(rows.Data, 0, sizeof(float) * rows.Size);
+    job.Rows = rows.Data;
+
+    if (pool)
+    {
+        pool->ParallelFor(row_count, FilterRowsHorizontal, &job);
+        pool->ParallelFor(dst_height, FilterRowsVertical, &job);
+    }
+    else
+    {
+        FilterRowsHorizontal(0, row_count, &job);
+        FilterRowsVertical(0, dst_height, &job);
+    }
+    return true;
+}
+
+void FitSize(int width, int height, int max_width, int max_height, int* out_width, int* out_height)
+{
+    float scale = 1.0f;
+    if (width > max_width)
+        scale = (float)max_width / width;
+    if (height * scale > max_height)
+        scale = (float)max_height / height;
+
+    *out_width  = (int)(width * scale + 0.5f);
+    *out_height = (int)(height * scale + 0.5f);
+    if (*out_width < 1)
+        *out_width = 1;
+    if (*out_height < 1)
+        *out_height = 1;
+}
+
+}
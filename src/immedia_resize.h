@@ -0,0 +1,33 @@
+// Image resampling with separable filters.
+//
+// Color channels are filtered premultiplied by alpha, so transparent pixels don't bleed into edges.
+//
+//     ImMedia::ThreadPool pool;
+//     ImMedia::Resize(pixels, 1920, 1080, 0, thumbnail, 192, 108, 0,
+//                     ImMedia::PixelFormat::RGBA8888, ImMedia::ResizeFilter::Lanczos3, &pool);
+//
+
+#ifndef IMMEDIA_RESIZE_H
+#define IMMEDIA_RESIZE_H
+
+#include "immedia_image.h"
+#include "immedia_thread_pool.h"
+
+namespace ImMedia {
+
+/// @brief Resample pixels into caller's buffer.
+/// @param src_stride Bytes between two rows of source, 0 if rows are tightly packed.
+/// @param dst_stride Bytes between two rows of destination, 0 if rows are tightly packed.
+/// @param format Interleaved formats only: RGB888, RGBA8888, L8 or LA88. Convert YUV420P and Indexed8 first.
+/// @param pool [nullable] Rows are split into bands across the pool threads, null to run on the calling thread.
+/// @return false if a size is not positive or the format is planar or has a palette.
+bool Resize(const uint8_t* src, int src_width, int src_height, int src_stride,
+            uint8_t*       dst, int dst_width, int dst_height, int dst_stride,
+            PixelFormat format, ResizeFilter filter = ResizeFilter::Lanczos3, ThreadPool* pool = nullptr);
+
+/// @brief Compute the largest size fitting in max_width x max_height with the same aspect ratio, never upscaled.
+void FitSize(int width, int height, int max_width, int max_height, int* out_width, int* out_height);
+
+}
+
+#endif // !IMMEDIA_RESIZE_H
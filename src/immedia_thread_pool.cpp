@@ -0,0 +1,162 @@
+#include "immedia_thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ImMedia {
+
+struct ThreadPoolJob
+{
+    void (*Func)(void* user_data);
+    void* UserData;
+};
+
+struct ThreadPoolState
+{
+    std::vector<std::thread>  Threads;
+    std::deque<ThreadPoolJob> Jobs;
+    std::mutex                Mutex;
+    std::condition_variable   JobAvailable;
+    std::condition_variable   JobsDone;
+    int                       Running  = 0;
+    bool                      Stopping = false;
+};
+
+static void WorkerMain(ThreadPoolState* state)
+{
+    std::unique_lock<std::mutex> lock(state->Mutex);
+    while (true)
+    {
+        state->JobAvailable.wait(lock, [state] { return state->Stopping || !state->Jobs.empty(); });
+        if (state->Stopping)
+            return;
+
+        ThreadPoolJob job = state->Jobs.front();
+        state->Jobs.pop_front();
+        ++state->Running;
+
+        lock.unlock();
+        job.Func(job.UserData);
+        lock.lock();
+
+        if (--state->Running == 0 && state->Jobs.empty())
+            state->JobsDone.notify_all();
+    }
+}
+
+ThreadPool::ThreadPool(int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = (int)std::thread::hardware_concurrency();
+    if (thread_count <= 0)
+        thread_count = 1;
+
+    State = new ThreadPoolState();
+    State->Threads.reserve(thread_count);
+    for (int i = 0; i < thread_count; ++i)
+        State->Threads.emplace_back(WorkerMain, State);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(State->Mutex);
+        State->Stopping = true;
+        State->Jobs.clear();
+    }
+    State->JobAvailable.notify_all();
+    for (std::thread& thread : State->Threads)
+        thread.join();
+    delete State;
+}
+
+int ThreadPool::GetThreadCount() const
+{
+    return (int)State->Threads.size();
+}
+
+void ThreadPool::Submit(void (*job)(void* user_data), void* user_data)
+{
+    {
+        std::lock_guard<std::mutex> lock(State->Mutex);
+        State->Jobs.push_back({ job, user_data });
+    }
+    State->JobAvailable.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(State->Mutex);
+    State->JobsDone.wait(lock, [this] { return State->Running == 0 && State->Jobs.empty(); });
+}
+
+// Shared by the caller and helper jobs, the last one to leave deletes it,
+// so the caller doesn't wait for helpers still queued behind other jobs.
+struct ParallelForRange
+{
+    void (*Func)(int begin, int end, void* user_data);
+    void*            UserData;
+    int              Count;
+    int              Step;
+    std::atomic<int> Next;
+    std::atomic<int> Remaining;
+    std::atomic<int> References;
+};
+
+static void RunParallelForRanges(ParallelForRange* range)
+{
+    while (true)
+    {
+        int begin = range->Next.fetch_add(range->Step);
+        if (begin >= range->Count)
+            break;
+        int end = begin + range->Step < range->Count ? begin + range->Step : range->Count;
+        range->Func(begin, end, range->UserData);
+        range->Remaining.fetch_sub(end - begin);
+    }
+}
+
+static void ReleaseParallelForRange(ParallelForRange* range)
+{
+    if (range->References.fetch_sub(1) == 1)
+        delete range;
+}
+
+void ThreadPool::ParallelFor(int count, void (*job)(int begin, int end, void* user_data), void* user_data)
+{
+    if (count <= 0)
+        return;
+
+    const int thread_count = GetThreadCount() + 1;
+    const int chunk_count  = thread_count * 4 < count ? thread_count * 4 : count;
+    const int helper_count = thread_count - 1 < chunk_count - 1 ? thread_count - 1 : chunk_count - 1;
+
+    ParallelForRange* range = new ParallelForRange();
+    range->Func     = job;
+    range->UserData = user_data;
+    range->Count    = count;
+    range->Step     = (count + chunk_count - 1) / chunk_count;
+    range->Next.store(0);
+    range->Remaining.store(count);
+    range->References.store(helper_count + 1);
+
+    for (int i = 0; i < helper_count; ++i)
+    {
+        Submit([](void* p) {
+            ParallelForRange* range = reinterpret_cast<ParallelForRange*>(p);
+            RunParallelForRanges(range);
+            ReleaseParallelForRange(range);
+        }, range);
+    }
+
+    RunParallelForRanges(range);
+    while (range->Remaining.load() > 0)
+        std::this_thread::yield();
+    ReleaseParallelForRange(range);
+}
+
+}
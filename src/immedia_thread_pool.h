@@ -0,0 +1,43 @@
+// Worker threads used by immedia for background decoding.
+//
+// Jobs are plain function pointers with user data, they must not throw.
+//
+
+#ifndef IMMEDIA_THREAD_POOL_H
+#define IMMEDIA_THREAD_POOL_H
+
+namespace ImMedia {
+
+struct ThreadPoolState;
+
+class ThreadPool
+{
+public:
+    /// @param thread_count 0 to use the number of hardware threads.
+    explicit ThreadPool(int thread_count = 0);
+
+    /// @brief Stop worker threads, jobs not started yet are discarded.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int GetThreadCount() const;
+
+    /// @brief Run job on a worker thread. Thread-safe.
+    void Submit(void (*job)(void* user_data), void* user_data);
+
+    /// @brief Block until all submitted jobs are finished.
+    void Wait();
+
+    /// @brief Split [0, count) into ranges and run them on worker threads, block until finished.
+    ///        The calling thread runs a range too, so it is safe to call with a busy pool.
+    void ParallelFor(int count, void (*job)(int begin, int end, void* user_data), void* user_data);
+
+private:
+    ThreadPoolState* State;
+};
+
+}
+
+#endif // !IMMEDIA_THREAD_POOL_H
@@ -0,0 +1,246 @@
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include "immedia_trace.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace ImMedia {
+
+#ifdef IMMEDIA_ENABLE_TRACE
+
+// Fields are atomic so an exporting thread can read slots while the owner overwrites them,
+// relaxed accesses compile to plain moves.
+struct TraceEvent
+{
+    std::atomic<const char*> Name;
+    std::atomic<uint64_t>    Begin;
+    std::atomic<uint64_t>    End;
+};
+
+// Single writer ring, an event is stored at its index modulo buffer size.
+// Reserved is bumped before a slot is written and Written after, readers drop slots overwritten while copying.
+struct TraceBuffer
+{
+    TraceEvent            Events[IMMEDIA_TRACE_BUFFER_SIZE];
+    std::atomic<uint64_t> Reserved{ 0 };
+    std::atomic<uint64_t> Written{ 0 };
+    uint64_t              Cleared  = 0;  // Index of the first event of current trace, guarded by TraceState::Mutex.
+    uint64_t              Flushed  = 0;  // Index of the first event not streamed yet, guarded by TraceState::Mutex.
+    int                   ThreadId = 0;
+};
+
+struct TraceEventCopy
+{
+    const char* Name;
+    uint64_t    Begin;
+    uint64_t    End;
+    int         ThreadId;
+};
+
+struct TraceState
+{
+    std::atomic<bool>         Enabled{ false };
+    std::mutex                Mutex;  // Taken once per recording thread and by exports, never while recording.
+    std::vector<TraceBuffer*> Buffers;
+    FILE*                     Stream = nullptr;
+    bool                      StreamHasEvents = false;
+
+    // Buffers are kept for the lifetime of process, threads hold them in thread_local pointers.
+    ~TraceState()
+    {
+        for (TraceBuffer* buffer : Buffers)
+            delete buffer;
+    }
+};
+
+static TraceState g_trace;
+static thread_local TraceBuffer* t_trace_buffer = nullptr;
+
+static TraceBuffer* CreateTraceBuffer()
+{
+    TraceBuffer* buffer = new TraceBuffer();
+    std::lock_guard<std::mutex> lock(g_trace.Mutex);
+    g_trace.Buffers.push_back(buffer);
+    buffer->ThreadId = (int)g_trace.Buffers.size();
+    return buffer;
+}
+
+// Copy events from index first on, the ones overwritten by the owner meanwhile are dropped.
+static void CopyTraceEvents(TraceBuffer* buffer, uint64_t first, std::vector<TraceEventCopy>& events, uint64_t* end)
+{
+    const uint64_t written = buffer->Written.load(std::memory_order_acquire);
+    const uint64_t begin = std::max(std::max(first, buffer->Cleared), written > IMMEDIA_TRACE_BUFFER_SIZE ? written - IMMEDIA_TRACE_BUFFER_SIZE : 0);
+
+    const size_t offset = events.size();
+    for (uint64_t i = begin; i < written; ++i)
+    {
+        const TraceEvent& event = buffer->Events[i % IMMEDIA_TRACE_BUFFER_SIZE];
+        events.push_back({ event.Name.load(std::memory_order_relaxed),
+                           event.Begin.load(std::memory_order_relaxed),
+                           event.End.load(std::memory_order_relaxed),
+                           buffer->ThreadId });
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reserved = buffer->Reserved.load(std::memory_order_relaxed);
+    if (reserved > IMMEDIA_TRACE_BUFFER_SIZE && reserved - IMMEDIA_TRACE_BUFFER_SIZE > begin)
+    {
+        const uint64_t dropped = std::min(reserved - IMMEDIA_TRACE_BUFFER_SIZE, written) - begin;
+        events.erase(events.begin() + offset, events.begin() + offset + (size_t)dropped);
+    }
+    *end = written;
+}
+
+static void WriteTraceEvents(FILE* f, const std::vector<TraceEventCopy>& events, bool* has_events)
+{
+    for (const TraceEventCopy& event : events)
+    {
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"immedia\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                *has_events ? "," : "", event.Name, event.ThreadId,
+                (double)event.Begin / 1000.0, (double)(event.End - event.Begin) / 1000.0);
+        *has_events = true;
+    }
+}
+
+// Must be called with TraceState::Mutex locked.
+static void FlushTraceLocked()
+{
+    if (!g_trace.Stream)
+        return;
+    std::vector<TraceEventCopy> events;
+    for (TraceBuffer* buffer : g_trace.Buffers)
+        CopyTraceEvents(buffer, buffer->Flushed, events, &buffer->Flushed);
+    WriteTraceEvents(g_trace.Stream, events, &g_trace.StreamHasEvents);
+    fflush(g_trace.Stream);
+}
+
+#endif // IMMEDIA_ENABLE_TRACE
+
+bool BeginTrace(const char* stream_filename)
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    EndTrace();
+
+    std::lock_guard<std::mutex> lock(g_trace.Mutex);
+    for (TraceBuffer* buffer : g_trace.Buffers)
+    {
+        buffer->Cleared = buffer->Written.load(std::memory_order_acquire);
+        buffer->Flushed = buffer->Cleared;
+    }
+
+    bool opened = true;
+    if (stream_filename)
+    {
+        g_trace.Stream = fopen(stream_filename, "wb");
+        g_trace.StreamHasEvents = false;
+        opened = g_trace.Stream != nullptr;
+        if (opened)
+            fputs("[", g_trace.Stream);
+    }
+    g_trace.Enabled.store(true, std::memory_order_release);
+    return opened;
+#else
+    (void)stream_filename;
+    return false;
+#endif
+}
+
+void EndTrace()
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    g_trace.Enabled.store(false, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(g_trace.Mutex);
+    if (g_trace.Stream)
+    {
+        FlushTraceLocked();
+        fputs("\n]\n", g_trace.Stream);
+        fclose(g_trace.Stream);
+        g_trace.Stream = nullptr;
+    }
+#endif
+}
+
+void FlushTrace()
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    std::lock_guard<std::mutex> lock(g_trace.Mutex);
+    FlushTraceLocked();
+#endif
+}
+
+bool WriteTrace(const char* filename)
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    FILE* f = fopen(filename, "wb");
+    if (!f)
+        return false;
+
+    std::vector<TraceEventCopy> events;
+    {
+        std::lock_guard<std::mutex> lock(g_trace.Mutex);
+        for (TraceBuffer* buffer : g_trace.Buffers)
+        {
+            uint64_t end;
+            CopyTraceEvents(buffer, 0, events, &end);
+        }
+    }
+
+    bool has_events = false;
+    fputs("[", f);
+    WriteTraceEvents(f, events, &has_events);
+    fputs("\n]\n", f);
+    return fclose(f) == 0;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+bool IsTracing()
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    return g_trace.Enabled.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+uint64_t GetTraceTime()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordTraceEvent(const char* name, uint64_t begin_time, uint64_t end_time)
+{
+#ifdef IMMEDIA_ENABLE_TRACE
+    TraceBuffer* buffer = t_trace_buffer;
+    if (!buffer)
+        buffer = t_trace_buffer = CreateTraceBuffer();
+
+    const uint64_t index = buffer->Written.load(std::memory_order_relaxed);
+    buffer->Reserved.store(index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    TraceEvent& event = buffer->Events[index % IMMEDIA_TRACE_BUFFER_SIZE];
+    event.Name.store(name, std::memory_order_relaxed);
+    event.Begin.store(begin_time, std::memory_order_relaxed);
+    event.End.store(end_time, std::memory_order_relaxed);
+    buffer->Written.store(index + 1, std::memory_order_release);
+#else
+    (void)name;
+    (void)begin_time;
+    (void)end_time;
+#endif
+}
+
+}
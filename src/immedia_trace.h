@@ -0,0 +1,84 @@
+// Scoped trace events of decoding, uploading and drawing, exported as Chrome trace JSON for Perfetto or chrome://tracing.
+//
+// Compiled out unless IMMEDIA_ENABLE_TRACE is defined, the macros expand to nothing and the functions do nothing.
+// Each thread records into its own ring buffer without locks, the oldest events are overwritten when it is full.
+//
+//     ImMedia::BeginTrace();
+//     // ...
+//     ImMedia::WriteTrace("immedia.json");
+//     ImMedia::EndTrace();
+//
+// Or stream events to file while recording, they are appended in @ref EndFrame:
+//
+//     ImMedia::BeginTrace("immedia.json");
+//
+// Timestamps are of std::chrono::steady_clock, so spans of the application on the same clock line up.
+// Application spans can be recorded with IMMEDIA_TRACE_SCOPE too.
+//
+
+#ifndef IMMEDIA_TRACE_H
+#define IMMEDIA_TRACE_H
+
+#include <stdint.h>
+
+namespace ImMedia {
+
+// Events kept per thread.
+#ifndef IMMEDIA_TRACE_BUFFER_SIZE
+#define IMMEDIA_TRACE_BUFFER_SIZE 16384
+#endif
+
+/// @brief Clear recorded events and start recording.
+/// @param stream_filename [nullable] File to stream events to, null to keep them in memory only.
+/// @return false if the file can't be opened, events are still recorded.
+bool BeginTrace(const char* stream_filename = nullptr);
+
+/// @brief Stop recording, the rest of events are written to the stream and it is closed.
+void EndTrace();
+
+/// @brief Write events of the stream recorded since the last flush, called by @ref EndFrame.
+void FlushTrace();
+
+/// @brief Write events in ring buffers as a JSON array, it doesn't affect the stream.
+/// @return false if the file can't be written.
+bool WriteTrace(const char* filename);
+
+bool IsTracing();
+
+/// @brief Nanoseconds of steady_clock.
+uint64_t GetTraceTime();
+
+/// @brief Record a complete event on the current thread, lock-free.
+/// @param name String literal, it is written to JSON as is.
+void RecordTraceEvent(const char* name, uint64_t begin_time, uint64_t end_time);
+
+#ifdef IMMEDIA_ENABLE_TRACE
+
+struct TraceScope
+{
+    const char* Name;
+    uint64_t    Begin;
+
+    explicit TraceScope(const char* name) : Name(name), Begin(IsTracing() ? GetTraceTime() : 0) {}
+    ~TraceScope() { if (Begin != 0) RecordTraceEvent(Name, Begin, GetTraceTime()); }
+};
+
+#define IMMEDIA_TRACE_CONCAT_(A, B) A##B
+#define IMMEDIA_TRACE_CONCAT(A, B)  IMMEDIA_TRACE_CONCAT_(A, B)
+
+/// @brief Record the rest of enclosing scope.
+#define IMMEDIA_TRACE_SCOPE(NAME) ::ImMedia::TraceScope IMMEDIA_TRACE_CONCAT(immedia_trace_scope_, __LINE__)(NAME)
+
+/// @brief Record an expression and yield its value.
+#define IMMEDIA_TRACE_CALL(NAME, ...) ([&]() { IMMEDIA_TRACE_SCOPE(NAME); return __VA_ARGS__; }())
+
+#else
+
+#define IMMEDIA_TRACE_SCOPE(NAME)
+#define IMMEDIA_TRACE_CALL(NAME, ...) (__VA_ARGS__)
+
+#endif // IMMEDIA_ENABLE_TRACE
+
+}
+
+#endif // !IMMEDIA_TRACE_H
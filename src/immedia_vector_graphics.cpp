@@ -3,6 +3,7 @@
 
 #include "imgui_internal.h"
 
+#include "immedia_trace.h"
 #include "immedia_vector_graphics.h"
 
 namespace ImMedia {
@@ -177,6 +178,7 @@ void VectorGraphics::Show(const ImVec2& size) const
 
 void VectorGraphics::Draw(ImDrawList* draw_list, const ImVec2& p1, const ImVec2& p2) const
 {
+    IMMEDIA_TRACE_SCOPE("VectorGraphics::Draw");
     const ImVec2 size = p2 - p1;
     const float  scale = (float)fmin(size.x / Size.x, size.y / Size.y);
     const ImVec2 offset = ImVec2((size.x - Size.x * scale) / 2, (size.y - Size.y * scale) / 2) + p1;
@@ -11,6 +11,14 @@
 // 
 //     IMMEDIA_RENDERER_OPENGL3_USE_LINEAR_FILTER
 //     IMMEDIA_RENDERER_OPENGL3_USE_MIPMAP
+//     IMMEDIA_RENDERER_OPENGL3_USE_PBO        Stream animation and StreamImage frames through a ring of pixel buffers.
+//     IMMEDIA_RENDERER_OPENGL3_EXPAND_RGB     Store RGB888 images as RGBA textures, for drivers with slow 3 bytes uploads.
+//                                             Requires immedia_pixel_convert.cpp.
+//     IMMEDIA_RENDERER_OPENGL3_GLSL_VERSION   Version line of the YUV conversion shaders, "#version 150\n" by default.
+//
+// YUV420P images are uploaded as three GL_R8 planes, Indexed8 images as GL_R8 indices and a 256 x 1 palette,
+// a shader pass draws them into the RGBA texture. Planes of still images are deleted after the pass.
+// L8 and LA88 images are stored as GL_R8 and GL_RG8 textures, swizzled to RGBA when sampled, OpenGL 3.3 or ES 3.0.
 //
 
 #ifndef IMMEDIA_RENDERER_OPENGL3_H
@@ -25,35 +33,396 @@ void ImMedia_RendererOpenGL3_Install();
 #ifdef IMMEDIA_RENDERER_OPENGL3_IMPL
 
 #include "immedia_image.h"
+#ifdef IMMEDIA_RENDERER_OPENGL3_EXPAND_RGB
+#include "immedia_pixel_convert.h"
+#endif
+
+#define IMMEDIA_RENDERER_OPENGL3_PBO_COUNT 2
+
+#ifndef IMMEDIA_RENDERER_OPENGL3_GLSL_VERSION
+#define IMMEDIA_RENDERER_OPENGL3_GLSL_VERSION "#version 150\n"
+#endif
 
 struct OpenGL3RendererContext
 {
     int    Width;
     int    Height;
     int    Format;
+    int    InternalFormat;
+    int    PixelSize;
+    bool   ExpandRGB;
+    bool   Allocated;
+    bool   HasAnim;
     GLuint Texture;
+
+    // Planar and palette formats are uploaded as planes and drawn into Texture.
+    bool   HasPlanes;
+    ImMedia::PixelFormat PlaneFormat;
+    GLuint Planes[3];    // Y, U, V or indices, palette.
+    GLuint Framebuffer;
+
+    GLuint PixelBuffers[IMMEDIA_RENDERER_OPENGL3_PBO_COUNT];
+    int    PixelBufferIndex;
+};
+
+struct OpenGL3Plane
+{
+    int    Width;
+    int    Height;
+    GLint  InternalFormat;
+    GLenum Format;
+    GLint  Filter;
+    size_t Offset;  // Bytes from the start of frame.
 };
 
+static bool g_ImMediaOpenGL3InUploadBatch = false;
+
+// Shared by all contexts with planes, alive until the OpenGL context is destroyed.
+static GLuint g_ImMediaOpenGL3PlaneVertexArray = 0;
+static GLuint g_ImMediaOpenGL3YUVProgram       = 0;
+static GLuint g_ImMediaOpenGL3PaletteProgram   = 0;
+static bool   g_ImMediaOpenGL3YUVFailed        = false;
+static bool   g_ImMediaOpenGL3PaletteFailed    = false;
+static int    g_ImMediaOpenGL3HasSwizzle       = -1;
+
+// A single triangle covering the texture, positions come from gl_VertexID so no vertex buffer is needed.
+static const char* g_ImMediaOpenGL3PlaneVertexShader =
+    "out vec2 UV;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 position = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+    "    UV = position;\n"
+    "    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+// Full range BT.601 as in JFIF. ChromaScale maps UV into chroma planes padded to even size.
+static const char* g_ImMediaOpenGL3YUVFragmentShader =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "in vec2 UV;\n"
+    "uniform sampler2D Plane0;\n"
+    "uniform sampler2D Plane1;\n"
+    "uniform sampler2D Plane2;\n"
+    "uniform vec2 ChromaScale;\n"
+    "out vec4 Color;\n"
+    "void main()\n"
+    "{\n"
+    "    float y = texture(Plane0, UV).r;\n"
+    "    float u = texture(Plane1, UV * ChromaScale).r - 0.5;\n"
+    "    float v = texture(Plane2, UV * ChromaScale).r - 0.5;\n"
+    "    Color = vec4(y + 1.402 * v, y - 0.344136 * u - 0.714136 * v, y + 1.772 * u, 1.0);\n"
+    "}\n";
+
+// Indices are fetched without filtering, then looked up in the 256 x 1 palette.
+static const char* g_ImMediaOpenGL3PaletteFragmentShader =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D Plane0;\n"
+    "uniform sampler2D Plane1;\n"
+    "out vec4 Color;\n"
+    "void main()\n"
+    "{\n"
+    "    int index = int(texelFetch(Plane0, ivec2(gl_FragCoord.xy), 0).r * 255.0 + 0.5);\n"
+    "    Color = texelFetch(Plane1, ivec2(index, 0), 0);\n"
+    "}\n";
+
+static GLuint ImMedia_RendererOpenGL3_CompileShader(GLenum type, const char* source)
+{
+    const char* sources[] = { IMMEDIA_RENDERER_OPENGL3_GLSL_VERSION, source };
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 2, sources, nullptr);
+    glCompileShader(shader);
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE)
+    {
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static GLuint ImMedia_RendererOpenGL3_CreateProgram(const char* fragment_shader)
+{
+    GLuint vertex   = ImMedia_RendererOpenGL3_CompileShader(GL_VERTEX_SHADER, g_ImMediaOpenGL3PlaneVertexShader);
+    GLuint fragment = ImMedia_RendererOpenGL3_CompileShader(GL_FRAGMENT_SHADER, fragment_shader);
+    GLuint program  = 0;
+    if (vertex && fragment)
+    {
+        program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        glLinkProgram(program);
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        glDetachShader(program, vertex);
+        glDetachShader(program, fragment);
+        if (status != GL_TRUE)
+        {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+    if (vertex)   glDeleteShader(vertex);
+    if (fragment) glDeleteShader(fragment);
+
+    if (program && !g_ImMediaOpenGL3PlaneVertexArray)
+        glGenVertexArrays(1, &g_ImMediaOpenGL3PlaneVertexArray);
+    return program;
+}
+
+// Texture swizzle is core since OpenGL 3.3 and OpenGL ES 3.0, checked on first use.
+static bool ImMedia_RendererOpenGL3_HasSwizzle()
+{
+#ifdef GL_TEXTURE_SWIZZLE_R
+    if (g_ImMediaOpenGL3HasSwizzle < 0)
+    {
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        const bool  is_es   = version && strncmp(version, "OpenGL ES", 9) == 0;
+        g_ImMediaOpenGL3HasSwizzle = (is_es ? major >= 3 : major > 3 || (major == 3 && minor >= 3)) ? 1 : 0;
+    }
+    return g_ImMediaOpenGL3HasSwizzle == 1;
+#else
+    return false;
+#endif
+}
+
+// Compiled on first use, 0 if the format has no planes or the shaders failed to compile.
+static GLuint ImMedia_RendererOpenGL3_GetPlaneProgram(ImMedia::PixelFormat format)
+{
+    GLuint*     program;
+    bool*       failed;
+    const char* fragment_shader;
+    switch (format)
+    {
+    case ImMedia::PixelFormat::YUV420P:
+        program         = &g_ImMediaOpenGL3YUVProgram;
+        failed          = &g_ImMediaOpenGL3YUVFailed;
+        fragment_shader = g_ImMediaOpenGL3YUVFragmentShader;
+        break;
+    case ImMedia::PixelFormat::Indexed8:
+        program         = &g_ImMediaOpenGL3PaletteProgram;
+        failed          = &g_ImMediaOpenGL3PaletteFailed;
+        fragment_shader = g_ImMediaOpenGL3PaletteFragmentShader;
+        break;
+    default:
+        return 0;
+    }
+    if (!*program && !*failed)
+    {
+        *program = ImMedia_RendererOpenGL3_CreateProgram(fragment_shader);
+        *failed  = *program == 0;
+    }
+    return *program;
+}
+
+static int ImMedia_RendererOpenGL3_GetPlanes(const OpenGL3RendererContext* ctx, OpenGL3Plane* planes)
+{
+    const size_t luma_size = (size_t)ctx->Width * ctx->Height;
+    if (ctx->PlaneFormat == ImMedia::PixelFormat::YUV420P)
+    {
+        const int chroma_width  = (ctx->Width  + 1) / 2;
+        const int chroma_height = (ctx->Height + 1) / 2;
+        planes[0] = { ctx->Width,   ctx->Height,   GL_R8, GL_RED, GL_LINEAR, 0 };
+        planes[1] = { chroma_width, chroma_height, GL_R8, GL_RED, GL_LINEAR, luma_size };
+        planes[2] = { chroma_width, chroma_height, GL_R8, GL_RED, GL_LINEAR, luma_size + (size_t)chroma_width * chroma_height };
+        return 3;
+    }
+    planes[0] = { ctx->Width, ctx->Height, GL_R8,    GL_RED,  GL_NEAREST, 0 };
+    planes[1] = { 256,        1,           GL_RGBA8, GL_RGBA, GL_NEAREST, luma_size };
+    return 2;
+}
+
+static void ImMedia_RendererOpenGL3_CreatePlanes(OpenGL3RendererContext* ctx)
+{
+    OpenGL3Plane planes[3];
+    const int plane_count = ImMedia_RendererOpenGL3_GetPlanes(ctx, planes);
+    glGenTextures(plane_count, ctx->Planes);
+    for (int i = 0; i < plane_count; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, ctx->Planes[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, planes[i].Filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, planes[i].Filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, planes[i].InternalFormat, planes[i].Width, planes[i].Height, 0,
+                     planes[i].Format, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, ctx->Texture);
+    if (!ctx->Allocated)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, ctx->InternalFormat, ctx->Width, ctx->Height, 0, ctx->Format, GL_UNSIGNED_BYTE, nullptr);
+        ctx->Allocated = true;
+    }
+
+    GLint last_framebuffer;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
+    glGenFramebuffers(1, &ctx->Framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->Framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ctx->Texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)last_framebuffer);
+}
+
+static void ImMedia_RendererOpenGL3_DeletePlanes(OpenGL3RendererContext* ctx)
+{
+    for (int i = 0; i < 3; ++i)
+        if (ctx->Planes[i])
+            glDeleteTextures(1, &ctx->Planes[i]);
+    if (ctx->Framebuffer)
+        glDeleteFramebuffers(1, &ctx->Framebuffer);
+    ctx->Planes[0] = ctx->Planes[1] = ctx->Planes[2] = 0;
+    ctx->Framebuffer = 0;
+}
+
+// Upload planes, then draw them into Texture. State changed by the pass is restored, it may run inside user rendering.
+static void ImMedia_RendererOpenGL3_WritePlanes(OpenGL3RendererContext* ctx, const uint8_t* pixels)
+{
+    if (!ctx->Planes[0])
+        ImMedia_RendererOpenGL3_CreatePlanes(ctx);
+
+    OpenGL3Plane planes[3];
+    const int plane_count = ImMedia_RendererOpenGL3_GetPlanes(ctx, planes);
+
+    if (!g_ImMediaOpenGL3InUploadBatch)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < plane_count; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, ctx->Planes[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planes[i].Width, planes[i].Height,
+                        planes[i].Format, GL_UNSIGNED_BYTE, pixels + planes[i].Offset);
+    }
+    if (!g_ImMediaOpenGL3InUploadBatch)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    GLint last_framebuffer, last_program, last_vertex_array, last_active_texture, last_viewport[4];
+    GLint last_textures[3];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &last_framebuffer);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &last_program);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &last_vertex_array);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &last_active_texture);
+    glGetIntegerv(GL_VIEWPORT, last_viewport);
+    const GLboolean last_blend   = glIsEnabled(GL_BLEND);
+    const GLboolean last_scissor = glIsEnabled(GL_SCISSOR_TEST);
+    const GLboolean last_depth   = glIsEnabled(GL_DEPTH_TEST);
+    const GLboolean last_stencil = glIsEnabled(GL_STENCIL_TEST);
+    const GLboolean last_cull    = glIsEnabled(GL_CULL_FACE);
+
+    static const char* sampler_names[] = { "Plane0", "Plane1", "Plane2" };
+    const GLuint program = ImMedia_RendererOpenGL3_GetPlaneProgram(ctx->PlaneFormat);
+    glBindFramebuffer(GL_FRAMEBUFFER, ctx->Framebuffer);
+    glViewport(0, 0, ctx->Width, ctx->Height);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_CULL_FACE);
+    glUseProgram(program);
+    if (ctx->PlaneFormat == ImMedia::PixelFormat::YUV420P)
+        glUniform2f(glGetUniformLocation(program, "ChromaScale"),
+                    (float)ctx->Width / (float)(planes[1].Width * 2), (float)ctx->Height / (float)(planes[1].Height * 2));
+    for (int i = 0; i < plane_count; ++i)
+    {
+        glUniform1i(glGetUniformLocation(program, sampler_names[i]), i);
+        glActiveTexture(GL_TEXTURE0 + i);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_textures[i]);
+        glBindTexture(GL_TEXTURE_2D, ctx->Planes[i]);
+    }
+    glBindVertexArray(g_ImMediaOpenGL3PlaneVertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    for (int i = 0; i < plane_count; ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, (GLuint)last_textures[i]);
+    }
+    glActiveTexture((GLenum)last_active_texture);
+    glBindVertexArray((GLuint)last_vertex_array);
+    glUseProgram((GLuint)last_program);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)last_framebuffer);
+    glViewport(last_viewport[0], last_viewport[1], (GLsizei)last_viewport[2], (GLsizei)last_viewport[3]);
+    if (last_blend)   glEnable(GL_BLEND);
+    if (last_scissor) glEnable(GL_SCISSOR_TEST);
+    if (last_depth)   glEnable(GL_DEPTH_TEST);
+    if (last_stencil) glEnable(GL_STENCIL_TEST);
+    if (last_cull)    glEnable(GL_CULL_FACE);
+
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_MIPMAP
+    glBindTexture(GL_TEXTURE_2D, ctx->Texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+#endif
+
+    if (!ctx->HasAnim)
+        ImMedia_RendererOpenGL3_DeletePlanes(ctx);
+}
+
 void* ImMedia_RendererOpenGL3_CreateContext(int width, int height, ImMedia::PixelFormat format, bool has_anim)
 {
     OpenGL3RendererContext* ctx = new OpenGL3RendererContext();
-    ctx->Width  = width;
-    ctx->Height = height;
-    ctx->Format = GL_NONE;
+    ctx->Width     = width;
+    ctx->Height    = height;
+    ctx->Format    = GL_NONE;
+    ctx->PixelSize = PIXEL_FORMAT_SIZE(format);
+    ctx->HasAnim   = has_anim;
     switch (format)
     {
     case ImMedia::PixelFormat::RGB888:   ctx->Format = GL_RGB;  break;
     case ImMedia::PixelFormat::RGBA8888: ctx->Format = GL_RGBA; break;
+    case ImMedia::PixelFormat::L8:       ctx->Format = GL_RED;  break;
+    case ImMedia::PixelFormat::LA88:     ctx->Format = GL_RG;   break;
+    case ImMedia::PixelFormat::YUV420P:
+    case ImMedia::PixelFormat::Indexed8:
+        ctx->Format      = GL_RGBA;
+        ctx->HasPlanes   = true;
+        ctx->PlaneFormat = format;
+        break;
+    }
+#ifdef IMMEDIA_RENDERER_OPENGL3_EXPAND_RGB
+    if (ctx->Format == GL_RGB)
+    {
+        ctx->Format    = GL_RGBA;
+        ctx->ExpandRGB = true;
     }
+#endif
+    ctx->InternalFormat = ctx->Format == GL_RED ? GL_R8 : ctx->Format == GL_RG ? GL_RG8 : ctx->Format;
     glGenTextures(1, &ctx->Texture);
     glBindTexture(GL_TEXTURE_2D, ctx->Texture);
 
+#ifdef GL_TEXTURE_SWIZZLE_R
+    if (ctx->Format == GL_RED || ctx->Format == GL_RG)
+    {
+        // Gray is replicated to color channels, alpha of L8 is opaque.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, ctx->Format == GL_RED ? GL_ONE : GL_GREEN);
+    }
+#endif
+
 #ifdef IMMEDIA_RENDERER_OPENGL3_USE_LINEAR_FILTER
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 #else
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 #endif
 
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_MIPMAP
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+#else
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+#endif
+
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_PBO
+    if (has_anim)
+        glGenBuffers(IMMEDIA_RENDERER_OPENGL3_PBO_COUNT, ctx->PixelBuffers);
+#else
+    IM_UNUSED(has_anim);
+#endif
+
     return ctx;
 }
 
@@ -61,25 +430,89 @@ void ImMedia_RendererOpenGL3_DeleteContext(void* context)
 {
     OpenGL3RendererContext* ctx = reinterpret_cast<OpenGL3RendererContext*>(context);
     glDeleteTextures(1, &ctx->Texture);
+    ImMedia_RendererOpenGL3_DeletePlanes(ctx);
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_PBO
+    if (ctx->PixelBuffers[0])
+        glDeleteBuffers(IMMEDIA_RENDERER_OPENGL3_PBO_COUNT, ctx->PixelBuffers);
+#endif
     delete ctx;
 }
 
-void ImMedia_RendererOpenGL3_WriteFrame(void* context, const uint8_t* pixels)
+void ImMedia_RendererOpenGL3_WriteRegion(void* context, const uint8_t* pixels, int stride, int x, int y, int width, int height)
 {
     OpenGL3RendererContext* ctx = reinterpret_cast<OpenGL3RendererContext*>(context);
-    if (ctx->Format == GL_RGB)
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    int pixel_size = ctx->PixelSize;
+
+#ifdef IMMEDIA_RENDERER_OPENGL3_EXPAND_RGB
+    static ImVector<uint8_t> expanded;
+    if (ctx->ExpandRGB)
+    {
+        expanded.resize(width * height * 4);
+        ImMedia::ConvertPixels(pixels, ImMedia::PixelFormat::RGB888, stride,
+                               expanded.Data, ImMedia::PixelFormat::RGBA8888, 0, width, height);
+        pixels     = expanded.Data;
+        stride     = width * 4;
+        pixel_size = 4;
+    }
+#endif
+
     glBindTexture(GL_TEXTURE_2D, ctx->Texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, ctx->Format, ctx->Width, ctx->Height, 0, ctx->Format, GL_UNSIGNED_BYTE, pixels);
+
+    // Storage is allocated once, later writes never reallocate the texture.
+    if (!ctx->Allocated)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, ctx->InternalFormat, ctx->Width, ctx->Height, 0, ctx->Format, GL_UNSIGNED_BYTE, nullptr);
+        ctx->Allocated = true;
+    }
+
+    if (!g_ImMediaOpenGL3InUploadBatch)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / pixel_size);
+
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_PBO
+    if (ctx->PixelBuffers[0])
+    {
+        const GLsizeiptr size = (GLsizeiptr)stride * (height - 1) + (GLsizeiptr)width * pixel_size;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ctx->PixelBuffers[ctx->PixelBufferIndex]);
+        ctx->PixelBufferIndex = (ctx->PixelBufferIndex + 1) % IMMEDIA_RENDERER_OPENGL3_PBO_COUNT;
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped)
+        {
+            memcpy(mapped, pixels, (size_t)size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pixels = nullptr;
+        }
+        else
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+#endif
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, ctx->Format, GL_UNSIGNED_BYTE, pixels);
+
+#ifdef IMMEDIA_RENDERER_OPENGL3_USE_PBO
+    if (ctx->PixelBuffers[0])
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
 
 #ifdef IMMEDIA_RENDERER_OPENGL3_USE_MIPMAP
     glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-#else
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 #endif
 
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (!g_ImMediaOpenGL3InUploadBatch)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void ImMedia_RendererOpenGL3_WriteFrame(void* context, const uint8_t* pixels)
+{
+    OpenGL3RendererContext* ctx = reinterpret_cast<OpenGL3RendererContext*>(context);
+    if (ctx->HasPlanes)
+    {
+        ImMedia_RendererOpenGL3_WritePlanes(ctx, pixels);
+        return;
+    }
+    ImMedia_RendererOpenGL3_WriteRegion(context, pixels, ctx->Width * ctx->PixelSize, 0, 0, ctx->Width, ctx->Height);
 }
 
 ImTextureID ImMedia_RendererOpenGL3_GetTexture(void* context)
@@ -88,13 +521,37 @@ ImTextureID ImMedia_RendererOpenGL3_GetTexture(void* context)
     return reinterpret_cast<ImTextureID>(ctx->Texture);
 }
 
+// Tightly packed rows are valid for any alignment, so one state change covers the whole batch.
+void ImMedia_RendererOpenGL3_BeginUpload()
+{
+    g_ImMediaOpenGL3InUploadBatch = true;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+}
+
+void ImMedia_RendererOpenGL3_EndUpload()
+{
+    g_ImMediaOpenGL3InUploadBatch = false;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+bool ImMedia_RendererOpenGL3_SupportsFormat(ImMedia::PixelFormat format)
+{
+    if (format == ImMedia::PixelFormat::L8 || format == ImMedia::PixelFormat::LA88)
+        return ImMedia_RendererOpenGL3_HasSwizzle();
+    return ImMedia_RendererOpenGL3_GetPlaneProgram(format) != 0;
+}
+
 void ImMedia_RendererOpenGL3_Install()
 {
     ImMedia::InstallImageRenderer({
         ImMedia_RendererOpenGL3_CreateContext,
         ImMedia_RendererOpenGL3_DeleteContext,
         ImMedia_RendererOpenGL3_WriteFrame,
-        ImMedia_RendererOpenGL3_GetTexture
+        ImMedia_RendererOpenGL3_GetTexture,
+        ImMedia_RendererOpenGL3_BeginUpload,
+        ImMedia_RendererOpenGL3_EndUpload,
+        ImMedia_RendererOpenGL3_WriteRegion,
+        ImMedia_RendererOpenGL3_SupportsFormat
     });
 }
 
@@ -3,6 +3,7 @@
 #include "SDL2/SDL.h"
 
 #include "immedia_image.h"
+#include "immedia_pixel_convert.h"
 
 static SDL_Renderer* GRenderer = nullptr;
 
@@ -23,26 +24,59 @@ static void DeleteContext(void* context)
     SDL_DestroyTexture(reinterpret_cast<SDL_Texture*>(context));
 }
 
-static void WriteFrame(void* context, const uint8_t* pixels)
+// SDL_PIXELFORMAT_BGR888 has 4 bytes texels, so RGB888 rows are expanded while being copied.
+static void CopyPixels(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height, bool has_alpha)
+{
+    if (has_alpha)
+        ImMedia::CopyRows(src, src_stride, dst, dst_stride, (size_t)width * 4, height);
+    else
+        ImMedia::ConvertPixels(src, ImMedia::PixelFormat::RGB888, src_stride,
+                               dst, ImMedia::PixelFormat::RGBA8888, dst_stride, width, height);
+}
+
+static void WriteRegion(void* context, const uint8_t* pixels, int stride, int x, int y, int width, int height)
 {
     SDL_Texture* texture = reinterpret_cast<SDL_Texture*>(context);
 
-    int width, height, access;
+    int access;
     Uint32 format;
-    SDL_QueryTexture(texture, &format, &access, &width, &height);
+    SDL_QueryTexture(texture, &format, &access, nullptr, nullptr);
+    const bool has_alpha = format == SDL_PIXELFORMAT_ABGR8888;
 
+    const SDL_Rect rect = { x, y, width, height };
     if (access == SDL_TEXTUREACCESS_STATIC)
-        SDL_UpdateTexture(texture, nullptr, pixels, width * (format == SDL_PIXELFORMAT_ABGR8888 ? 4 : 3));
+    {
+        if (has_alpha)
+            SDL_UpdateTexture(texture, &rect, pixels, stride);
+        else
+        {
+            static ImVector<uint8_t> expanded;
+            expanded.resize(width * height * 4);
+            CopyPixels(pixels, stride, expanded.Data, width * 4, width, height, false);
+            SDL_UpdateTexture(texture, &rect, expanded.Data, width * 4);
+        }
+    }
     else
     {
         void* texture_pixels;
         int   texture_pitch;
-        SDL_LockTexture(texture, nullptr, &texture_pixels, &texture_pitch);
-        memcpy(texture_pixels, pixels, (size_t)height * texture_pitch);
+        if (SDL_LockTexture(texture, &rect, &texture_pixels, &texture_pitch) != 0)
+            return;
+        CopyPixels(pixels, stride, (uint8_t*)texture_pixels, texture_pitch, width, height, has_alpha);
         SDL_UnlockTexture(texture);
     }
 }
 
+static void WriteFrame(void* context, const uint8_t* pixels)
+{
+    SDL_Texture* texture = reinterpret_cast<SDL_Texture*>(context);
+
+    int width, height;
+    Uint32 format;
+    SDL_QueryTexture(texture, &format, nullptr, &width, &height);
+    WriteRegion(context, pixels, width * (format == SDL_PIXELFORMAT_ABGR8888 ? 4 : 3), 0, 0, width, height);
+}
+
 static ImTextureID GetTexture(void* context)
 {
     return context;
@@ -55,7 +89,11 @@ void ImMedia_RendererSDL2_Install(SDL_Renderer* renderer)
         CreateContext,
         DeleteContext,
         WriteFrame,
-        GetTexture
+        GetTexture,
+        nullptr,
+        nullptr,
+        WriteRegion,
+        nullptr
     });
 }
 
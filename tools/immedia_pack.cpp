@@ -0,0 +1,176 @@
+// Build an ImMedia asset pack from image files, see also src/immedia_pack.h.
+//
+// Usage:
+//   immedia_pack [options] <output.impack> <file>...
+//
+// Options:
+//   --root <dir>   Strip dir from entry names, names are the file paths as given by default.
+//   --pixels       Store still images as raw pixels, nothing is decoded at runtime.
+//   --qoi          Store still images as qoi, smaller than raw pixels and fast to decode.
+//
+// Animated images are always stored as the original file.
+// Build it with immedia sources, imgui, and the stb and qoi decoders:
+//   c++ -std=c++17 -Isrc -Isrc/decoder tools/immedia_pack.cpp src/*.cpp
+//       src/decoder/immedia_decoder_stb.cpp src/decoder/immedia_decoder_qoi.cpp imgui/*.cpp
+//
+
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "immedia_image.h"
+#include "immedia_pack.h"
+#include "immedia_decoder_qoi.h"
+#include "immedia_decoder_stb.h"
+
+// Implemented in immedia_decoder_qoi.cpp.
+#include "qoi.h"
+
+static bool ReadFile(const char* filename, ImVector<uint8_t>& data)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data.resize(size > 0 ? (int)size : 0);
+    bool ok = size > 0 && fread(data.Data, 1, (size_t)size, f) == (size_t)size;
+    fclose(f);
+    return ok;
+}
+
+static const char* GetEntryName(const char* filename, const char* root, ImVector<char>& buffer)
+{
+    size_t root_size = root ? strlen(root) : 0;
+    if (root_size > 0 && strncmp(filename, root, root_size) == 0)
+        filename += root_size;
+    while (*filename == '/' || *filename == '\\')
+        ++filename;
+    if (filename[0] == '.' && (filename[1] == '/' || filename[1] == '\\'))
+        filename += 2;
+
+    buffer.resize((int)strlen(filename) + 1);
+    for (int i = 0; i < buffer.Size; ++i)
+        buffer[i] = filename[i] == '\\' ? '/' : filename[i];
+    return buffer.Data;
+}
+
+static bool AddFile(ImMedia::PackWriter& writer, const char* name, const char* filename, ImMedia::PackEncoding encoding)
+{
+    const char* dot = strrchr(filename, '.');
+    char format[12] = {};
+    for (int i = 0; dot && dot[i + 1] != '\0' && i < (int)sizeof(format) - 1; ++i)
+        format[i] = (char)(dot[i + 1] >= 'A' && dot[i + 1] <= 'Z' ? dot[i + 1] - 'A' + 'a' : dot[i + 1]);
+
+    const ImMedia::ImageDecoder* decoder = ImMedia::GetImageDecoder(format);
+    if (!decoder)
+    {
+        fprintf(stderr, "%s: no decoder for format '%s'\n", filename, format);
+        return false;
+    }
+
+    ImVector<uint8_t> data;
+    if (!ReadFile(filename, data))
+    {
+        fprintf(stderr, "%s: can't read file\n", filename);
+        return false;
+    }
+
+    void* context = decoder->CreateContextFromData(data.Data, (size_t)data.Size);
+    if (!context)
+    {
+        fprintf(stderr, "%s: can't decode file\n", filename);
+        return false;
+    }
+
+    ImMedia::PackEntryInfo info = { format, ImMedia::PackEncoding::Original, 0, 0, ImMedia::PixelFormat::RGBA8888, 0, 0 };
+    decoder->GetInfo(context, &info.Width, &info.Height, &info.Format, &info.FrameCount);
+
+    uint8_t* pixels = nullptr;
+    int      delay;
+    if (encoding != ImMedia::PackEncoding::Original && info.FrameCount == 0
+        && ImMedia::ReadFinalFrame(context, decoder, &pixels, &delay))
+    {
+        if (encoding == ImMedia::PackEncoding::Pixels)
+            writer.AddPixels(name, format, info.Width, info.Height, info.Format, pixels);
+        else
+        {
+            qoi_desc desc;
+            desc.width      = (unsigned int)info.Width;
+            desc.height     = (unsigned int)info.Height;
+            desc.channels   = (unsigned char)PIXEL_FORMAT_SIZE(info.Format);
+            desc.colorspace = QOI_SRGB;
+            int   qoi_size = 0;
+            void* qoi      = qoi_encode(pixels, &desc, &qoi_size);
+            if (qoi)
+            {
+                info.Encoding = ImMedia::PackEncoding::QOI;
+                writer.AddEntry(name, info, (const uint8_t*)qoi, (size_t)qoi_size);
+                free(qoi);
+            }
+            else
+                writer.AddEntry(name, info, data.Data, (size_t)data.Size);
+        }
+    }
+    else
+        writer.AddEntry(name, info, data.Data, (size_t)data.Size);
+
+    decoder->DeleteContext(context);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char*           root     = nullptr;
+    ImMedia::PackEncoding encoding = ImMedia::PackEncoding::Original;
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; ++i)
+    {
+        if (strcmp(argv[i], "--root") == 0 && i + 1 < argc)
+            root = argv[++i];
+        else if (strcmp(argv[i], "--pixels") == 0)
+            encoding = ImMedia::PackEncoding::Pixels;
+        else if (strcmp(argv[i], "--qoi") == 0)
+            encoding = ImMedia::PackEncoding::QOI;
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (argc - i < 2)
+    {
+        fprintf(stderr, "usage: %s [--root <dir>] [--pixels | --qoi] <output.impack> <file>...\n", argv[0]);
+        return 1;
+    }
+    const char* output = argv[i++];
+
+    ImMedia::CreateContext();
+    ImMedia_DecoderSTB_Install(DecoderSTBFormat::ALL);
+    ImMedia_DecoderQOI_Install();
+
+    int failed = 0;
+    {
+        ImMedia::PackWriter writer;
+        ImVector<char>      name;
+        for (; i < argc; ++i)
+            if (!AddFile(writer, GetEntryName(argv[i], root, name), argv[i], encoding))
+                ++failed;
+
+        if (!writer.Write(output))
+        {
+            fprintf(stderr, "%s: can't write pack\n", output);
+            failed = -1;
+        }
+        else
+            printf("%s: %d entries\n", output, writer.GetEntryCount());
+    }
+
+    ImMedia::DestoryContext();
+    return failed == 0 ? 0 : 1;
+}
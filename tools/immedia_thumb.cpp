@@ -0,0 +1,421 @@
+// Generate thumbnails of image files on all cores with the installed decoders, no renderer is needed.
+//
+// Usage:
+//   immedia_thumb [options] <output dir> <file>...
+//
+// Options:
+//   --size <n>       Fit thumbnails in n x n pixels, 256 by default. Images are never upscaled.
+//   --png            Write png instead of qoi.
+//   --filter <name>  box, mitchell or lanczos3, box by default.
+//   --threads <n>    Worker threads, the number of hardware threads by default.
+//   --root <dir>     Strip dir from file paths, the rest names the thumbnail with separators replaced by '_'.
+//
+// Decoders supporting ImageDecoder::SetTargetSize decode at a reduced size first, e.g. JPEG by DCT scaling.
+// Files are split evenly between workers, a worker out of files steals the upper half of the largest remaining range.
+// Thumbnails are upright, EXIF orientation is applied to pixels. Animated images use the first frame.
+//
+// Build it with immedia sources, imgui, the stb and qoi decoders and stb_image_write.h:
+//   c++ -std=c++17 -O2 -Isrc -Isrc/decoder tools/immedia_thumb.cpp src/*.cpp
+//       src/decoder/immedia_decoder_stb.cpp src/decoder/immedia_decoder_qoi.cpp imgui/*.cpp -lpthread
+// Define IMMEDIA_THUMB_LIBJPEGTURBO and add src/decoder/immedia_decoder_libjpegturbo.cpp -lturbojpeg to decode jpeg
+// with libjpeg-turbo, which supports decoding at target size.
+// Define IMMEDIA_THUMB_LIBJXL and add src/decoder/immedia_decoder_libjxl.cpp -ljxl -ljxl_threads to decode jpeg xl,
+// each file on its worker thread since workers already use all cores.
+//
+
+#ifdef _MSC_VER
+#pragma warning (disable: 4996) // 'This function or variable may be unsafe'.
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#include "immedia_image.h"
+#include "immedia_pixel_convert.h"
+#include "immedia_resize.h"
+#include "immedia_thread_pool.h"
+#include "immedia_decoder_qoi.h"
+#include "immedia_decoder_stb.h"
+#ifdef IMMEDIA_THUMB_LIBJPEGTURBO
+#include "immedia_decoder_libjpegturbo.h"
+#endif
+#ifdef IMMEDIA_THUMB_LIBJXL
+#include "immedia_decoder_libjxl.h"
+#endif
+
+// Implemented in immedia_decoder_qoi.cpp.
+#include "qoi.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+struct ThumbOptions
+{
+    const char*           OutputDir = nullptr;
+    const char*           Root      = nullptr;
+    int                   Size      = 256;
+    bool                  PNG       = false;
+    ImMedia::ResizeFilter Filter    = ImMedia::ResizeFilter::Box;
+};
+
+// Range of file indices [begin, end) packed as begin << 32 | end, so it is popped and split with one CAS.
+// The owner pops from the front, thieves split off the upper half, only the owner refills it once it is empty.
+struct alignas(64) ThumbWorker
+{
+    std::atomic<uint64_t> Range{ 0 };
+};
+
+struct ThumbJob
+{
+    const ThumbOptions*   Options;
+    char**                Filenames;
+    ThumbWorker*          Workers;
+    int                   WorkerCount;
+    std::atomic<int>      NextWorker{ 0 };
+    std::atomic<int>      Failed{ 0 };
+    std::atomic<int>      Stolen{ 0 };
+    std::atomic<uint64_t> BytesRead{ 0 };
+};
+
+static inline uint64_t PackRange(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)begin << 32 | end;
+}
+
+static bool PopFront(ThumbWorker& worker, int* index)
+{
+    uint64_t range = worker.Range.load(std::memory_order_relaxed);
+    while (true)
+    {
+        const uint32_t begin = (uint32_t)(range >> 32);
+        const uint32_t end   = (uint32_t)range;
+        if (begin >= end)
+            return false;
+        if (worker.Range.compare_exchange_weak(range, PackRange(begin + 1, end), std::memory_order_acq_rel))
+        {
+            *index = (int)begin;
+            return true;
+        }
+    }
+}
+
+// Steal from the victim with most files left, the victim keeps the lower half, which it is working through.
+static bool Steal(ThumbJob* job, int thief)
+{
+    while (true)
+    {
+        int      victim = -1;
+        uint64_t range  = 0;
+        uint32_t most   = 0;
+        for (int i = 0; i < job->WorkerCount; ++i)
+        {
+            const uint64_t r = job->Workers[i].Range.load(std::memory_order_relaxed);
+            const uint32_t begin = (uint32_t)(r >> 32), end = (uint32_t)r;
+            if (i != thief && begin < end && end - begin > most)
+            {
+                victim = i;
+                range  = r;
+                most   = end - begin;
+            }
+        }
+        if (victim < 0)
+            return false;
+
+        const uint32_t begin = (uint32_t)(range >> 32);
+        const uint32_t end   = (uint32_t)range;
+        const uint32_t mid   = begin + (end - begin) / 2;
+        if (job->Workers[victim].Range.compare_exchange_strong(range, PackRange(begin, mid), std::memory_order_acq_rel))
+        {
+            // A single file is taken whole, the victim is left empty.
+            job->Workers[thief].Range.store(PackRange(mid, end), std::memory_order_release);
+            job->Stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+static bool ReadFile(const char* filename, ImVector<uint8_t>& data)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+        return false;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data.resize(size > 0 ? (int)size : 0);
+    bool ok = size > 0 && fread(data.Data, 1, (size_t)size, f) == (size_t)size;
+    fclose(f);
+    return ok;
+}
+
+static const ImMedia::ImageDecoder* FindDecoder(const char* filename, const ImVector<uint8_t>& data)
+{
+    const ImMedia::ImageDecoder* decoder = ImMedia::GetImageDecoder(ImMedia::DetectImageFormat(data.Data, (size_t)data.Size));
+    if (decoder)
+        return decoder;
+
+    const char* dot = strrchr(filename, '.');
+    char format[12] = {};
+    for (int i = 0; dot && dot[i + 1] != '\0' && i < (int)sizeof(format) - 1; ++i)
+        format[i] = (char)(dot[i + 1] >= 'A' && dot[i + 1] <= 'Z' ? dot[i + 1] - 'A' + 'a' : dot[i + 1]);
+    return ImMedia::GetImageDecoder(format);
+}
+
+static void GetOutputPath(const char* filename, const ThumbOptions& options, ImVector<char>& path)
+{
+    size_t root_size = options.Root ? strlen(options.Root) : 0;
+    if (root_size > 0 && strncmp(filename, options.Root, root_size) == 0)
+        filename += root_size;
+    while (*filename == '/' || *filename == '\\')
+        ++filename;
+    if (filename[0] == '.' && (filename[1] == '/' || filename[1] == '\\'))
+        filename += 2;
+
+    const char* dot       = strrchr(filename, '.');
+    const int   name_size = dot && !strpbrk(dot, "/\\") ? (int)(dot - filename) : (int)strlen(filename);
+    const char* extension = options.PNG ? ".png" : ".qoi";
+
+    path.resize(0);
+    for (const char* c = options.OutputDir; *c; ++c)
+        path.push_back(*c);
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        path.push_back('/');
+    for (int i = 0; i < name_size; ++i)
+        path.push_back(filename[i] == '/' || filename[i] == '\\' ? '_' : filename[i]);
+    for (const char* c = extension; *c; ++c)
+        path.push_back(*c);
+    path.push_back('\0');
+}
+
+// Rotate or flip stored pixels of width x height into display orientation.
+static void OrientPixels(const uint8_t* src, int width, int height, int pixel_size,
+                         ImMedia::ImageOrientation orientation, uint8_t* dst)
+{
+    const bool transposed     = IMAGE_ORIENTATION_IS_TRANSPOSED(orientation);
+    const int  display_width  = transposed ? height : width;
+    const int  display_height = transposed ? width : height;
+    for (int y = 0; y < display_height; ++y)
+        for (int x = 0; x < display_width; ++x)
+        {
+            int sx = x, sy = y;
+            switch (orientation)
+            {
+            case ImMedia::ImageOrientation::FlipHorizontal: sx = width - 1 - x;                   break;
+            case ImMedia::ImageOrientation::Rotate180:      sx = width - 1 - x; sy = height - 1 - y; break;
+            case ImMedia::ImageOrientation::FlipVertical:                       sy = height - 1 - y; break;
+            case ImMedia::ImageOrientation::Transpose:      sx = y;             sy = x;              break;
+            case ImMedia::ImageOrientation::Rotate90:       sx = y;             sy = height - 1 - x; break;
+            case ImMedia::ImageOrientation::Transverse:     sx = width - 1 - y; sy = height - 1 - x; break;
+            case ImMedia::ImageOrientation::Rotate270:      sx = width - 1 - y; sy = x;              break;
+            default: break;
+            }
+            memcpy(dst + ((size_t)y * display_width + x) * pixel_size,
+                   src + ((size_t)sy * width + sx) * pixel_size, pixel_size);
+        }
+}
+
+static bool WriteThumbnail(const char* path, const uint8_t* pixels, int width, int height, int channels, bool png)
+{
+    if (png)
+        return stbi_write_png(path, width, height, channels, pixels, width * channels) != 0;
+
+    qoi_desc desc;
+    desc.width      = (unsigned int)width;
+    desc.height     = (unsigned int)height;
+    desc.channels   = (unsigned char)channels;
+    desc.colorspace = QOI_SRGB;
+    int   qoi_size = 0;
+    void* qoi      = qoi_encode(pixels, &desc, &qoi_size);
+    if (!qoi)
+        return false;
+
+    FILE* f = fopen(path, "wb");
+    bool  ok = f && fwrite(qoi, 1, (size_t)qoi_size, f) == (size_t)qoi_size;
+    if (f && fclose(f) != 0)
+        ok = false;
+    free(qoi);
+    return ok;
+}
+
+static bool MakeThumbnail(const char* filename, const ThumbOptions& options, std::atomic<uint64_t>& bytes_read)
+{
+    ImVector<uint8_t> data;
+    if (!ReadFile(filename, data))
+    {
+        fprintf(stderr, "%s: can't read file\n", filename);
+        return false;
+    }
+    bytes_read.fetch_add((uint64_t)data.Size, std::memory_order_relaxed);
+
+    const ImMedia::ImageDecoder* decoder = FindDecoder(filename, data);
+    void* context = decoder ? decoder->CreateContextFromData(data.Data, (size_t)data.Size) : nullptr;
+    if (!context)
+    {
+        fprintf(stderr, "%s: %s\n", filename, decoder ? "can't decode file" : "no decoder");
+        return false;
+    }
+
+    const ImMedia::ImageOrientation orientation = decoder->GetOrientation ? decoder->GetOrientation(context) : ImMedia::ImageOrientation::Normal;
+    if (decoder->SetTargetSize)
+        decoder->SetTargetSize(context, options.Size, options.Size);
+
+    int                  width, height;
+    ImMedia::PixelFormat format;
+    decoder->GetInfo(context, &width, &height, &format, nullptr);
+
+    uint8_t* pixels = nullptr;
+    int      delay;
+    if (!ImMedia::ReadFinalFrame(context, decoder, &pixels, &delay))
+    {
+        fprintf(stderr, "%s: can't decode file\n", filename);
+        decoder->DeleteContext(context);
+        return false;
+    }
+
+    // Resize works on interleaved channels only.
+    bool              ok = true;
+    ImVector<uint8_t> converted;
+    if (format != ImMedia::PixelFormat::RGB888 && format != ImMedia::PixelFormat::RGBA8888)
+    {
+        converted.resize(width * height * 4);
+        ok = ImMedia::ConvertPixels(pixels, format, 0, converted.Data, ImMedia::PixelFormat::RGBA8888, 0, width, height);
+        pixels = converted.Data;
+        format = ImMedia::PixelFormat::RGBA8888;
+    }
+
+    int thumbnail_width, thumbnail_height;
+    ImMedia::FitSize(width, height, options.Size, options.Size, &thumbnail_width, &thumbnail_height);
+
+    const int         channels = PIXEL_FORMAT_SIZE(format);
+    ImVector<uint8_t> thumbnail;
+    thumbnail.resize(thumbnail_width * thumbnail_height * channels);
+    ok = ok && ImMedia::Resize(pixels, width, height, 0, thumbnail.Data, thumbnail_width, thumbnail_height, 0, format, options.Filter);
+    decoder->DeleteContext(context);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: can't convert pixels\n", filename);
+        return false;
+    }
+
+    if (orientation != ImMedia::ImageOrientation::Normal)
+    {
+        ImVector<uint8_t> oriented;
+        oriented.resize(thumbnail.Size);
+        OrientPixels(thumbnail.Data, thumbnail_width, thumbnail_height, channels, orientation, oriented.Data);
+        thumbnail.swap(oriented);
+        if (IMAGE_ORIENTATION_IS_TRANSPOSED(orientation))
+        {
+            const int stored_width = thumbnail_width;
+            thumbnail_width  = thumbnail_height;
+            thumbnail_height = stored_width;
+        }
+    }
+
+    ImVector<char> path;
+    GetOutputPath(filename, options, path);
+    if (!WriteThumbnail(path.Data, thumbnail.Data, thumbnail_width, thumbnail_height, channels, options.PNG))
+    {
+        fprintf(stderr, "%s: can't write file\n", path.Data);
+        return false;
+    }
+    return true;
+}
+
+static void WorkerMain(void* user_data)
+{
+    ThumbJob* job  = reinterpret_cast<ThumbJob*>(user_data);
+    const int self = job->NextWorker.fetch_add(1, std::memory_order_relaxed);
+
+    int index;
+    while (PopFront(job->Workers[self], &index) || (Steal(job, self) && PopFront(job->Workers[self], &index)))
+        if (!MakeThumbnail(job->Filenames[index], *job->Options, job->BytesRead))
+            job->Failed.fetch_add(1, std::memory_order_relaxed);
+}
+
+int main(int argc, char** argv)
+{
+    ThumbOptions options;
+    int          thread_count = 0;
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; ++i)
+    {
+        if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+            options.Size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--png") == 0)
+            options.PNG = true;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            thread_count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--root") == 0 && i + 1 < argc)
+            options.Root = argv[++i];
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            if (strcmp(name, "box") == 0)
+                options.Filter = ImMedia::ResizeFilter::Box;
+            else if (strcmp(name, "mitchell") == 0)
+                options.Filter = ImMedia::ResizeFilter::Mitchell;
+            else if (strcmp(name, "lanczos3") == 0)
+                options.Filter = ImMedia::ResizeFilter::Lanczos3;
+            else
+            {
+                fprintf(stderr, "unknown filter %s\n", name);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (argc - i < 2 || options.Size <= 0)
+    {
+        fprintf(stderr, "usage: %s [--size <n>] [--png] [--filter <name>] [--threads <n>] [--root <dir>] <output dir> <file>...\n", argv[0]);
+        return 1;
+    }
+    options.OutputDir = argv[i++];
+
+    ImMedia::CreateContext();
+    ImMedia_DecoderSTB_Install(DecoderSTBFormat::ALL);
+    ImMedia_DecoderQOI_Install();
+#ifdef IMMEDIA_THUMB_LIBJPEGTURBO
+    ImMedia_DecoderLibjpegTurbo_Install(false);
+#endif
+#ifdef IMMEDIA_THUMB_LIBJXL
+    ImMedia_DecoderLibjxl_Install(false, 1);
+#endif
+
+    const int file_count = argc - i;
+    int       failed;
+    {
+        ImMedia::ThreadPool pool(thread_count);
+        ThumbJob job;
+        job.Options     = &options;
+        job.Filenames   = argv + i;
+        job.WorkerCount = pool.GetThreadCount();
+        job.Workers     = new ThumbWorker[job.WorkerCount];
+        for (int w = 0; w < job.WorkerCount; ++w)
+            job.Workers[w].Range.store(PackRange((uint32_t)((int64_t)file_count * w / job.WorkerCount),
+                                                 (uint32_t)((int64_t)file_count * (w + 1) / job.WorkerCount)));
+
+        const auto begin = std::chrono::steady_clock::now();
+        for (int w = 0; w < job.WorkerCount; ++w)
+            pool.Submit(WorkerMain, &job);
+        pool.Wait();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        failed = job.Failed.load();
+        const double megabytes = (double)job.BytesRead.load() / (1024.0 * 1024.0);
+        printf("%d thumbnails, %d failed, %d threads, %d steals in %.3f s: %.1f files/s, %.1f MB/s read\n",
+               file_count - failed, failed, job.WorkerCount, job.Stolen.load(), seconds,
+               seconds > 0.0 ? file_count / seconds : 0.0, seconds > 0.0 ? megabytes / seconds : 0.0);
+        delete[] job.Workers;
+    }
+
+    ImMedia::DestoryContext();
+    return failed == 0 ? 0 : 1;
+}